@@ -0,0 +1,410 @@
+/* Measures how fast the emulator core runs.
+ *
+ * Usage: bench [-r rom.bin] [-t test.bin] [-b baseline] [-s seconds]
+ *
+ * Every workload is run unthrottled, repeatedly, until at least the
+ * given number of seconds (default 1) has elapsed. For every workload,
+ * one line is written to standard output, with the following
+ * whitespace-separated fields:
+ *
+ *   name instructions cycles seconds ips cps ns_per_insn
+ *
+ * Lines starting with # are comments. When a baseline file (in the
+ * same format, e.g. the output of a previous run) is given, two more
+ * fields are added: the baseline's instructions per second and the
+ * ratio of the current value to that.
+ *
+ * Workloads that need a file that cannot be read are skipped.
+ */
+#define HM1K_UNTHROTTLED
+
+#include "hm1000.h"
+
+#include "hm1000.c"
+
+/** Addresses of entries in the ROM's jump table. */
+#define ROM_CLSHOME 0xe006
+#define ROM_SHOWCHR 0xe009
+#define ROM_SCROLLUP 0xe021
+#define ROM_SAVECART 0xe027
+
+/** Locations of the variables holding the cartridge block size and
+ * how savecart writes, and the CARTMODE bit that makes it skip blocks
+ * that already hold the data. */
+#define CARTBSZ 0x0206
+#define CARTMODE 0x0208
+#define CARTSKIP 0x01
+
+/** Locations of the page the console draws on and of the console mode,
+ * and the CONMODE bit that enables double buffering. These are set up
+ * by the ROM's startup code, which workloads that call ROM procedures
+ * directly skip. */
+#define VIDBASE 0x88
+#define CONMODE 0x0209
+#define CONDBL 0x01
+
+/** Number of bytes and block size used by the savecart workload. */
+#define SAVECART_BYTES 0x1000
+#define SAVECART_BLOCK 32
+
+/** Number of times the scroll workload scrolls the screen. */
+#define SCROLL_LINES 100
+
+/** Address programs are loaded at. */
+#define START 0x0400
+
+/** Return address used to detect that a called program has returned. */
+#define RETURN_ADDRESS 0xfffc
+
+/** Workloads that run for more instructions than this are assumed to
+ * be stuck. */
+#define MAX_INSTRUCTIONS 100000000UL
+
+#define MAX_WORKLOADS 16
+
+typedef struct {
+  const char *name;
+  unsigned long instructions;
+  unsigned long cycles;
+  double seconds;
+} bench_result;
+
+typedef struct {
+  uint8_t ram[RAM_SIZE];
+  uint8_t rom[ROM_SIZE];
+  uint8_t *cartridge;
+  size_t cartridge_size;
+  uint8_t test[RAM_SIZE - START];
+  size_t test_size;
+  bool have_rom, have_test;
+} bench_data;
+
+typedef unsigned long (*workload_fn) (hm1k_state *s, bench_data *d);
+
+typedef struct {
+  const char *name;
+  workload_fn run;
+} workload;
+
+/* Prints a character from 0x40 to 0x7f, 8192 times. This causes the
+ * text to scroll about 180 times. */
+static const uint8_t text_program[] = {
+  0x20, ROM_CLSHOME & 0xff, ROM_CLSHOME >> 8, /* jsr clshome */
+  0xa9, 0x00,                   /* lda #0 */
+  0x85, 0x00,                   /* sta $00 */
+  0xa9, 0x20,                   /* lda #$20 */
+  0x85, 0x01,                   /* sta $01 */
+  0xa5, 0x00,                   /* loop: lda $00 */
+  0x29, 0x3f,                   /* and #$3f */
+  0x09, 0x40,                   /* ora #$40 */
+  0x20, ROM_SHOWCHR & 0xff, ROM_SHOWCHR >> 8, /* jsr showchr */
+  0xc6, 0x00,                   /* dec $00 */
+  0xd0, 0xf3,                   /* bne loop */
+  0xc6, 0x01,                   /* dec $01 */
+  0xd0, 0xef,                   /* bne loop */
+  0x60,                         /* rts */
+};
+
+static double elapsed(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) +
+    (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/** Reads up to size bytes from path into buf, storing the number read
+ * in *bytes_read unless bytes_read is NULL. */
+static bool read_file(const char *path, uint8_t *buf, size_t size,
+                      size_t *bytes_read) {
+  FILE *f = fopen(path, "rb");
+  size_t n;
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  n = fread(buf, 1, size, f);
+  if (bytes_read) *bytes_read = n;
+  fclose(f);
+  return true;
+}
+
+/** Runs until the program counter no longer changes, i.e. the program
+ * has reached a jmp to itself. Returns the number of instructions
+ * executed. */
+static unsigned long run_until_halt(hm1k_state *s) {
+  unsigned long n = 0;
+  uint16_t pc;
+  do {
+    pc = s->pc;
+    step_6502(s);
+    if (++n > MAX_INSTRUCTIONS) FATALF("stuck at $%04x", s->pc);
+  } while (s->pc != pc);
+  return n;
+}
+
+/** Calls the subroutine at addr and runs until it returns. Returns
+ * the number of instructions executed. */
+static unsigned long run_call(hm1k_state *s, uint16_t addr) {
+  unsigned long n = 0;
+  push_u16(s, RETURN_ADDRESS - 1);
+  s->pc = addr;
+  while (s->pc != RETURN_ADDRESS) {
+    step_6502(s);
+    if (++n > MAX_INSTRUCTIONS) FATALF("stuck at $%04x", s->pc);
+  }
+  return n;
+}
+
+static void init_bench(hm1k_state *s, bench_data *d,
+                       uint8_t *cartridge, size_t cartridge_size) {
+  randomize(d->ram, sizeof(d->ram));
+  init_hm1000_cartridge(s, d->ram, d->rom, cartridge, cartridge_size);
+  reset(s);
+}
+
+/** Sets up the console as the ROM's startup code does, with the given
+ * mode. */
+static void init_console(bench_data *d, uint8_t mode) {
+  d->ram[VIDBASE] = VIDEO_BASE >> 8;
+  d->ram[CONMODE] = mode;
+}
+
+/** Boots the ROM without a cartridge, up to the point where it reports
+ * that no cartridge could be loaded. */
+static unsigned long workload_boot(hm1k_state *s, bench_data *d) {
+  if (!d->have_rom) return 0;
+  init_bench(s, d, NULL, 0);
+  return run_until_halt(s);
+}
+
+/** Boots the ROM with a cartridge holding a large program, up to the
+ * point where the program has been loaded and started. */
+static unsigned long workload_cartridge(hm1k_state *s, bench_data *d) {
+  if (!d->have_rom) return 0;
+  init_bench(s, d, d->cartridge, d->cartridge_size);
+  return run_until_halt(s);
+}
+
+/** Generates random numbers with micrornd. */
+static unsigned long workload_micrornd(hm1k_state *s, bench_data *d) {
+  unsigned long n = 0;
+  int i;
+  if (!d->have_test) return 0;
+  init_bench(s, d, NULL, 0);
+  memcpy(&d->ram[START], d->test, d->test_size);
+  s->s = 0xff;
+  for (i = 0; i < 0x10000; i++) {
+    n += run_call(s, START);
+  }
+  return n;
+}
+
+/** Writes text to the screen, scrolling it many times. */
+static unsigned long workload_text(hm1k_state *s, bench_data *d) {
+  if (!d->have_rom) return 0;
+  init_bench(s, d, NULL, 0);
+  init_console(d, 0);
+  memcpy(&d->ram[START], text_program, sizeof(text_program));
+  s->s = 0xff;
+  return run_call(s, START);
+}
+
+/** Scrolls the screen up SCROLL_LINES times, one line at a time, as
+ * printing a newline on the last line does. The cycles divided by
+ * SCROLL_LINES are the cost of scrolling a line. */
+static unsigned long run_scroll(hm1k_state *s, bench_data *d,
+                                uint8_t mode) {
+  unsigned long n = 0;
+  int i;
+  if (!d->have_rom) return 0;
+  init_bench(s, d, NULL, 0);
+  init_console(d, mode);
+  s->s = 0xff;
+  for (i = 0; i < SCROLL_LINES; i++) {
+    s->a = 1;
+    n += run_call(s, ROM_SCROLLUP);
+  }
+  return n;
+}
+
+static unsigned long workload_scroll(hm1k_state *s, bench_data *d) {
+  return run_scroll(s, d, 0);
+}
+
+/** Like scroll, but double-buffered: every scroll is drawn in the video
+ * area that is not shown, and then shown. */
+static unsigned long workload_dblscroll(hm1k_state *s, bench_data *d) {
+  return run_scroll(s, d, CONDBL);
+}
+
+/** Calls savecart to save SAVECART_BYTES from START to cartridge
+ * location $00000010, in 32-byte blocks. */
+static unsigned long run_savecart(hm1k_state *s, bench_data *d,
+                                  uint8_t mode) {
+  unsigned long n;
+  d->ram[CARTBSZ] = SAVECART_BLOCK;
+  d->ram[CARTBSZ + 1] = 0;
+  d->ram[CARTMODE] = mode;
+  d->ram[0xa0] = 0x10;
+  d->ram[0xa1] = 0;
+  d->ram[0xa2] = 0;
+  d->ram[0xa3] = 0;
+  d->ram[0xa4] = SAVECART_BYTES & 0xff;
+  d->ram[0xa5] = SAVECART_BYTES >> 8;
+  d->ram[0xa6] = START & 0xff;
+  d->ram[0xa7] = START >> 8;
+  s->s = 0xff;
+  n = run_call(s, ROM_SAVECART);
+  if (s->a != 0) FATALF("savecart failed with $%02x", s->a);
+  return n;
+}
+
+/** Saves 4 KiB to the cartridge in 32-byte blocks. Each block takes
+ * a write cycle of the EEPROM, so most of the time is spent polling
+ * for the cartridge to become ready again. */
+static unsigned long workload_savecart(hm1k_state *s, bench_data *d) {
+  if (!d->have_rom) return 0;
+  init_bench(s, d, d->cartridge, d->cartridge_size);
+  return run_savecart(s, d, 0);
+}
+
+/** Saves 4 KiB that the cartridge already holds, skipping unchanged
+ * blocks. Only reads from the cartridge. */
+static unsigned long workload_resave(hm1k_state *s, bench_data *d) {
+  if (!d->have_rom) return 0;
+  init_bench(s, d, d->cartridge, d->cartridge_size);
+  memcpy(&d->ram[START], &d->cartridge[0x10], SAVECART_BYTES);
+  return run_savecart(s, d, CARTSKIP);
+}
+
+static const workload workloads[] = {
+  { "boot", workload_boot },
+  { "text", workload_text },
+  { "scroll", workload_scroll },
+  { "dblscroll", workload_dblscroll },
+  { "micrornd", workload_micrornd },
+  { "cartridge", workload_cartridge },
+  { "savecart", workload_savecart },
+  { "resave", workload_resave },
+};
+
+/** Creates a cartridge image holding a 28 KiB program, which is
+ * loaded at $4000 and consists of a jmp to itself followed by nops. */
+static void make_cartridge(bench_data *d) {
+  static const uint8_t header[] = {
+    'H', 'M', 0x00, 0x01,
+    0x00, 0x40,                 /* entry point */
+    0x20, 0x00,                 /* bytes per page */
+    0x10, 0x00,                 /* position on cartridge */
+    0x00, 0x70,                 /* number of bytes */
+    0x00, 0x40,                 /* load address */
+    0x00, 0x00,
+  };
+  d->cartridge_size = sizeof(header) + 0x7000;
+  d->cartridge = malloc(d->cartridge_size);
+  if (!d->cartridge) FATAL("failed to allocate memory for cartridge");
+  memset(d->cartridge, 0xea, d->cartridge_size);
+  memcpy(d->cartridge, header, sizeof(header));
+  d->cartridge[sizeof(header)] = 0x4c;     /* jmp $4000 */
+  d->cartridge[sizeof(header) + 1] = 0x00;
+  d->cartridge[sizeof(header) + 2] = 0x40;
+}
+
+/** Reads results from a file written by an earlier run. Returns the
+ * number of results read. */
+static size_t read_baseline(const char *path, bench_result *results,
+                            char names[][32], size_t max) {
+  char line[256];
+  size_t n = 0;
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return 0;
+  }
+  while (n < max && fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%31s %lu %lu %lf", names[n],
+               &results[n].instructions, &results[n].cycles,
+               &results[n].seconds) != 4) continue;
+    results[n].name = names[n];
+    ++n;
+  }
+  fclose(f);
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  static hm1k_state state;
+  static bench_data data;
+  const char *rom_path = "rom.bin";
+  const char *test_path = "test.bin";
+  const char *baseline_path = NULL;
+  double min_seconds = 1.0;
+  bench_result baseline[MAX_WORKLOADS];
+  char baseline_names[MAX_WORKLOADS][32];
+  size_t nbaseline = 0, i, j;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:r:s:t:")) != -1) {
+    switch (opt) {
+    case 'b':
+      baseline_path = optarg;
+      break;
+    case 'r':
+      rom_path = optarg;
+      break;
+    case 's':
+      min_seconds = atof(optarg);
+      break;
+    case 't':
+      test_path = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-r rom.bin] [-t test.bin]"
+              " [-b baseline] [-s seconds]\n", argv[0]);
+      return 0x80;
+    }
+  }
+
+  data.have_rom = read_file(rom_path, data.rom, ROM_SIZE, NULL);
+  data.have_test = read_file(test_path, data.test, sizeof(data.test),
+                             &data.test_size);
+  make_cartridge(&data);
+  if (baseline_path) {
+    nbaseline = read_baseline(baseline_path, baseline, baseline_names,
+                              MAX_WORKLOADS);
+  }
+
+  printf("# name instructions cycles seconds ips cps ns_per_insn%s\n",
+         nbaseline ? " baseline_ips ratio" : "");
+  for (i = 0; i < sizeof(workloads) / sizeof(*workloads); i++) {
+    bench_result r = { workloads[i].name, 0, 0, 0.0 };
+    struct timespec start;
+    double ips;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+      unsigned long n = workloads[i].run(&state, &data);
+      if (n == 0) break;
+      r.instructions += n;
+      r.cycles += state.cycles;
+      r.seconds = elapsed(&start);
+    } while (r.seconds < min_seconds);
+    if (r.instructions == 0) {
+      printf("# %s skipped\n", r.name);
+      continue;
+    }
+    ips = r.instructions / r.seconds;
+    printf("%s %lu %lu %.6f %.0f %.0f %.3f",
+           r.name, r.instructions, r.cycles, r.seconds,
+           ips, r.cycles / r.seconds, 1e9 * r.seconds / r.instructions);
+    for (j = 0; j < nbaseline; j++) {
+      if (strcmp(baseline[j].name, r.name) == 0) {
+        double base_ips = baseline[j].instructions / baseline[j].seconds;
+        printf(" %.0f %.3f", base_ips, ips / base_ips);
+        break;
+      }
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "coverage.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+void init_coverage(hm1k_coverage *c) {
+  memset(c, 0, sizeof(*c));
+  memcpy(c->magic, COVERAGE_MAGIC, 4);
+  c->version = COVERAGE_VERSION;
+}
+
+static bool valid_coverage(const hm1k_coverage *c) {
+  return memcmp(c->magic, COVERAGE_MAGIC, 4) == 0 &&
+    c->version == COVERAGE_VERSION;
+}
+
+int read_coverage(hm1k_coverage *c, const char *path) {
+  FILE *f = fopen(path, "rb");
+  size_t n;
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  n = fread(c, 1, sizeof(*c), f);
+  fclose(f);
+  if (n != sizeof(*c) || !valid_coverage(c)) {
+    fprintf(stderr, "%s: not a coverage file or unsupported version\n",
+            path);
+    return -1;
+  }
+  return 0;
+}
+
+void add_coverage(hm1k_coverage *dest, const hm1k_coverage *src) {
+  size_t i;
+  for (i = 0; i < sizeof(dest->executed); i++) {
+    dest->executed[i] |= src->executed[i];
+    dest->taken[i] |= src->taken[i];
+    dest->not_taken[i] |= src->not_taken[i];
+  }
+}
+
+int merge_coverage(const hm1k_coverage *c, const char *path) {
+  hm1k_coverage merged;
+  ssize_t n;
+  int fd, result = -1;
+
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd == -1) {
+    perror(path);
+    return -1;
+  }
+  if (flock(fd, LOCK_EX)) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  n = read(fd, &merged, sizeof(merged));
+  if (n == 0) {
+    init_coverage(&merged);
+  } else if (n != sizeof(merged) || !valid_coverage(&merged)) {
+    fprintf(stderr, "%s: not a coverage file or unsupported version\n",
+            path);
+    goto done;
+  }
+  add_coverage(&merged, c);
+  if (lseek(fd, 0, SEEK_SET) != 0 ||
+      write(fd, &merged, sizeof(merged)) != sizeof(merged)) {
+    perror(path);
+    goto done;
+  }
+  result = 0;
+ done:
+  /* Closing the file releases the lock. */
+  close(fd);
+  return result;
+}
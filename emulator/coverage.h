@@ -0,0 +1,49 @@
+#ifndef HOMEMICRO_EMULATOR_COVERAGE
+#define HOMEMICRO_EMULATOR_COVERAGE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Coverage files consist of a single hm1k_coverage. Every bitmap has
+ * one bit per address, with bit (addr & 7) of byte (addr >> 3)
+ * corresponding to addr. Merging files ORs the bitmaps together, so
+ * that the results of several runs can be combined in any order.
+ */
+
+#define COVERAGE_MAGIC "HMCV"
+#define COVERAGE_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  /* Addresses at which an instruction started executing. */
+  uint8_t executed[0x10000 / 8];
+  /* Addresses of branches that were taken at least once. */
+  uint8_t taken[0x10000 / 8];
+  /* Addresses of branches that were not taken at least once. */
+  uint8_t not_taken[0x10000 / 8];
+} hm1k_coverage;
+
+/** Initializes c to hold no coverage. */
+void init_coverage(hm1k_coverage *c);
+
+/** Reads a coverage file into c. Returns 0 on success. */
+int read_coverage(hm1k_coverage *c, const char *path);
+
+/** Adds c to the coverage file at path, creating it if it does not
+ * exist. The file is locked while it is updated, so this is safe to
+ * call from several processes at once. Returns 0 on success. */
+int merge_coverage(const hm1k_coverage *c, const char *path);
+
+/** ORs the bitmaps in src into dest. */
+void add_coverage(hm1k_coverage *dest, const hm1k_coverage *src);
+
+static inline bool coverage_bit(const uint8_t *bitmap, uint16_t addr) {
+  return bitmap[addr >> 3] & (1 << (addr & 7));
+}
+
+static inline void set_coverage_bit(uint8_t *bitmap, uint16_t addr) {
+  bitmap[addr >> 3] |= 1 << (addr & 7);
+}
+
+#endif /* ndef HOMEMICRO_EMULATOR_COVERAGE */
@@ -0,0 +1,189 @@
+#include "disas.h"
+#include "hm1000.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OP(CODE, NAME, MODE, CYCLES) #NAME,
+static const char *const mnemonics[256] = {
+#include "ops.inc"
+};
+#undef OP
+
+#define OP(CODE, NAME, MODE, CYCLES) MODE_ ## MODE,
+static const uint8_t modes[256] = {
+#include "ops.inc"
+};
+#undef OP
+
+/** Length of an instruction, indexed by addressing mode. */
+static const uint8_t mode_lengths[] = {
+  [MODE_abs] = 3,
+  [MODE_absx] = 3,
+  [MODE_absy] = 3,
+  [MODE_imm] = 2,
+  [MODE_impl] = 1,
+  [MODE_ind] = 3,
+  [MODE_ix] = 2,
+  [MODE_iy] = 2,
+  [MODE_ni] = 1,
+  [MODE_rel] = 2,
+  [MODE_zp] = 2,
+  [MODE_zpx] = 2,
+  [MODE_zpy] = 2,
+};
+
+unsigned int disas_length(uint8_t op) {
+  return mode_lengths[modes[op]];
+}
+
+const char *disas_mnemonic(uint8_t op) {
+  return mnemonics[op];
+}
+
+/** Formats an address as a label if there is one, or as hex. */
+static void format_addr(char *buf, size_t size, uint16_t addr,
+                        int digits, const hm1k_labels *labels) {
+  const char *label = labels ? find_label(labels, addr) : NULL;
+  if (label) snprintf(buf, size, "%s", label);
+  else snprintf(buf, size, "$%0*x", digits, addr);
+}
+
+unsigned int disassemble(char *buf, size_t size, uint16_t addr,
+                         const uint8_t *bytes, const hm1k_labels *labels) {
+  const uint8_t op = bytes[0];
+  const char *name = mnemonics[op];
+  const uint16_t abs = bytes[1] | (bytes[2] << 8);
+  char operand[64];
+
+  switch (modes[op]) {
+  case MODE_abs:
+    format_addr(operand, sizeof(operand), abs, 4, labels);
+    snprintf(buf, size, "%s %s", name, operand);
+    break;
+  case MODE_absx:
+    format_addr(operand, sizeof(operand), abs, 4, labels);
+    snprintf(buf, size, "%s %s, x", name, operand);
+    break;
+  case MODE_absy:
+    format_addr(operand, sizeof(operand), abs, 4, labels);
+    snprintf(buf, size, "%s %s, y", name, operand);
+    break;
+  case MODE_imm:
+    snprintf(buf, size, "%s #$%02x", name, bytes[1]);
+    break;
+  case MODE_impl:
+    /* asla, lsra, rola, and rora operate on the accumulator. */
+    if (strlen(name) == 4) snprintf(buf, size, "%.3s", name);
+    else snprintf(buf, size, "%s", name);
+    break;
+  case MODE_ind:
+    format_addr(operand, sizeof(operand), abs, 4, labels);
+    snprintf(buf, size, "%s (%s)", name, operand);
+    break;
+  case MODE_ix:
+    format_addr(operand, sizeof(operand), bytes[1], 2, labels);
+    snprintf(buf, size, "%s (%s,x)", name, operand);
+    break;
+  case MODE_iy:
+    format_addr(operand, sizeof(operand), bytes[1], 2, labels);
+    snprintf(buf, size, "%s (%s), y", name, operand);
+    break;
+  case MODE_rel:
+    format_addr(operand, sizeof(operand),
+                addr + 2 + (int8_t) bytes[1], 4, labels);
+    snprintf(buf, size, "%s %s", name, operand);
+    break;
+  case MODE_zp:
+    format_addr(operand, sizeof(operand), bytes[1], 2, labels);
+    snprintf(buf, size, "%s %s", name, operand);
+    break;
+  case MODE_zpx:
+    format_addr(operand, sizeof(operand), bytes[1], 2, labels);
+    snprintf(buf, size, "%s %s, x", name, operand);
+    break;
+  case MODE_zpy:
+    format_addr(operand, sizeof(operand), bytes[1], 2, labels);
+    snprintf(buf, size, "%s %s, y", name, operand);
+    break;
+  default:
+    snprintf(buf, size, ".byt $%02x", op);
+  }
+  return mode_lengths[modes[op]];
+}
+
+void init_labels(hm1k_labels *labels) {
+  labels->labels = NULL;
+  labels->count = 0;
+}
+
+static int compare_labels(const void *a, const void *b) {
+  const hm1k_label *x = a, *y = b;
+  if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+int load_labels(hm1k_labels *labels, const char *path) {
+  char line[256], name[128];
+  unsigned int addr;
+  size_t capacity = labels->count;
+  hm1k_label *l;
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  /* xa writes lines of the form "name, 0x1234, 1, 0x0000". */
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, " %127[^, ] , %x", name, &addr) != 2) continue;
+    if (labels->count == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      l = realloc(labels->labels, capacity * sizeof(*l));
+      if (!l) {
+        fclose(f);
+        return -1;
+      }
+      labels->labels = l;
+    }
+    l = &labels->labels[labels->count++];
+    l->name = strdup(name);
+    l->addr = addr;
+  }
+  fclose(f);
+  qsort(labels->labels, labels->count, sizeof(*labels->labels),
+        compare_labels);
+  return 0;
+}
+
+void free_labels(hm1k_labels *labels) {
+  size_t i;
+  for (i = 0; i < labels->count; i++) free(labels->labels[i].name);
+  free(labels->labels);
+  init_labels(labels);
+}
+
+const char *find_label(const hm1k_labels *labels, uint16_t addr) {
+  size_t lo = 0, hi = labels->count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (labels->labels[mid].addr < addr) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo < labels->count && labels->labels[lo].addr == addr) {
+    return labels->labels[lo].name;
+  }
+  return NULL;
+}
+
+int find_label_addr(const hm1k_labels *labels, const char *name,
+                    uint16_t *addr) {
+  size_t i;
+  for (i = 0; i < labels->count; i++) {
+    if (strcmp(labels->labels[i].name, name) == 0) {
+      *addr = labels->labels[i].addr;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,53 @@
+#ifndef HOMEMICRO_EMULATOR_DISAS
+#define HOMEMICRO_EMULATOR_DISAS
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A label read from a label file written by xa -l. */
+typedef struct {
+  char *name;
+  uint16_t addr;
+} hm1k_label;
+
+/** A set of labels, sorted by address. */
+typedef struct {
+  hm1k_label *labels;
+  size_t count;
+} hm1k_labels;
+
+/** Returns the length in bytes of the instruction with the given
+ * opcode. */
+unsigned int disas_length(uint8_t op);
+
+/** Returns the mnemonic for the given opcode, e.g. "lda". */
+const char *disas_mnemonic(uint8_t op);
+
+/**
+ * Disassembles the instruction at addr, whose bytes are given in
+ * bytes (only the first disas_length(bytes[0]) bytes are used).
+ * Writes the text to buf, which has room for size bytes. When labels
+ * is not NULL, operands that match a label are shown as that label.
+ * Returns the length of the instruction.
+ */
+unsigned int disassemble(char *buf, size_t size, uint16_t addr,
+                         const uint8_t *bytes, const hm1k_labels *labels);
+
+/** Initializes labels to hold no labels. */
+void init_labels(hm1k_labels *labels);
+
+/** Adds the labels in an xa label file. Returns 0 on success. */
+int load_labels(hm1k_labels *labels, const char *path);
+
+/** Frees the memory held by labels. */
+void free_labels(hm1k_labels *labels);
+
+/** Returns the label for addr, or NULL if there is none. */
+const char *find_label(const hm1k_labels *labels, uint16_t addr);
+
+/** Looks up a label by name. Returns 0 and stores its address in addr
+ * if found, nonzero otherwise. */
+int find_label_addr(const hm1k_labels *labels, const char *name,
+                    uint16_t *addr);
+
+#endif /* ndef HOMEMICRO_EMULATOR_DISAS */
@@ -0,0 +1,93 @@
+#include "eeprom.h"
+
+#include <string.h>
+
+/** Returns true if the device is still storing a page. */
+static bool eeprom_busy(const hm1k_eeprom *e) {
+  return e->clock && *e->clock < e->busy_until;
+}
+
+/** Returns the number of bytes of the page at offset page that lie
+ * within data. */
+static size_t page_bytes(const hm1k_eeprom *e, size_t page) {
+  return e->size - page < e->page_size ? e->size - page : e->page_size;
+}
+
+static bool eeprom_start(hm1k_twi_device *dev, uint8_t addr_byte) {
+  hm1k_eeprom *e = (hm1k_eeprom*) dev;
+  /* The device ignores its address while it is storing a page. The
+   * ROM polls for the acknowledge to find out when it is done. */
+  if (eeprom_busy(e)) return false;
+  /* A write that is not ended by a stop condition is discarded. */
+  e->written = false;
+  if ((addr_byte & 1) == 0) {
+    /* Block select bits in the device address that are not part of
+     * the device's own address form the top bits of the memory
+     * address. */
+    e->addr = (addr_byte & ~e->dev.addr_mask & 0x0e) >> 1;
+    e->addr_bytes = 2;
+  }
+  return true;
+}
+
+static bool eeprom_write(hm1k_twi_device *dev, uint8_t byte) {
+  hm1k_eeprom *e = (hm1k_eeprom*) dev;
+  const size_t mask = e->page_size - 1;
+  if (e->addr_bytes > 0) {
+    e->addr = (e->addr << 8) | byte;
+    /* Wrap the address here, so that the page and the byte within it
+     * both come from the same address that a read would use. */
+    if (--e->addr_bytes == 0) e->addr %= e->size;
+    return true;
+  }
+  if (!e->written) {
+    e->page = e->addr & ~mask;
+    memcpy(e->page_buffer, e->data + e->page, page_bytes(e, e->page));
+    e->written = true;
+  }
+  e->page_buffer[e->addr & mask] = byte;
+  /* Only the bits that select a byte within the page are
+   * incremented. */
+  e->addr = (e->addr & ~mask) | ((e->addr + 1) & mask);
+  return true;
+}
+
+static uint8_t eeprom_read(hm1k_twi_device *dev) {
+  hm1k_eeprom *e = (hm1k_eeprom*) dev;
+  return e->data[e->addr++ % e->size];
+}
+
+static void eeprom_stop(hm1k_twi_device *dev) {
+  hm1k_eeprom *e = (hm1k_eeprom*) dev;
+  if (!e->written) return;
+  memcpy(e->data + e->page, e->page_buffer, page_bytes(e, e->page));
+  if (e->clock) e->busy_until = *e->clock + e->write_time;
+  e->written = false;
+}
+
+void init_eeprom(hm1k_eeprom *e, uint8_t *data, size_t size,
+                 size_t page_size) {
+  e->dev.addr = 0xa0;
+  e->dev.addr_mask = 0xf0;
+  e->dev.start = eeprom_start;
+  e->dev.write = eeprom_write;
+  e->dev.read = eeprom_read;
+  e->dev.stop = eeprom_stop;
+  e->data = data;
+  e->size = size;
+  e->addr = 0;
+  e->addr_bytes = 0;
+  e->written = false;
+  e->page_size = page_size;
+  e->page = 0;
+  e->clock = NULL;
+  e->write_time = 0;
+  e->busy_until = 0;
+}
+
+void set_eeprom_timing(hm1k_eeprom *e, const unsigned long *clock,
+                       unsigned long write_time) {
+  e->clock = clock;
+  e->write_time = write_time;
+  e->busy_until = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef HOMEMICRO_EMULATOR_EEPROM
+#define HOMEMICRO_EMULATOR_EEPROM
+
+#include "twi.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A 24-series serial EEPROM, as used in cartridges. By default, the
+ * device responds to TWI addresses 1010xxx, where xxx are the top bits
+ * of the memory address. Devices that only respond to some of those
+ * addresses, as set in dev.addr and dev.addr_mask, use the remaining
+ * bits. Writing sets the memory address from the next two
+ * bytes. Any bytes after those go into a page buffer, wrapping around
+ * at the end of the page, and are stored when the master sends a stop
+ * condition. After that, the device is busy for a while and does not
+ * acknowledge its address. Reading returns bytes from the current
+ * memory address. The address wraps around at the end of memory.
+ */
+
+/** Largest supported page size. */
+#define EEPROM_MAX_PAGE_SIZE 256
+
+typedef struct {
+  hm1k_twi_device dev;
+  uint8_t *data;
+  size_t size;
+  size_t addr;
+  /* Number of address bytes still expected in the current write. */
+  uint8_t addr_bytes;
+  /* Whether the page buffer holds data to be stored on stop. */
+  bool written;
+  /* Size of a page. A power of 2, at most EEPROM_MAX_PAGE_SIZE. */
+  size_t page_size;
+  /* Offset in data of the page in the page buffer. */
+  size_t page;
+  uint8_t page_buffer[EEPROM_MAX_PAGE_SIZE];
+  /* Time is measured by the counter clock points to, if not NULL.
+   * Storing a page takes write_time, and the device is busy until the
+   * counter reaches busy_until. */
+  const unsigned long *clock;
+  unsigned long write_time;
+  unsigned long busy_until;
+} hm1k_eeprom;
+
+/** Initializes e to hold size bytes at data, with the given page size
+ * and no write time. */
+void init_eeprom(hm1k_eeprom *e, uint8_t *data, size_t size,
+                 size_t page_size);
+
+/** Makes storing a page take write_time ticks of clock. */
+void set_eeprom_timing(hm1k_eeprom *e, const unsigned long *clock,
+                       unsigned long write_time);
+
+#endif /* ndef HOMEMICRO_EMULATOR_EEPROM */
@@ -1,4 +1,10 @@
+#include "coverage.h"
+#include "eeprom.h"
 #include "hm1000.h"
+#include "sound.h"
+#include "trace.h"
+#include "twi.h"
+#include "video.h"
 #include "xcb.h"
 
 #include <fcntl.h>
@@ -38,20 +44,41 @@
 
 #define ROM_SIZE 0x2000
 
+#define VMODE 0xd001
 #define KBDCOL 0xd002
 #define KBDROW 0xd003
 #define SERIR 0xd004
 #define SERCR 0xd005
+#define COLOR01 0xd00d
+#define COLOR23 0xd00f
+
+/// First of the sound generator's registers. See sound.h.
+#define SOUND_BASE 0xd010
+
+/// Start of the pixel data in the primary and alternate video areas.
+#define VIDEO_BASE 0x2000
+#define ALT_VIDEO_BASE 0x6000
 
 #define SERCR_SCL 0x40
 #define SERCR_SDA 0x80
 
-#define TWI_ADDR_SET 0x10
-#define TWI_BITS_LEFT(X) (X & 7)
+/// Number of cartridge slots. The ROM selects a chip with the three
+/// block select bits of the TWI device address, so there can be up to
+/// 8, each responding to device address 1010sss.
+#define CART_SLOTS 8
+
+/// Size of a cartridge chip: the memory addressed by the two address
+/// bytes that follow the device address. Larger images take up several
+/// slots.
+#define CART_CHIP_SIZE 0x10000
 
-#define CART_WAIT_A1 1
-#define CART_WAIT_A2 2
-#define CART_STATE_NORMAL 3
+/// Page size of the cartridge EEPROM. The ROM writes in blocks of the
+/// size given in the cartridge header, which must not be larger.
+#define CART_PAGE_SIZE 64
+
+/// Clock cycles the cartridge EEPROM takes to store a page. Datasheets
+/// give a maximum of 5 ms.
+#define CART_WRITE_CYCLES (5000000UL * TIME_STEP_TICKS / TIME_STEP_NS)
 
 #define FATALF(FMT, ...) { fprintf(stderr, FMT "\n", __VA_ARGS__); exit(1); }
 #define FATAL(MSG) FATALF("%s", MSG)
@@ -95,37 +122,66 @@ typedef struct hm1k_state_s hm1k_state;
 typedef uint8_t (*hm1k_read_byte_fn) (hm1k_state*, uint16_t);
 typedef void (*hm1k_write_byte_fn) (hm1k_state*, uint16_t, uint8_t);
 typedef void (*hm1k_op_fn) (hm1k_state*);
+typedef void (*hm1k_page_hook) (hm1k_state*, uint16_t addr, uint8_t val,
+                                uint8_t access);
+
+/* Bits in hm1k_state.page_attr. */
+/* Call the page's hook after an instruction reads from the page. */
+#define PAGE_WATCH_READ 1
+/* Call the page's hook after an instruction writes to the page. */
+#define PAGE_WATCH_WRITE 2
+/* Call the page's hook before executing an instruction on the page. */
+#define PAGE_WATCH_EXEC 4
+/* Bits that make step_6502 take the slow path. */
+#define PAGE_TRAPS (PAGE_WATCH_READ | PAGE_WATCH_WRITE | PAGE_WATCH_EXEC)
 
 struct hm1k_state_s {
   uint8_t a, p, s, x, y;
   uint16_t pc;
-  uint8_t *cartridge;
-  uint8_t cartridge_bits;
-  uint8_t cartridge_state;
-  size_t cartridge_addr;
-  size_t cartridge_size;
+  /* Bit i is set if cartridge slot i holds a chip. */
+  uint8_t cartridge_slots;
+  hm1k_eeprom cartridges[CART_SLOTS];
+  hm1k_twi_bus twi;
+  hm1k_sound sound;
   uint8_t *ram;
   uint8_t *rom;
   hm1k_read_byte_fn io_read[0x1000];
   hm1k_write_byte_fn io_write[0x1000];
-  uint8_t kbdrow, sercr, serir, twi_addr, twi_status;
+  uint8_t vmode, color01, color23, kbdrow, sercr, serir;
   uint8_t keyboard[8];
   struct timespec last_sync, next_redraw;
   unsigned long ticks;
+  /* Total number of clock cycles executed since init_6502. */
+  unsigned long cycles;
+  /* When non-NULL, every instruction executed is recorded here. */
+  hm1k_trace *trace;
+  /* Per-page attributes and hooks for observing memory accesses.
+   * trap_pages counts the pages with any of PAGE_TRAPS set. While it is
+   * zero, the only cost is a single test per instruction. */
+  uint8_t page_attr[256];
+  hm1k_page_hook page_hook[256];
+  unsigned int trap_pages;
+  /* When non-NULL, executed instructions and branches are recorded
+   * here. See start_coverage. */
+  hm1k_coverage *coverage;
 };
 
 typedef void (*hm1k_op) (hm1k_state *s, uint8_t op);
 
 inline static void add_ticks(hm1k_state *s, unsigned long ticks) {
   s->ticks += ticks;
+  s->cycles += ticks;
 }
 
 /** Wait until real time agrees with the number of CPU cycles we
  * have counted.
  * This updates s->last_sync to the real time synchronized to, and
  * s->ticks to the remaining ticks not accounted for.
+ * When HM1K_UNTHROTTLED is defined, no synchronization is performed and
+ * the emulator runs as fast as the host allows.
  */
 static void sync_time(hm1k_state *s) {
+#ifndef HM1K_UNTHROTTLED
   if (s->ticks < TIME_STEP_TICKS) return;
   unsigned long new_nsec = s->last_sync.tv_nsec +
     (s->ticks / TIME_STEP_TICKS) * TIME_STEP_NS;
@@ -140,6 +196,7 @@ static void sync_time(hm1k_state *s) {
     fprintf(stderr, "clock_nanosleep: %s\n", strerror(n));
   }
   s->ticks = s->ticks % TIME_STEP_TICKS;
+#endif
 }
 
 static void randomize(void *start, size_t len) {
@@ -166,110 +223,6 @@ static uint8_t read_serir(hm1k_state *s, uint16_t addr) {
   return s->serir;
 }
 
-static void handle_new_sercr(hm1k_state *s, uint8_t val) {
-#define set_sda_low() { s->serir &= 0xfe; }
-  /* Nothing interesting happens when SCL goes low or stays low. */
-  if ((val & SERCR_SCL) == 0) return;
-
-  const bool scl_rising = (s->sercr & SERCR_SCL) == 0;
-  const bool addr_set = s->twi_status & TWI_ADDR_SET;
-  const bool addressing_cartridge = (s->twi_addr & 0xf0) == 0xa0;
-  const bool twi_addr_even = (s->twi_addr & 1) == 0;
-  if (scl_rising) {
-    /* Rising SCL means we're clocking in a bit. */
-    /* Usage of twi_status:
-     *  - We starte the lower 4 bits at 0xf and count down for every
-     *    bit we send or receive.
-     *  - Once the value reaches 7, this means we have sent or received
-     *    8 bits and need to send or receive an acknowledgment.
-     *  - TWI_ADDR_SET indicates that we have received a TWI address.
-     * twi_addr is used to store the address of the TWI device currently
-     * being addressed. It is valid when TWI_ADDR_SET is set in twi_status.
-     * cartridge_addr is used to store the current cartridge address.
-     * It is set by the computer transmitting the bit sequence.
-     * 1010xxx0 yyyyyyyy zzzzzzzz. This is also the sequence that initiates
-     * a write to the cartridge. A read is performed by writing zero
-     * bytes (just to set the address), then sending the sequence
-     * 1010xxx1.
-     */
-    const bool addr_set = s->twi_status & TWI_ADDR_SET;
-    const bool cart_write = (s->twi_addr & 0xf1) == 0xa0;
-    const bool waiting_for_ack = (s->twi_status & 15) == 7;
-    /* Shift incoming bit into serir. We start by setting it to the value
-     * of the top bit in sercr, but allow clients to pull it low. */
-    s->serir = (s->serir << 1) | (s->sercr >> 7);
-    if (waiting_for_ack) {
-      if (s->cartridge && addressing_cartridge) {
-        if (addr_set) {
-          /* Acknowledge address sent to cartridge. */
-          if (cart_write) set_sda_low();
-        } else  {
-          /* Acknowledge cartridge addresses. */
-          set_sda_low();
-          s->twi_status |= TWI_ADDR_SET;
-          if (cart_write) {
-            s->cartridge_state = CART_WAIT_A1;
-            s->cartridge_addr = (s->twi_addr >> 1) & 7;
-            s->cartridge_bits = 0;
-          }
-        }
-      }
-      s->twi_status |= 8;
-    } else {
-      if (addr_set && addressing_cartridge && !twi_addr_even) {
-        static uint8_t data = 0;
-        if (s->cartridge_bits == 0) {
-          data = s->cartridge[s->cartridge_addr % s->cartridge_size];
-          /* if (s->pc < 0xc000) */
-          /*   printf("cartridge %08x: %02x\n", s->cartridge_addr, data); */
-          s->cartridge_addr += 1;
-          s->cartridge_bits = 8;
-        }
-        s->serir &= 0xfe | (data >> 7);
-        data <<= 1;
-        --s->cartridge_bits;
-      }
-      if ((s->twi_status & 7) == 0) {
-        if (addr_set) {
-          if (cart_write)
-          if (addressing_cartridge && twi_addr_even) {
-            /* printf("to cartridge: %02x\n", s->serir); */
-            if (s->cartridge_state < CART_STATE_NORMAL) {
-              s->cartridge_addr = (s->cartridge_addr << 8) | s->serir;
-              ++s->cartridge_state;
-              /* printf("cartridge_addr: %04x\n", s->cartridge_addr); */
-            } else {
-              /* printf("cartridge[%08x] <- %02x\n", s->cartridge_addr, s->serir); */
-              s->cartridge[s->cartridge_addr % s->cartridge_size] = s->serir;
-              ++s->cartridge_addr;
-            }
-          }
-        } else {
-          s->twi_addr = s->serir;
-        }
-      }
-      --s->twi_status;
-    }
-  } else {
-    /* SCL was high and continues to be high. */
-    const uint8_t new_sda = val & SERCR_SDA;
-    /* If SDA is unchanged, nothing interesting happens. */
-    if (new_sda == (s->sercr & SERCR_SDA)) return;
-    if (new_sda == 0) {
-      /* Start condition. */
-      /* Address not set, expecting 8 data bits and an ack. */
-      s->twi_status = 15;
-    } else {
-      /* Stop condition. */
-      if (s->cartridge && addr_set && addressing_cartridge && twi_addr_even) {
-        msync(s->cartridge, s->cartridge_size, MS_ASYNC);
-      }
-      s->twi_status = 0;
-    }
-  }
-#undef set_sda_low
-}
-
 /* Sets s->kbdrow based on index of first unset bit in val. */
 static void write_kbdrow(hm1k_state *s, uint16_t addr, uint8_t val) {
   uint8_t n = 0;
@@ -281,9 +234,34 @@ static void write_kbdrow(hm1k_state *s, uint16_t addr, uint8_t val) {
   s->kbdrow = n;
 }
 
+static void write_vmode(hm1k_state *s, uint16_t addr, uint8_t val) {
+  s->vmode = val;
+}
+
+static void write_color01(hm1k_state *s, uint16_t addr, uint8_t val) {
+  s->color01 = val;
+}
+
+static void write_color23(hm1k_state *s, uint16_t addr, uint8_t val) {
+  s->color23 = val;
+}
+
+static void write_sound(hm1k_state *s, uint16_t addr, uint8_t val) {
+  sound_write(&s->sound, addr - SOUND_BASE, val, s->cycles);
+}
+
+/** Returns the address of the pixel data currently being displayed. */
+static inline uint16_t video_base(const hm1k_state *s) {
+  return (s->vmode & VMODE_ALT) ? ALT_VIDEO_BASE : VIDEO_BASE;
+}
+
+/* SCL and SDA are driven by SERCR and connected to the TWI bus. When
+ * SCL rises, the level of SDA is shifted into SERIR. */
 static void write_sercr(hm1k_state *s, uint16_t addr, uint8_t val) {
-  handle_new_sercr(s, val);
+  int sda;
   s->sercr = val;
+  sda = twi_update(&s->twi, val & SERCR_SCL, val & SERCR_SDA);
+  if (sda >= 0) s->serir = (s->serir << 1) | sda;
 }
 
 static uint8_t load_u8_nosync(hm1k_state *s, uint16_t addr) {
@@ -303,6 +281,14 @@ static uint16_t load_u16(hm1k_state *s, uint16_t addr) {
     (uint16_t) load_u8_nosync(s, addr + 1) << 8;
 }
 
+/** Loads a pointer from the zero page. A pointer at $ff takes its high
+ * byte from $00, as on the 6502. */
+static uint16_t load_zp_u16(hm1k_state *s, uint8_t addr) {
+  sync_time(s);
+  return (uint16_t) load_u8_nosync(s, addr) |
+    (uint16_t) load_u8_nosync(s, (uint8_t) (addr + 1)) << 8;
+}
+
 static void store_u8(hm1k_state *s, uint16_t addr, uint8_t val) {
   sync_time(s);
   if (addr < RAM_SIZE) {
@@ -312,12 +298,48 @@ static void store_u8(hm1k_state *s, uint16_t addr, uint8_t val) {
   if (addr < ROM_BASE) s->io_write[addr & 0x0fff](s, addr, val);
 }
 
+/** Sets the attribute byte of a page, keeping s->trap_pages up to
+ * date. */
+static void set_page_attr(hm1k_state *s, uint8_t page, uint8_t attr) {
+  const bool was_trapped = s->page_attr[page] & PAGE_TRAPS;
+  const bool trapped = attr & PAGE_TRAPS;
+  s->trap_pages += trapped - was_trapped;
+  s->page_attr[page] = attr;
+}
+
+/** Sets attribute bits on pages first through last and installs hook
+ * for them. hook may be NULL if attr contains no PAGE_WATCH_* bits. */
+static void set_page_traps(hm1k_state *s, uint8_t first, uint8_t last,
+                           uint8_t attr, hm1k_page_hook hook) {
+  unsigned int i;
+  for (i = first; i <= last; i++) {
+    set_page_attr(s, i, s->page_attr[i] | attr);
+    if (hook) s->page_hook[i] = hook;
+  }
+}
+
+/** Clears attribute bits on pages first through last. */
+static inline void clear_page_traps(hm1k_state *s, uint8_t first,
+                                    uint8_t last, uint8_t attr) {
+  unsigned int i;
+  for (i = first; i <= last; i++) {
+    set_page_attr(s, i, s->page_attr[i] & ~attr);
+  }
+}
+
 static void init_6502(hm1k_state *s, uint8_t *data) {
  size_t i;
   randomize(s, sizeof(hm1k_state));
   s->ram = data;
-  s->cartridge = NULL;
-  s->twi_status = 0;
+  s->cartridge_slots = 0;
+  init_twi(&s->twi);
+  s->trace = NULL;
+  s->coverage = NULL;
+  memset(s->page_attr, 0, sizeof(s->page_attr));
+  s->trap_pages = 0;
+  for (i = 0; i < 256; i++) {
+    s->page_hook[i] = NULL;
+  }
   for (i = 0; i < 0x1000; i++) {
     s->io_read[i] = io_read_default;
   }
@@ -327,26 +349,126 @@ static void init_6502(hm1k_state *s, uint8_t *data) {
   clock_gettime(CLOCK_MONOTONIC, &s->last_sync);
   s->next_redraw = s->last_sync;
   s->ticks = 0;
+  s->cycles = 0;
 }
 
-static void init_hm1000_cartridge(
-    hm1k_state *s, uint8_t *ram,
-    uint8_t *rom, uint8_t *cartridge, size_t cartridge_size) {
+static void init_hm1000(
+    hm1k_state *s, uint8_t *ram, uint8_t *rom) {
+  unsigned int i;
   init_6502(s, ram);
   s->rom = rom;
   s->io_read[SERIR - IO_BASE] = read_serir;
   s->io_write[SERCR - IO_BASE] = write_sercr;
+  s->vmode = 0;
+  s->io_write[VMODE - IO_BASE] = write_vmode;
+  /* White on black, which is all the Home Micro 1000 can show. */
+  s->color01 = 0xf0;
+  s->io_write[COLOR01 - IO_BASE] = write_color01;
+  s->color23 = 0x00;
+  s->io_write[COLOR23 - IO_BASE] = write_color23;
   s->kbdrow = 0;
   memset(s->keyboard, 0xff, sizeof(s->keyboard));
   s->io_read[KBDCOL - IO_BASE] = read_kbdcol;
   s->io_write[KBDROW - IO_BASE] = write_kbdrow;
-  s->cartridge = cartridge;
-  s->cartridge_size = cartridge_size;
+  init_sound(&s->sound);
+  for (i = 0; i < SOUND_REGISTERS; i++) {
+    s->io_write[SOUND_BASE - IO_BASE + i] = write_sound;
+  }
 }
 
-static void init_hm1000(
-    hm1k_state *s, uint8_t *ram, uint8_t *rom) {
-  init_hm1000_cartridge(s, ram, rom, NULL, 0);
+/**
+ * Inserts a cartridge image of size bytes into the given slot. Images
+ * larger than CART_CHIP_SIZE are split across that slot and the ones
+ * after it, as if the cartridge held several chips. Returns the number
+ * of slots used, or -1 if the image does not fit.
+ */
+static int insert_cartridge(hm1k_state *s, unsigned int slot,
+                            uint8_t *data, size_t size) {
+  const unsigned int n = (size + CART_CHIP_SIZE - 1) / CART_CHIP_SIZE;
+  unsigned int i;
+  if (n == 0 || slot + n > CART_SLOTS) return -1;
+  for (i = slot; i < slot + n; i++) {
+    if (s->cartridge_slots & (1 << i)) return -1;
+  }
+  for (i = 0; i < n; i++) {
+    hm1k_eeprom *e = &s->cartridges[slot + i];
+    const size_t offset = (size_t) i * CART_CHIP_SIZE;
+    init_eeprom(e, data + offset,
+                size - offset < CART_CHIP_SIZE ? size - offset
+                                               : CART_CHIP_SIZE,
+                CART_PAGE_SIZE);
+    e->dev.addr = 0xa0 | ((slot + i) << 1);
+    e->dev.addr_mask = 0xfe;
+    set_eeprom_timing(e, &s->cycles, CART_WRITE_CYCLES);
+    attach_twi_device(&s->twi, &e->dev);
+    s->cartridge_slots |= 1 << (slot + i);
+  }
+  return n;
+}
+
+/** Initializes an HM1000 with a single cartridge image, which may be
+ * NULL for none. */
+static inline void init_hm1000_cartridge(
+    hm1k_state *s, uint8_t *ram,
+    uint8_t *rom, uint8_t *cartridge, size_t cartridge_size) {
+  init_hm1000(s, ram, rom);
+  if (cartridge && insert_cartridge(s, 0, cartridge, cartridge_size) < 0) {
+    FATALF("cartridge image too large (%lu bytes)",
+           (unsigned long) cartridge_size);
+  }
+}
+
+/**
+ * Maps the cartridge image at path into memory. Pages are read from
+ * the file when they are first accessed, so large images do not slow
+ * down startup. Writes to the image are not saved to the file.
+ * Returns NULL on error, with errno set.
+ */
+static uint8_t *map_cartridge(const char *path, size_t *size) {
+  struct stat st;
+  void *map;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+  *size = st.st_size;
+  return map;
+}
+
+/** Maps the cartridge images at paths and inserts them into
+ * consecutive slots, starting at slot 0. Returns 0 on success, or
+ * prints a message and returns -1 on error. */
+static inline int insert_cartridges(hm1k_state *s,
+                                    const char *const *paths,
+                                    unsigned int count) {
+  unsigned int i, slot = 0;
+  for (i = 0; i < count; i++) {
+    size_t size;
+    int n;
+    uint8_t *data = map_cartridge(paths[i], &size);
+    if (!data) {
+      perror(paths[i]);
+      return -1;
+    }
+    n = insert_cartridge(s, slot, data, size);
+    if (n < 0) {
+      fprintf(stderr, "%s: does not fit in cartridge slots %u to %d\n",
+              paths[i], slot, CART_SLOTS - 1);
+      return -1;
+    }
+    slot += n;
+  }
+  return 0;
 }
 
 static void reset(hm1k_state *s) {
@@ -362,7 +484,7 @@ static void reset(hm1k_state *s) {
   s->pc = load_u16(s, 0xfffc);
 }
 
-static void randomize_reset_hm1000(
+static inline void randomize_reset_hm1000(
     hm1k_state *s, uint8_t *ram, size_t ramsize,
     uint8_t *rom, size_t romsize, uint16_t reset_addr)
 {
@@ -418,11 +540,11 @@ static uint16_t mode_imm(hm1k_state *s) {
 }
 
 static uint16_t mode_indx(hm1k_state *s) {
-  return load_u16(s, (load_u8(s, s->pc++) + s->x) & 0xff);
+  return load_zp_u16(s, load_u8(s, s->pc++) + s->x);
 }
 
 static uint16_t mode_indy(hm1k_state *s) {
-  return load_u16(s, load_u8(s, s->pc++)) + s->y;
+  return load_zp_u16(s, load_u8(s, s->pc++)) + s->y;
 }
 
 static uint16_t mode_noi(hm1k_state *s) {
@@ -810,11 +932,182 @@ static const unsigned int op_cycles[256] = {
 };
 #undef OP
 
+#define OP(CODE, NAME, MODE, CYCLES) MODE_ ## MODE,
+static const uint8_t op_modes[256] = {
+#include "ops.inc"
+};
+#undef OP
+
+/** Reads memory without side effects. I/O addresses read as 0. */
+static uint8_t peek_u8(hm1k_state *s, uint16_t addr) {
+  if (addr < RAM_SIZE) return s->ram[addr];
+  if (addr >= ROM_BASE) return s->rom[addr - ROM_BASE];
+  return 0;
+}
+
+static uint16_t peek_u16(hm1k_state *s, uint16_t addr) {
+  return (uint16_t) peek_u8(s, addr) |
+    (uint16_t) peek_u8(s, addr + 1) << 8;
+}
+
+/** Reads a pointer from the zero page the way load_zp_u16 does. */
+static uint16_t peek_zp_u16(hm1k_state *s, uint8_t addr) {
+  return (uint16_t) peek_u8(s, addr) |
+    (uint16_t) peek_u8(s, (uint8_t) (addr + 1)) << 8;
+}
+
+/* Bits returned by access_of. These match the trace record bits. */
+#define ACCESS_READ TRACE_READ
+#define ACCESS_WRITE TRACE_WRITE
+
+/** Computes which memory location the instruction at s->pc will
+ * access, without executing it. Stores the address in *addr and
+ * returns a combination of ACCESS_READ and ACCESS_WRITE, or 0 if the
+ * instruction does not access memory through its operand. Stack
+ * accesses are not included. */
+static uint8_t access_of(hm1k_state *s, uint8_t op, uint16_t *addr) {
+  const uint16_t arg = s->pc + 1;
+  const hm1k_op fn = ops[op];
+  uint8_t access = ACCESS_READ;
+
+  switch (op_modes[op]) {
+  case MODE_abs: *addr = peek_u16(s, arg); break;
+  case MODE_absx: *addr = peek_u16(s, arg) + s->x; break;
+  case MODE_absy: *addr = peek_u16(s, arg) + s->y; break;
+  case MODE_ix: *addr = peek_zp_u16(s, peek_u8(s, arg) + s->x); break;
+  case MODE_iy: *addr = peek_zp_u16(s, peek_u8(s, arg)) + s->y; break;
+  case MODE_zp: *addr = peek_u8(s, arg); break;
+  case MODE_zpx: *addr = (peek_u8(s, arg) + s->x) & 0xff; break;
+  case MODE_zpy: *addr = (peek_u8(s, arg) + s->y) & 0xff; break;
+  default: return 0;
+  }
+  if (fn == op_jmp || fn == op_jsr) {
+    access = 0;
+  } else if (fn == op_sta || fn == op_stx || fn == op_sty) {
+    access = ACCESS_WRITE;
+  } else if (fn == op_asl || fn == op_dec || fn == op_inc ||
+             fn == op_lsr || fn == op_rol || fn == op_ror) {
+    access = ACCESS_READ | ACCESS_WRITE;
+  }
+  return access;
+}
+
+/** Fills in the trace record for the instruction at s->pc.
+ * Rather than slowing down every memory access with a check for
+ * tracing, the address the instruction accesses is computed up front
+ * from its addressing mode. Returns the kind of access made. */
+static uint8_t trace_begin(hm1k_state *s, uint8_t op) {
+  hm1k_trace_record *r = trace_next(s->trace);
+
+  r->cycles = s->cycles;
+  r->pc = s->pc;
+  r->op = op;
+  r->operand[0] = peek_u8(s, s->pc + 1);
+  r->operand[1] = peek_u8(s, s->pc + 2);
+  r->a = s->a;
+  r->x = s->x;
+  r->y = s->y;
+  r->s = s->s;
+  r->p = s->p;
+  r->access = access_of(s, op, &r->addr);
+  return r->access;
+}
+
+/** Returns the value an instruction read from or wrote to addr, after
+ * executing it. For I/O addresses, only the values of loads and stores
+ * are known; other instructions give 0. */
+static uint8_t access_value(hm1k_state *s, uint8_t op, uint16_t addr) {
+  const hm1k_op fn = ops[op];
+  if (addr < RAM_SIZE || addr >= ROM_BASE) return peek_u8(s, addr);
+  if (fn == op_lda || fn == op_sta) return s->a;
+  if (fn == op_ldx || fn == op_stx) return s->x;
+  if (fn == op_ldy || fn == op_sty) return s->y;
+  return 0;
+}
+
+/** Records the value read or written and publishes the record. */
+static void trace_end(hm1k_state *s) {
+  hm1k_trace_record *r = trace_next(s->trace);
+  if (!r->access) {
+    r->addr = 0;
+    r->val = 0;
+  } else {
+    r->val = access_value(s, r->op, r->addr);
+  }
+  trace_commit(s->trace);
+}
+
+/** Handles an access by an instruction to a page with PAGE_TRAPS set:
+ * calls the page's hook. PAGE_WATCH_READ and PAGE_WATCH_WRITE have the
+ * same values as ACCESS_READ and ACCESS_WRITE. */
+static void page_trap(hm1k_state *s, uint8_t op, uint16_t addr,
+                      uint8_t access) {
+  const uint8_t page = addr >> 8;
+  const uint8_t watched =
+    access & s->page_attr[page] & (PAGE_WATCH_READ | PAGE_WATCH_WRITE);
+  if (watched) {
+    s->page_hook[page](s, addr, access_value(s, op, addr), watched);
+  }
+}
+
+/** Executes one instruction while tracing or while any page is
+ * trapped. Like tracing, the memory location the instruction accesses
+ * is computed from its addressing mode, so that load_u8 and store_u8
+ * need no checks. Stack accesses are not seen. */
+static void step_6502_slow(hm1k_state *s, uint8_t op) {
+  const uint16_t pc = s->pc;
+  uint16_t addr = 0;
+  uint8_t access;
+
+  if (s->page_attr[pc >> 8] & PAGE_WATCH_EXEC) {
+    s->page_hook[pc >> 8](s, pc, op, PAGE_WATCH_EXEC);
+  }
+  if (s->trace) {
+    access = trace_begin(s, op);
+    addr = trace_next(s->trace)->addr;
+  } else {
+    access = access_of(s, op, &addr);
+  }
+  ++s->pc;
+  add_ticks(s, op_cycles[op]);
+  ops[op](s, op);
+  if (s->trace) trace_end(s);
+  if (access && (s->page_attr[addr >> 8] & PAGE_TRAPS)) {
+    page_trap(s, op, addr, access);
+  }
+}
+
 static void step_6502(hm1k_state *s) {
   uint8_t op = load_u8(s, s->pc);
-  // printf("%04x: %02x %02x %02x\n", s->pc, op, load_u8(s, s->pc + 1), load_u8(s, s->pc + 2));
-  // disas_modes[op](s->pc, s->ram);
+  if (s->trace || s->trap_pages) {
+    step_6502_slow(s, op);
+    return;
+  }
   ++s->pc;
   add_ticks(s, op_cycles[op]);
   ops[op](s, op);
 }
+
+/** Records the instruction about to be executed at addr in
+ * s->coverage. For branches, also records whether they will be
+ * taken. */
+static void coverage_hook(hm1k_state *s, uint16_t addr, uint8_t op,
+                          uint8_t access) {
+  /* Flag tested by the branches, indexed by the top 2 bits of the
+   * opcode. Bit 5 tells whether the flag must be set to branch. */
+  static const uint8_t branch_flags[4] = { FLAG_N, FLAG_V, FLAG_C, FLAG_Z };
+  bool taken;
+  if (access != PAGE_WATCH_EXEC) return;
+  set_coverage_bit(s->coverage->executed, addr);
+  if (op_modes[op] != MODE_rel) return;
+  taken = ((s->p & branch_flags[op >> 6]) != 0) == ((op >> 5) & 1);
+  set_coverage_bit(taken ? s->coverage->taken : s->coverage->not_taken,
+                   addr);
+}
+
+/** Starts recording coverage in c. This traps execution on every page,
+ * so the emulator runs on its slow path from then on. */
+static inline void start_coverage(hm1k_state *s, hm1k_coverage *c) {
+  s->coverage = c;
+  set_page_traps(s, 0x00, 0xff, PAGE_WATCH_EXEC, coverage_hook);
+}
@@ -62,6 +62,23 @@
 #define KEY_X POS(3, 2)
 #define KEY_Y POS(1, 6)
 #define KEY_Z POS(3, 1)
+/* Addressing modes, as named in the MODE column of ops.inc. */
+typedef enum {
+  MODE_abs,
+  MODE_absx,
+  MODE_absy,
+  MODE_imm,
+  MODE_impl,
+  MODE_ind,
+  MODE_ix,
+  MODE_iy,
+  MODE_ni,
+  MODE_rel,
+  MODE_zp,
+  MODE_zpx,
+  MODE_zpy,
+} hm1k_addressing_mode;
+
 /* Maps keysyms to hm1k keyboard codes.
  * For example, keysym 13 (return) maps to row 6, column 1, which we
  * encode as 6 | (1 << 3).
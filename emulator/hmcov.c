@@ -0,0 +1,401 @@
+/* Merges and reports on coverage files written by the emulator.
+ *
+ * Usage: hmcov merge output input...
+ *        hmcov report -b binary [-o origin] [-l labelfile]...
+ *                     [-s source]... coveragefile
+ *
+ * merge adds the inputs to output, creating it if necessary.
+ *
+ * report prints an annotated listing of the code in binary, which is
+ * loaded at origin (hex, default e000). With -s, the listing follows
+ * the given xa source files, using the labels to find the address of
+ * each line. Without -s, the code starting at every label is
+ * disassembled up to the next label. Every instruction is prefixed by
+ * + if it was executed and - if it was not. Branches are further
+ * marked with T if they were taken and N if they were not taken.
+ */
+#include "coverage.h"
+#include "disas.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Maximum nesting depth of #include in sources. */
+#define MAX_INCLUDE_DEPTH 8
+
+typedef struct {
+  hm1k_coverage coverage;
+  hm1k_labels labels;
+  uint8_t *binary;
+  size_t size;
+  uint16_t origin;
+  /* Address of the next source line, if known. */
+  bool tracking;
+  uint16_t addr;
+  unsigned long instructions, executed;
+  unsigned long branches, taken, not_taken;
+} report;
+
+static bool in_binary(const report *r, uint16_t addr, unsigned int len) {
+  return addr >= r->origin && (size_t) (addr - r->origin) + len <= r->size;
+}
+
+static bool is_branch(uint8_t op) {
+  /* All branches have opcodes of the form xxx10000. */
+  return (op & 0x1f) == 0x10;
+}
+
+/** Writes the coverage marks for the instruction at addr to mark and
+ * updates the totals. */
+static void mark_insn(report *r, uint16_t addr, char mark[4]) {
+  const hm1k_coverage *c = &r->coverage;
+  const bool executed = coverage_bit(c->executed, addr);
+  ++r->instructions;
+  if (executed) ++r->executed;
+  mark[0] = executed ? '+' : '-';
+  mark[1] = ' ';
+  mark[2] = ' ';
+  mark[3] = '\0';
+  if (is_branch(r->binary[addr - r->origin])) {
+    ++r->branches;
+    if (coverage_bit(c->taken, addr)) {
+      mark[1] = 'T';
+      ++r->taken;
+    }
+    if (coverage_bit(c->not_taken, addr)) {
+      mark[2] = 'N';
+      ++r->not_taken;
+    }
+  }
+}
+
+static void print_summary(const report *r) {
+  printf("\n%lu of %lu instructions executed", r->executed, r->instructions);
+  if (r->instructions) {
+    printf(" (%.1f%%)", 100.0 * r->executed / r->instructions);
+  }
+  printf("\n%lu branches, %lu taken, %lu not taken\n",
+         r->branches, r->taken, r->not_taken);
+}
+
+/** Lists the code from every label up to the next one. */
+static void report_labels(report *r) {
+  size_t i = 0, j;
+  char mark[4], text[80];
+  while (i < r->labels.count) {
+    uint16_t addr = r->labels.labels[i].addr, end;
+    if (!in_binary(r, addr, 1)) {
+      ++i;
+      continue;
+    }
+    for (j = i; j < r->labels.count && r->labels.labels[j].addr == addr; j++) {
+      printf("%s:\n", r->labels.labels[j].name);
+    }
+    i = j;
+    end = i < r->labels.count && in_binary(r, r->labels.labels[i].addr, 1) ?
+      r->labels.labels[i].addr : r->origin + r->size - 1;
+    while (addr < end) {
+      const uint8_t *bytes = &r->binary[addr - r->origin];
+      unsigned int len = disas_length(bytes[0]);
+      if (!in_binary(r, addr, len)) break;
+      disassemble(text, sizeof(text), addr, bytes, &r->labels);
+      mark_insn(r, addr, mark);
+      printf("%s %04x  %s\n", mark, addr, text);
+      addr += len;
+    }
+  }
+}
+
+/** Parses a number in xa syntax ($hex, %binary, or decimal) or a label
+ * name at *p. Returns 0 on success. */
+static int parse_value(const report *r, const char **p, uint16_t *val) {
+  const char *s = *p;
+  char name[128];
+  size_t n = 0;
+  char *end;
+  if (*s == '$') {
+    *val = strtoul(s + 1, &end, 16);
+  } else if (*s == '%') {
+    *val = strtoul(s + 1, &end, 2);
+  } else if (isdigit((unsigned char) *s)) {
+    *val = strtoul(s, &end, 10);
+  } else {
+    while ((isalnum((unsigned char) s[n]) || s[n] == '_') &&
+           n < sizeof(name) - 1) {
+      name[n] = s[n];
+      ++n;
+    }
+    name[n] = '\0';
+    if (n == 0 || find_label_addr(&r->labels, name, val)) return -1;
+    end = (char*) s + n;
+  }
+  *p = end;
+  return 0;
+}
+
+/** Returns the number of items in a comma-separated list of .byt
+ * operands, counting every character of quoted strings. */
+static unsigned int count_bytes(const char *p) {
+  unsigned int n = 0;
+  bool item = false;
+  for (; *p; p++) {
+    if (*p == '"') {
+      for (++p; *p && *p != '"'; p++) ++n;
+      if (!*p) break;
+    } else if (*p == ',') {
+      if (item) ++n;
+      item = false;
+    } else if (!isspace((unsigned char) *p)) {
+      item = true;
+    }
+  }
+  return item ? n + 1 : n;
+}
+
+/** Returns true if name is the mnemonic of some instruction. */
+static bool is_mnemonic(const char *name) {
+  unsigned int i;
+  if (strlen(name) != 3) return false;
+  for (i = 0; i < 256; i++) {
+    if (strncmp(disas_mnemonic(i), name, 3) == 0 &&
+        strcmp(disas_mnemonic(i), "ni")) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Reads the next identifier at *p into buf. Returns its length. */
+static size_t read_ident(const char **p, char *buf, size_t size) {
+  size_t n = 0;
+  while ((isalnum((unsigned char) **p) || **p == '_') && n < size - 1) {
+    buf[n++] = tolower((unsigned char) *(*p)++);
+  }
+  buf[n] = '\0';
+  return n;
+}
+
+static void report_source(report *r, const char *path, int depth);
+
+/** Annotates a single source line. dir is the directory of the source
+ * file, used for #include. */
+static void report_line(report *r, const char *line, const char *dir,
+                        int depth) {
+  char mark[4] = "   ", word[128], label[128], code[1024];
+  const char *p = code;
+  uint16_t line_addr;
+  bool insn = false;
+  char *c;
+  size_t n;
+
+  /* Parse a copy without the comment, keeping semicolons in strings. */
+  snprintf(code, sizeof(code), "%s", line);
+  for (c = code; *c; c++) {
+    if (*c == '"') {
+      c = strchr(c + 1, '"');
+      if (!c) break;
+    } else if (*c == ';' || *c == '\n') {
+      *c = '\0';
+      break;
+    }
+  }
+
+  if (*p == '#') {
+    if (strncmp(p, "#include", 8) == 0 && depth < MAX_INCLUDE_DEPTH) {
+      const char *q = strchr(p, '"'), *e = q ? strchr(q + 1, '"') : NULL;
+      if (e) {
+        char inc[1024];
+        const int n = snprintf(inc, sizeof(inc), "%s%.*s", dir,
+                               (int) (e - q - 1), q + 1);
+        printf("          | %s", line);
+        if (n < 0 || (size_t) n >= sizeof(inc)) {
+          fprintf(stderr, "%s%.*s: path too long\n", dir,
+                  (int) (e - q - 1), q + 1);
+        } else {
+          report_source(r, inc, depth + 1);
+        }
+        return;
+      }
+    }
+    printf("          | %s", line);
+    return;
+  }
+
+  /* A label starts in the first column, optionally followed by :. */
+  if (isalpha((unsigned char) *p) || *p == '_') {
+    n = 0;
+    while ((isalnum((unsigned char) *p) || *p == '_') && n < sizeof(label) - 1) {
+      label[n++] = *p++;
+    }
+    label[n] = '\0';
+    if (*p == ':') ++p;
+    while (*p == ' ' || *p == '\t') ++p;
+    if (*p == '=') {
+      /* Symbol definition. */
+      p = "";
+    } else if (find_label_addr(&r->labels, label, &r->addr) == 0) {
+      r->tracking = true;
+    } else {
+      /* Unknown label; we don't know where we are. */
+      r->tracking = false;
+    }
+  }
+  while (*p == ' ' || *p == '\t') ++p;
+  line_addr = r->addr;
+
+  if (*p == '*') {
+    /* Origin: * = value. */
+    ++p;
+    while (*p == ' ' || *p == '\t' || *p == '=') ++p;
+    r->tracking = parse_value(r, &p, &r->addr) == 0;
+  } else if (*p == '.') {
+    ++p;
+    read_ident(&p, word, sizeof(word));
+    if (!strcmp(word, "byt") || !strcmp(word, "byte") ||
+        !strcmp(word, "asc")) {
+      r->addr += count_bytes(p);
+    } else if (!strcmp(word, "word")) {
+      r->addr += 2 * count_bytes(p);
+    } else {
+      r->tracking = false;
+    }
+  } else if (read_ident(&p, word, sizeof(word)) > 0) {
+    while (*p == ' ' || *p == '\t') ++p;
+    if (*p != '=' && is_mnemonic(word)) {
+      insn = true;
+      if (r->tracking && in_binary(r, r->addr, 1) &&
+          strncmp(disas_mnemonic(r->binary[r->addr - r->origin]),
+                  word, 3) == 0) {
+        mark_insn(r, r->addr, mark);
+        r->addr += disas_length(r->binary[r->addr - r->origin]);
+      } else {
+        /* The binary doesn't match the source here. */
+        strcpy(mark, "?");
+        r->tracking = false;
+      }
+    }
+  }
+
+  if (insn && mark[0] != '?') {
+    printf("%-3s %04x | %s", mark, line_addr, line);
+  } else if (insn) {
+    printf("?         | %s", line);
+  } else {
+    printf("          | %s", line);
+  }
+}
+
+static void report_source(report *r, const char *path, int depth) {
+  /* One byte more than fgets is allowed to fill, for the newline. */
+  char line[1025], dir[1024];
+  const char *slash = strrchr(path, '/');
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return;
+  }
+  snprintf(dir, sizeof(dir), "%.*s",
+           slash ? (int) (slash - path + 1) : 0, path);
+  while (fgets(line, sizeof(line) - 1, f)) {
+    if (!strchr(line, '\n')) strcat(line, "\n");
+    report_line(r, line, dir, depth);
+  }
+  fclose(f);
+}
+
+static int merge(int argc, char *argv[]) {
+  hm1k_coverage c, total;
+  int i;
+  if (argc < 3) return 0x80;
+  init_coverage(&total);
+  for (i = 2; i < argc; i++) {
+    if (read_coverage(&c, argv[i])) return 1;
+    add_coverage(&total, &c);
+  }
+  return merge_coverage(&total, argv[1]) ? 1 : 0;
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+  uint8_t *data;
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  rewind(f);
+  data = malloc(*size ? *size : 1);
+  if (data && fread(data, 1, *size, f) != *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(f);
+  return data;
+}
+
+int main(int argc, char *argv[]) {
+  static report r;
+  const char *binary_path = NULL;
+  const char *sources[16];
+  int nsources = 0, opt, i;
+
+  if (argc > 1 && !strcmp(argv[1], "merge")) {
+    int result = merge(argc - 1, argv + 1);
+    if (result == 0x80) goto usage;
+    return result;
+  }
+  if (argc < 2 || strcmp(argv[1], "report")) goto usage;
+
+  --argc;
+  ++argv;
+  init_labels(&r.labels);
+  r.origin = 0xe000;
+  while ((opt = getopt(argc, argv, "b:l:o:s:")) != -1) {
+    switch (opt) {
+    case 'b':
+      binary_path = optarg;
+      break;
+    case 'l':
+      if (load_labels(&r.labels, optarg)) return 1;
+      break;
+    case 'o':
+      r.origin = strtoul(optarg, NULL, 16);
+      break;
+    case 's':
+      if (nsources == sizeof(sources) / sizeof(*sources)) goto usage;
+      sources[nsources++] = optarg;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (!binary_path || optind != argc - 1) goto usage;
+  if (read_coverage(&r.coverage, argv[optind])) return 1;
+  r.binary = read_file(binary_path, &r.size);
+  if (!r.binary) {
+    perror(binary_path);
+    return 1;
+  }
+  if (r.size > 0x10000 - r.origin) r.size = 0x10000 - r.origin;
+
+  if (nsources == 0) {
+    report_labels(&r);
+  } else {
+    for (i = 0; i < nsources; i++) {
+      r.tracking = false;
+      report_source(&r, sources[i], 0);
+    }
+  }
+  print_summary(&r);
+  free(r.binary);
+  free_labels(&r.labels);
+  return 0;
+
+ usage:
+  fprintf(stderr,
+          "Usage: hmcov merge output input...\n"
+          "       hmcov report -b binary [-o origin] [-l labelfile]...\n"
+          "                    [-s source]... coveragefile\n");
+  return 0x80;
+}
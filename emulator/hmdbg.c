@@ -0,0 +1,467 @@
+/* Interactive debugger for the emulator.
+ *
+ * Usage: hmdbg [-C coveragefile] [-c cartridge]... [-l labelfile]...
+ *              [rom.bin]
+ *
+ * Runs the HM1000 without a display, reading commands from standard
+ * input. The emulator runs as fast as the host allows. Type "help" for
+ * a list of commands. Pressing ^C while the program is running returns
+ * to the command prompt. With -C, the code executed is added to the
+ * given coverage file on exit.
+ */
+#define HM1K_UNTHROTTLED
+
+#include "disas.h"
+#include "hm1000.h"
+
+#include "hm1000.c"
+
+#include <ctype.h>
+#include <signal.h>
+
+/** Number of instructions run between checks for ^C when there are no
+ * breakpoints or watchpoints. */
+#define RUN_CHUNK 65536
+
+#define MAX_WATCHES 16
+
+/** A range of addresses which stops execution when accessed. */
+typedef struct {
+  uint16_t start, end;
+  uint8_t access;
+} watch;
+
+typedef struct {
+  /* Must be first, so that hooks can find the debugger from it. */
+  hm1k_state state;
+  hm1k_labels labels;
+  /* One bit per address. */
+  uint8_t breakpoints[0x10000 / 8];
+  unsigned int breakpoint_count;
+  watch watches[MAX_WATCHES];
+  unsigned int watch_count;
+  /* Set by watch_hook when a watch is hit. */
+  const watch *watch_hit;
+  uint16_t watch_addr;
+  uint8_t watch_val;
+  uint16_t list_addr;
+  uint16_t dump_addr;
+} debugger;
+
+/** Why run() returned. */
+enum stop_reason {
+  STOP_DONE,
+  STOP_BREAKPOINT,
+  STOP_WATCH,
+  STOP_HALTED,
+  STOP_INTERRUPTED,
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_sigint(int sig) {
+  interrupted = 1;
+}
+
+static bool is_breakpoint(const debugger *d, uint16_t addr) {
+  return d->breakpoints[addr >> 3] & (1 << (addr & 7));
+}
+
+/** Parses an address: a label, or a hex number, optionally prefixed
+ * by $. Labels take precedence, since names like "add" are also valid
+ * hex numbers. Returns 0 on success. */
+static int parse_addr(const debugger *d, const char *text, uint16_t *addr) {
+  char *end;
+  unsigned long val;
+  if (*text != '$' && find_label_addr(&d->labels, text, addr) == 0) {
+    return 0;
+  }
+  if (*text == '$') ++text;
+  val = strtoul(text, &end, 16);
+  if (*text && *end == '\0' && val <= 0xffff) {
+    *addr = val;
+    return 0;
+  }
+  printf("bad address: %s\n", text);
+  return -1;
+}
+
+/** Prints addr, with its label if it has one. */
+static void print_addr(const debugger *d, uint16_t addr) {
+  const char *label = find_label(&d->labels, addr);
+  if (label) printf("%04x <%s>", addr, label);
+  else printf("%04x", addr);
+}
+
+/** Called after an instruction accesses a page with a watch on it. */
+static void watch_hook(hm1k_state *s, uint16_t addr, uint8_t val,
+                       uint8_t access) {
+  debugger *d = (debugger*) s;
+  unsigned int i;
+  /* Watches replace the coverage hook on their pages. */
+  if (access == PAGE_WATCH_EXEC) {
+    if (s->coverage) coverage_hook(s, addr, val, access);
+    return;
+  }
+  for (i = 0; i < d->watch_count; i++) {
+    const watch *w = &d->watches[i];
+    if ((w->access & access) && addr >= w->start && addr <= w->end) {
+      d->watch_hit = w;
+      d->watch_addr = addr;
+      d->watch_val = val;
+      return;
+    }
+  }
+}
+
+/** Sets the page traps for the current watches. */
+static void update_watch_traps(debugger *d) {
+  unsigned int i;
+  clear_page_traps(&d->state, 0x00, 0xff,
+                   PAGE_WATCH_READ | PAGE_WATCH_WRITE);
+  for (i = 0; i < d->watch_count; i++) {
+    const watch *w = &d->watches[i];
+    set_page_traps(&d->state, w->start >> 8, w->end >> 8,
+                   w->access == ACCESS_READ ?
+                   PAGE_WATCH_READ : PAGE_WATCH_WRITE,
+                   watch_hook);
+  }
+}
+
+/** Runs up to count instructions. The instruction at the current pc
+ * is executed even if it has a breakpoint, so that continuing from a
+ * breakpoint makes progress. Watches stop execution after the
+ * instruction that hit them. */
+static enum stop_reason run(debugger *d, unsigned long count) {
+  hm1k_state *s = &d->state;
+  uint16_t pc;
+  unsigned long i;
+
+  interrupted = 0;
+  if (d->breakpoint_count == 0 && d->watch_count == 0) {
+    /* Nothing to check, so run in chunks, looking only for ^C and
+     * the program halting. */
+    while (count > 0 && !interrupted) {
+      unsigned long n = count < RUN_CHUNK ? count : RUN_CHUNK;
+      count -= n;
+      for (i = 0; i < n; i++) {
+        pc = s->pc;
+        step_6502(s);
+        if (s->pc == pc) return STOP_HALTED;
+      }
+    }
+    return interrupted ? STOP_INTERRUPTED : STOP_DONE;
+  }
+
+  d->watch_hit = NULL;
+  for (i = 0; i < count; i++) {
+    if (interrupted) return STOP_INTERRUPTED;
+    pc = s->pc;
+    if (i > 0 && is_breakpoint(d, pc)) return STOP_BREAKPOINT;
+    step_6502(s);
+    if (d->watch_hit) {
+      printf("watch %04x-%04x: ", d->watch_hit->start, d->watch_hit->end);
+      print_addr(d, pc);
+      if (d->watch_hit->access == ACCESS_WRITE) {
+        printf(" wrote %02x to %04x\n", d->watch_val, d->watch_addr);
+      } else {
+        printf(" read %02x from %04x\n", d->watch_val, d->watch_addr);
+      }
+      return STOP_WATCH;
+    }
+    if (s->pc == pc) return STOP_HALTED;
+  }
+  return STOP_DONE;
+}
+
+/** Disassembles one instruction. Returns its length. */
+static unsigned int print_insn(const debugger *d, uint16_t addr) {
+  uint8_t bytes[3];
+  char text[80];
+  unsigned int i, len;
+  const char *label = find_label(&d->labels, addr);
+  for (i = 0; i < 3; i++) {
+    bytes[i] = peek_u8((hm1k_state*) &d->state, addr + i);
+  }
+  len = disassemble(text, sizeof(text), addr, bytes, &d->labels);
+  if (label) printf("%s:\n", label);
+  printf("  %04x ", addr);
+  for (i = 0; i < 3; i++) {
+    if (i < len) printf(" %02x", bytes[i]);
+    else printf("   ");
+  }
+  printf("  %s\n", text);
+  return len;
+}
+
+static void print_registers(const debugger *d) {
+  const hm1k_state *s = &d->state;
+  static const char flags[] = "NV-BDIZC";
+  unsigned int i;
+  printf("a=%02x x=%02x y=%02x s=%02x p=%02x [", s->a, s->x, s->y, s->s, s->p);
+  for (i = 0; i < 8; i++) {
+    putchar((s->p & (0x80 >> i)) ? flags[i] : '.');
+  }
+  printf("] cycles=%lu pc=", s->cycles);
+  print_addr(d, s->pc);
+  printf("\n");
+  print_insn(d, s->pc);
+}
+
+static void dump_memory(debugger *d, uint16_t addr, unsigned int len) {
+  unsigned int i, j;
+  for (i = 0; i < len; i += 16) {
+    uint16_t line = addr + i;
+    printf("%04x ", line);
+    for (j = 0; j < 16; j++) printf(" %02x", peek_u8(&d->state, line + j));
+    printf("  ");
+    for (j = 0; j < 16; j++) {
+      uint8_t c = peek_u8(&d->state, line + j);
+      putchar(c >= 0x20 && c < 0x7f ? c : '.');
+    }
+    printf("\n");
+  }
+  d->dump_addr = addr + len;
+}
+
+/** Prints the text on the screen. In character modes, this is the
+ * character codes. In bitmap modes, the bitmap is matched against the
+ * font in ROM, and cells that don't match a character are shown as ?. */
+static void print_screen(const debugger *d) {
+  const uint8_t *ram = d->state.ram, *font = d->state.rom + 0x800;
+  const uint8_t *screen = ram + video_base(&d->state);
+  const bool text = (d->state.vmode & VMODE_KIND) != VMODE_BITMAP;
+  unsigned int row, col, c;
+  for (row = 0; row < VIDEO_ROWS; row++) {
+    for (col = 0; col < VIDEO_COLUMNS; col++) {
+      const uint8_t *cell = screen + row * 320 + col * 8;
+      if (text) {
+        c = screen[row * VIDEO_COLUMNS + col];
+      } else {
+        for (c = 0; c < 128; c++) {
+          if (memcmp(cell, font + c * 8, 8) == 0) break;
+        }
+      }
+      putchar(c >= 0x20 && c < 0x7f ? c : c < 0x80 ? ' ' : '?');
+    }
+    putchar('\n');
+  }
+}
+
+static void report_stop(debugger *d, enum stop_reason why) {
+  switch (why) {
+  case STOP_BREAKPOINT: printf("breakpoint\n"); break;
+  case STOP_HALTED: printf("halted\n"); break;
+  case STOP_INTERRUPTED: printf("interrupted\n"); break;
+  default: break;
+  }
+  d->list_addr = d->state.pc;
+  print_registers(d);
+}
+
+static void help(void) {
+  printf("Commands:\n"
+         "  s [n]              step n instructions (default 1)\n"
+         "  c                  continue until breakpoint, watch, or halt\n"
+         "  b addr             set breakpoint\n"
+         "  d addr             delete breakpoint\n"
+         "  bl                 list breakpoints and watches\n"
+         "  w start [end]      stop on writes to start..end\n"
+         "  wr start [end]     stop on reads from start..end\n"
+         "  dw n               delete watch n\n"
+         "  r                  show registers\n"
+         "  m [addr [len]]     dump memory\n"
+         "  l [addr [n]]       disassemble n instructions\n"
+         "  screen             show the text on the screen\n"
+         "  reset              reset the CPU\n"
+         "  q                  quit\n"
+         "Addresses are hex numbers or labels.\n");
+}
+
+static void list_breakpoints(const debugger *d) {
+  unsigned int addr, i;
+  for (addr = 0; addr < 0x10000; addr++) {
+    if (is_breakpoint(d, addr)) {
+      printf("break ");
+      print_addr(d, addr);
+      printf("\n");
+    }
+  }
+  for (i = 0; i < d->watch_count; i++) {
+    printf("watch %u: %04x-%04x %s\n", i,
+           d->watches[i].start, d->watches[i].end,
+           d->watches[i].access == ACCESS_WRITE ? "write" : "read");
+  }
+}
+
+/** Executes one command line. Returns false when the debugger should
+ * exit. */
+static bool command(debugger *d, char *line) {
+  char *argv[4];
+  int argc = 0;
+  uint16_t addr, end;
+  char *tok;
+
+  for (tok = strtok(line, " \t\n"); tok && argc < 4;
+       tok = strtok(NULL, " \t\n")) {
+    argv[argc++] = tok;
+  }
+  if (argc == 0) return true;
+
+  if (!strcmp(argv[0], "q") || !strcmp(argv[0], "quit")) {
+    return false;
+  } else if (!strcmp(argv[0], "help") || !strcmp(argv[0], "?")) {
+    help();
+  } else if (!strcmp(argv[0], "s")) {
+    unsigned long n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    report_stop(d, run(d, n));
+  } else if (!strcmp(argv[0], "c")) {
+    report_stop(d, run(d, ~0UL));
+  } else if (!strcmp(argv[0], "b") && argc > 1) {
+    if (parse_addr(d, argv[1], &addr)) return true;
+    if (!is_breakpoint(d, addr)) {
+      d->breakpoints[addr >> 3] |= 1 << (addr & 7);
+      ++d->breakpoint_count;
+    }
+  } else if (!strcmp(argv[0], "d") && argc > 1) {
+    if (parse_addr(d, argv[1], &addr)) return true;
+    if (is_breakpoint(d, addr)) {
+      d->breakpoints[addr >> 3] &= ~(1 << (addr & 7));
+      --d->breakpoint_count;
+    }
+  } else if (!strcmp(argv[0], "bl")) {
+    list_breakpoints(d);
+  } else if ((!strcmp(argv[0], "w") || !strcmp(argv[0], "wr")) && argc > 1) {
+    watch *w;
+    if (d->watch_count == MAX_WATCHES) {
+      printf("too many watches\n");
+      return true;
+    }
+    if (parse_addr(d, argv[1], &addr)) return true;
+    end = addr;
+    if (argc > 2 && parse_addr(d, argv[2], &end)) return true;
+    w = &d->watches[d->watch_count++];
+    w->start = addr;
+    w->end = end;
+    w->access = argv[0][1] == 'r' ? ACCESS_READ : ACCESS_WRITE;
+    update_watch_traps(d);
+  } else if (!strcmp(argv[0], "dw") && argc > 1) {
+    unsigned long n = strtoul(argv[1], NULL, 0);
+    if (n >= d->watch_count) {
+      printf("no such watch\n");
+      return true;
+    }
+    memmove(&d->watches[n], &d->watches[n + 1],
+            (d->watch_count - n - 1) * sizeof(watch));
+    --d->watch_count;
+    update_watch_traps(d);
+  } else if (!strcmp(argv[0], "r")) {
+    print_registers(d);
+  } else if (!strcmp(argv[0], "m")) {
+    unsigned int len = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+    addr = d->dump_addr;
+    if (argc > 1 && parse_addr(d, argv[1], &addr)) return true;
+    dump_memory(d, addr, len);
+  } else if (!strcmp(argv[0], "l")) {
+    unsigned int i, n = argc > 2 ? strtoul(argv[2], NULL, 0) : 10;
+    addr = d->list_addr;
+    if (argc > 1 && parse_addr(d, argv[1], &addr)) return true;
+    for (i = 0; i < n; i++) addr += print_insn(d, addr);
+    d->list_addr = addr;
+  } else if (!strcmp(argv[0], "screen")) {
+    print_screen(d);
+  } else if (!strcmp(argv[0], "reset")) {
+    reset(&d->state);
+    report_stop(d, STOP_DONE);
+  } else {
+    printf("unknown command: %s (type help for a list)\n", argv[0]);
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  static debugger d;
+  static uint8_t ram[RAM_SIZE];
+  static uint8_t rom[ROM_SIZE];
+  const char *rom_path = "rom.bin";
+  const char *cartridge_paths[CART_SLOTS];
+  unsigned int cartridge_count = 0;
+  const char *coverage_path = NULL;
+  static hm1k_coverage coverage;
+  char line[256];
+  FILE *f;
+  int opt;
+
+  init_labels(&d.labels);
+  while ((opt = getopt(argc, argv, "C:c:l:")) != -1) {
+    switch (opt) {
+    case 'C':
+      coverage_path = optarg;
+      break;
+    case 'c':
+      if (cartridge_count == CART_SLOTS) goto usage;
+      cartridge_paths[cartridge_count++] = optarg;
+      break;
+    case 'l':
+      if (load_labels(&d.labels, optarg)) return 1;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind < argc - 1) goto usage;
+  if (optind < argc) rom_path = argv[optind];
+
+  f = fopen(rom_path, "rb");
+  if (!f) {
+    perror(rom_path);
+    return 1;
+  }
+  fread(rom, 1, ROM_SIZE, f);
+  fclose(f);
+
+  randomize(ram, sizeof(ram));
+  init_hm1000(&d.state, ram, rom);
+  /* Like the emulator, use cartridge.bin if present and no cartridge
+   * was given. */
+  if (cartridge_count > 0) {
+    if (insert_cartridges(&d.state, cartridge_paths, cartridge_count)) {
+      return 1;
+    }
+  } else {
+    const char *path = "cartridge.bin";
+    if (access(path, F_OK) == 0 &&
+        insert_cartridges(&d.state, &path, 1)) {
+      return 1;
+    }
+  }
+  if (coverage_path) {
+    init_coverage(&coverage);
+    start_coverage(&d.state, &coverage);
+  }
+  reset(&d.state);
+  d.list_addr = d.state.pc;
+  d.dump_addr = 0;
+
+  signal(SIGINT, handle_sigint);
+  print_registers(&d);
+  for (;;) {
+    if (isatty(0)) {
+      printf("> ");
+      fflush(stdout);
+    }
+    if (!fgets(line, sizeof(line), stdin)) break;
+    if (!command(&d, line)) break;
+    fflush(stdout);
+  }
+
+  free_labels(&d.labels);
+  if (coverage_path && merge_coverage(&coverage, coverage_path)) return 1;
+  return 0;
+
+ usage:
+  fprintf(stderr,
+          "Usage: %s [-C coveragefile] [-c cartridge]... [-l labelfile]..."
+          " [rom.bin]\n", argv[0]);
+  return 0x80;
+}
@@ -0,0 +1,110 @@
+/* Decodes execution traces written by the emulator.
+ *
+ * Usage: hmtrace [-l labelfile] [-n count] tracefile
+ *
+ * Prints the records in the trace, oldest first, with the instructions
+ * disassembled. With -n, only the last count records are printed. With
+ * -l, operands that match a label in the given xa label file are shown
+ * as that label.
+ */
+#include "disas.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void print_record(const hm1k_trace_record *r,
+                         const hm1k_labels *labels) {
+  const uint8_t bytes[3] = { r->op, r->operand[0], r->operand[1] };
+  char text[80];
+  char hex[9] = "";
+  unsigned int len, i;
+
+  len = disassemble(text, sizeof(text), r->pc, bytes, labels);
+  for (i = 0; i < len; i++) {
+    snprintf(hex + 3 * i, sizeof(hex) - 3 * i, "%02x ", bytes[i]);
+  }
+  printf("%12llu %04x: %-9s%-20s a=%02x x=%02x y=%02x s=%02x p=%02x",
+         (unsigned long long) r->cycles, r->pc, hex, text,
+         r->a, r->x, r->y, r->s, r->p);
+  if (r->access & TRACE_WRITE) {
+    printf(" [%04x] <- %02x", r->addr, r->val);
+  } else if ((r->access & TRACE_READ) &&
+             (uint16_t) (r->addr - r->pc) > 2) {
+    /* Only show reads outside the instruction itself. */
+    printf(" [%04x] -> %02x", r->addr, r->val);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  const hm1k_trace_header *header;
+  const hm1k_trace_record *records;
+  struct stat st;
+  uint64_t head, first, i, count = ~0ULL;
+  hm1k_labels labels;
+  void *map;
+  int fd, opt;
+
+  init_labels(&labels);
+  while ((opt = getopt(argc, argv, "l:n:")) != -1) {
+    switch (opt) {
+    case 'l':
+      if (load_labels(&labels, optarg)) return 1;
+      break;
+    case 'n':
+      count = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc - 1) goto usage;
+
+  fd = open(argv[optind], O_RDONLY);
+  if (fd == -1 || fstat(fd, &st)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if ((size_t) st.st_size < sizeof(*header)) {
+    fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+    return 1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  header = map;
+  records = (const hm1k_trace_record*) (header + 1);
+  if (memcmp(header->magic, TRACE_MAGIC, 4) ||
+      header->version != TRACE_VERSION ||
+      header->record_size != sizeof(hm1k_trace_record) ||
+      sizeof(*header) + (size_t) header->capacity * sizeof(*records) >
+      (size_t) st.st_size) {
+    fprintf(stderr, "%s: not a trace file or unsupported version\n",
+            argv[optind]);
+    return 1;
+  }
+
+  head = atomic_load_explicit(&((hm1k_trace_header*) header)->head,
+                              memory_order_acquire);
+  first = head > header->capacity ? head - header->capacity : 0;
+  if (head - first > count) first = head - count;
+  for (i = first; i < head; i++) {
+    print_record(&records[i & (header->capacity - 1)], &labels);
+  }
+  munmap(map, st.st_size);
+  free_labels(&labels);
+  return 0;
+
+ usage:
+  fprintf(stderr, "Usage: %s [-l labelfile] [-n count] tracefile\n", argv[0]);
+  return 0x80;
+}
@@ -1,15 +1,94 @@
 #include "hm1000.h"
+#include "soundout.h"
 #include "xcb.h"
 
 #include "hm1000.c"
 
+/** Number of records kept in the trace by default. */
+#define TRACE_RECORDS (1 << 20)
+
+/** Start and size of the memory the video controller reads from:
+ * color tiles, screen, and lower character set. The alternate video
+ * area, which holds the upper character set, is $4000 higher. */
+#define VIDEO_START 0x1c00
+#define VIDEO_SIZE 0x2400
+#define ALT_VIDEO_START (VIDEO_START + 0x4000)
+
+/** Both video areas as of the last call to take_video_dirty. */
+static uint8_t video_shadow[2][VIDEO_SIZE];
+
+/**
+ * Returns whether video memory changed since the last call.
+ * Comparing with a copy takes a few microseconds per redraw. Trapping
+ * writes to video memory instead would send every instruction through
+ * the slow path for as long as any of those pages stayed unwritten.
+ */
+static bool take_video_dirty(const uint8_t *ram) {
+  static const uint16_t starts[2] = { VIDEO_START, ALT_VIDEO_START };
+  bool dirty = false;
+  unsigned int i;
+  for (i = 0; i < 2; i++) {
+    if (memcmp(video_shadow[i], ram + starts[i], VIDEO_SIZE)) {
+      memcpy(video_shadow[i], ram + starts[i], VIDEO_SIZE);
+      dirty = true;
+    }
+  }
+  return dirty;
+}
+
 int main(int argc, char *argv[]) {
   hm1k_state state;
   uint8_t ram[RAM_SIZE];
   uint8_t rom[ROM_SIZE];
   bool redraw;
+  static hm1k_video video;
   xcb_generic_event_t *event;
   xcb_data gui;
+  const char *coverage_path = NULL;
+  const char *sound_path = NULL;
+  static hm1k_sound_out sound_out;
+  const char *trace_path = NULL;
+  hm1k_coverage coverage;
+  const char *cartridge_paths[CART_SLOTS];
+  unsigned int cartridge_count = 0;
+  unsigned long trace_records = TRACE_RECORDS;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:C:c:n:t:")) != -1) {
+    switch (opt) {
+    case 'a':
+      sound_path = optarg;
+      break;
+    case 'C':
+      coverage_path = optarg;
+      break;
+    case 'c':
+      if (cartridge_count == CART_SLOTS) {
+        fprintf(stderr, "At most %d cartridges can be inserted.\n",
+                CART_SLOTS);
+        return 0x80;
+      }
+      cartridge_paths[cartridge_count++] = optarg;
+      break;
+    case 'n':
+      trace_records = strtoul(optarg, NULL, 0);
+      if (trace_records == 0 || trace_records > TRACE_MAX_RECORDS) {
+        fprintf(stderr, "The number of trace records must be between 1"
+                " and %lu.\n", TRACE_MAX_RECORDS);
+        return 0x80;
+      }
+      break;
+    case 't':
+      trace_path = optarg;
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [-a soundfile] [-C coveragefile] [-c cartridge]..."
+              " [-t tracefile [-n records]]\n",
+              argv[0]);
+      return 0x80;
+    }
+  }
 
   if (init_xcb(&gui)) {
     FATAL("error initializing xcb");
@@ -30,33 +109,32 @@ int main(int argc, char *argv[]) {
     fread(rom, 1, ROM_SIZE, f);
     fclose(f);
   }
-  init_6502(&state, ram);
-  state.rom = rom;
-  state.io_read[SERIR - IO_BASE] = read_serir;
-  state.io_write[SERCR - IO_BASE] = write_sercr;
-  state.kbdrow = 0;
-  memset(state.keyboard, 0xff, sizeof(state.keyboard));
-  state.io_read[KBDCOL - IO_BASE] = read_kbdcol;
-  state.io_write[KBDROW - IO_BASE] = write_kbdrow;
-  do {
-    FILE *f = fopen("cartridge.bin", "rb");
-    if (!f) break;
-    fseek(f, 0, SEEK_END);
-    state.cartridge_size = ftell(f);
-    rewind(f);
-    state.cartridge = malloc(state.cartridge_size);
-    if (!state.cartridge) {
-      fprintf(stderr,
-              "failed to allocate memory (%lu bytes) for cartridge\n",
-              (unsigned long) state.cartridge_size);
-      perror("malloc");
-      break;
+  init_hm1000(&state, ram, rom);
+  if (cartridge_count > 0) {
+    if (insert_cartridges(&state, cartridge_paths, cartridge_count)) {
+      return 1;
     }
-    memset(state.cartridge, 0xff, state.cartridge_size);
-    fread(state.cartridge, 1, state.cartridge_size, f);
-    fclose(f);
-  } while (0);
+  } else {
+    /* Use cartridge.bin if present. */
+    const char *path = "cartridge.bin";
+    if (access(path, F_OK) == 0 && insert_cartridges(&state, &path, 1)) {
+      return 1;
+    }
+  }
+  if (trace_path) {
+    state.trace = open_trace(trace_path, trace_records);
+    if (!state.trace) return 1;
+  }
+  if (coverage_path) {
+    init_coverage(&coverage);
+    start_coverage(&state, &coverage);
+  }
+  init_video(&video);
   reset(&state);
+  if (sound_path) {
+    if (start_sound_out(&sound_out, sound_path)) return 1;
+    connect_sound(&state.sound, &sound_out.ring, state.cycles);
+  }
 
   redraw = true;
   for (;;) {
@@ -75,14 +153,18 @@ int main(int argc, char *argv[]) {
     event = xcb_poll_for_event(gui.xcb);
     if (!event) {
       if (redraw) {
-        update_display(&gui, ram, /* force_redraw */ false);
+        sound_update(&state.sound, state.cycles);
+        update_display(&gui, &video,
+                       render_video(&video, state.vmode, state.color01,
+                                    state.color23, ram, rom,
+                                    take_video_dirty(ram)));
         redraw = false;
       }
       continue;
     }
     switch (event->response_type & ~0x80) {
     case XCB_EXPOSE:
-      update_display(&gui, ram, /* force_redraw */ true);
+      redraw_display(&gui, &video);
       redraw = false;
       break;
     case XCB_KEY_PRESS:
@@ -114,7 +196,7 @@ int main(int argc, char *argv[]) {
         xcb_configure_notify_event_t *cne =
           (xcb_configure_notify_event_t*) event;
         resize(&gui, cne->width, cne->height);
-        update_display(&gui, ram, /* force_redraw */ true);
+        redraw_display(&gui, &video);
         redraw = false;
       }
       break;
@@ -129,5 +211,14 @@ int main(int argc, char *argv[]) {
   }  
 
   xcb_disconnect(gui.xcb);
+  if (sound_path) {
+    sound_update(&state.sound, state.cycles);
+    if (state.sound.dropped) {
+      fprintf(stderr, "%lu sound samples dropped\n", state.sound.dropped);
+    }
+    if (stop_sound_out(&sound_out)) perror(sound_path);
+  }
+  if (state.trace) close_trace(state.trace);
+  if (coverage_path && merge_coverage(&coverage, coverage_path)) return 1;
   return 0;
 }
@@ -0,0 +1,88 @@
+#include "sound.h"
+
+#include <string.h>
+
+/* Shift register taps for the noise channel: x^15 + x^14 + 1, which
+ * repeats after 32767 steps. */
+#define LFSR_INIT 0x4000
+
+void init_sound(hm1k_sound *sound) {
+  memset(sound->divider, 0, sizeof(sound->divider));
+  memset(sound->volume, 0, sizeof(sound->volume));
+  memset(sound->count, 0, sizeof(sound->count));
+  sound->lfsr = LFSR_INIT;
+  sound->cycles = 0;
+  sound->ring = NULL;
+  sound->dropped = 0;
+}
+
+void init_sound_ring(hm1k_sound_ring *ring) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+}
+
+void connect_sound(hm1k_sound *sound, hm1k_sound_ring *ring,
+                   unsigned long cycles) {
+  sound->ring = ring;
+  sound->cycles = cycles;
+}
+
+/** Advances channel ch by one sample and returns its output. */
+static inline int step_channel(hm1k_sound *sound, unsigned int ch) {
+  const uint16_t divider = sound->divider[ch];
+  if (divider == 0) return 0;
+  if (++sound->count[ch] >= divider) {
+    sound->count[ch] = 0;
+    if (ch == SOUND_NOISE) {
+      const uint16_t bit = (sound->lfsr ^ (sound->lfsr >> 1)) & 1;
+      sound->lfsr = (sound->lfsr >> 1) | (bit << 14);
+    }
+  }
+  if (ch == SOUND_NOISE) return sound->lfsr & 1;
+  /* High for the first half of the period. */
+  return sound->count[ch] < (divider + 1) / 2;
+}
+
+void sound_update(hm1k_sound *sound, unsigned long cycles) {
+  hm1k_sound_ring *ring = sound->ring;
+  size_t head, room, n;
+
+  if (!ring || cycles - sound->cycles < SOUND_SAMPLE_CYCLES) return;
+  n = (cycles - sound->cycles) / SOUND_SAMPLE_CYCLES;
+  sound->cycles += n * SOUND_SAMPLE_CYCLES;
+
+  /* The consumer only ever makes more room, so it is enough to look
+   * once. Samples that do not fit are computed but dropped, so that
+   * the channels stay in step with the CPU. */
+  head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  room = SOUND_RING_SIZE -
+    (head - atomic_load_explicit(&ring->tail, memory_order_acquire));
+  for (; n > 0; n--) {
+    unsigned int sample = 0, ch;
+    for (ch = 0; ch < SOUND_CHANNELS; ch++) {
+      if (step_channel(sound, ch)) sample += sound->volume[ch];
+    }
+    if (room > 0) {
+      ring->data[head++ % SOUND_RING_SIZE] = sample;
+      --room;
+    } else {
+      ++sound->dropped;
+    }
+  }
+  atomic_store_explicit(&ring->head, head, memory_order_release);
+}
+
+void sound_write(hm1k_sound *sound, unsigned int reg, uint8_t val,
+                 unsigned long cycles) {
+  sound_update(sound, cycles);
+  if (reg < SOUND_DIV_LO(SOUND_CHANNELS)) {
+    uint16_t *divider = &sound->divider[reg / 2];
+    if (reg & 1) {
+      *divider = (*divider & 0x00ff) | ((val & 0x0f) << 8);
+    } else {
+      *divider = (*divider & 0x0f00) | val;
+    }
+  } else if (reg < SOUND_REGISTERS) {
+    sound->volume[reg - SOUND_VOLUME(0)] = val & SOUND_MAX_VOLUME;
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef HOMEMICRO_EMULATOR_SOUND
+#define HOMEMICRO_EMULATOR_SOUND
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The sound generator described in docs/design/sound.txt: three square
+ * wave channels and a noise channel. The generator runs a loop of 128
+ * ticks of the 7.16 MHz master clock, which is 32 CPU cycles, and
+ * produces one sample per loop: the sum of the volumes of the channels
+ * whose output is high.
+ *
+ * Samples are only computed when a register is written or when
+ * sound_update is called, in one batch covering all the loops since
+ * the last time, and go into a ring buffer that another thread reads
+ * from.
+ */
+
+/* CPU cycles per sample. */
+#define SOUND_SAMPLE_CYCLES 32
+
+/* Samples per second, rounded down from 55930.3. */
+#define SOUND_RATE 55930
+
+#define SOUND_CHANNELS 4
+/* The channel whose output comes from a shift register. */
+#define SOUND_NOISE 3
+
+/* Offsets of the registers from SOUND_BASE. Each channel has a 12-bit
+ * divider, low byte first, and a 6-bit volume. */
+#define SOUND_DIV_LO(CH) (2 * (CH))
+#define SOUND_DIV_HI(CH) (2 * (CH) + 1)
+#define SOUND_VOLUME(CH) (2 * SOUND_CHANNELS + (CH))
+#define SOUND_REGISTERS (3 * SOUND_CHANNELS)
+
+#define SOUND_MAX_VOLUME 63
+
+/* Size of the ring buffer in samples. A power of 2. At 55930 samples
+ * per second, this is almost 300 ms. */
+#define SOUND_RING_SIZE 16384
+
+/** Ring buffer with a single producer (the emulator) and a single
+ * consumer (the thread writing the samples out). head is only written
+ * by the producer and tail only by the consumer. Both count samples
+ * since the start and are reduced modulo SOUND_RING_SIZE to index
+ * data. */
+typedef struct {
+  uint8_t data[SOUND_RING_SIZE];
+  atomic_size_t head;
+  atomic_size_t tail;
+} hm1k_sound_ring;
+
+typedef struct {
+  /* 12-bit dividers: the output of a channel has a period of this many
+   * samples. 0 silences the channel. */
+  uint16_t divider[SOUND_CHANNELS];
+  uint8_t volume[SOUND_CHANNELS];
+  /* Samples into the current period. */
+  uint16_t count[SOUND_CHANNELS];
+  /* 15-bit shift register for the noise channel. */
+  uint16_t lfsr;
+  /* Samples have been produced up to this cycle. */
+  unsigned long cycles;
+  /* Where samples go. When NULL, only the registers are kept. */
+  hm1k_sound_ring *ring;
+  /* Number of samples dropped because the ring was full. */
+  unsigned long dropped;
+} hm1k_sound;
+
+/** Initializes the generator with all channels silent and no ring. */
+void init_sound(hm1k_sound *sound);
+
+/** Initializes an empty ring. */
+void init_sound_ring(hm1k_sound_ring *ring);
+
+/** Makes sound send its samples to ring, starting at cycle cycles. */
+void connect_sound(hm1k_sound *sound, hm1k_sound_ring *ring,
+                   unsigned long cycles);
+
+/** Produces the samples up to cycle cycles. */
+void sound_update(hm1k_sound *sound, unsigned long cycles);
+
+/** Writes val to register reg at cycle cycles. Samples up to that cycle
+ * are produced with the old register values. */
+void sound_write(hm1k_sound *sound, unsigned int reg, uint8_t val,
+                 unsigned long cycles);
+
+#endif /* ndef HOMEMICRO_EMULATOR_SOUND */
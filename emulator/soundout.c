@@ -0,0 +1,128 @@
+#include "soundout.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define WAV_HEADER_SIZE 44
+
+/* How long the thread sleeps when the ring is empty. The ring holds
+ * much more than this. */
+#define POLL_NS 10000000
+
+static void put_u16(uint8_t *p, uint16_t x) {
+  p[0] = x & 0xff;
+  p[1] = x >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t x) {
+  put_u16(p, x & 0xffff);
+  put_u16(p + 2, x >> 16);
+}
+
+/** Fills in a WAV header for samples bytes of sound data. */
+static void wav_header(uint8_t *h, uint32_t samples) {
+  memcpy(h, "RIFF", 4);
+  put_u32(h + 4, samples > UINT32_MAX - 36 ? UINT32_MAX : samples + 36);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  put_u32(h + 16, 16);
+  /* PCM, mono. */
+  put_u16(h + 20, 1);
+  put_u16(h + 22, 1);
+  put_u32(h + 24, SOUND_RATE);
+  /* Bytes per second, bytes per sample, bits per sample. */
+  put_u32(h + 28, SOUND_RATE);
+  put_u16(h + 32, 1);
+  put_u16(h + 34, 8);
+  memcpy(h + 36, "data", 4);
+  put_u32(h + 40, samples);
+}
+
+/** Writes what is in the ring to the file. Returns the number of
+ * samples written. */
+static size_t drain(hm1k_sound_out *out) {
+  hm1k_sound_ring *ring = &out->ring;
+  const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const size_t n = head - tail;
+  while (tail != head) {
+    /* Up to the end of the data or the end of the buffer. */
+    const size_t start = tail % SOUND_RING_SIZE;
+    size_t count = head - tail;
+    if (count > SOUND_RING_SIZE - start) count = SOUND_RING_SIZE - start;
+    fwrite(ring->data + start, 1, count, out->f);
+    tail += count;
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+  out->written += n;
+  return n;
+}
+
+static void *sound_thread(void *arg) {
+  hm1k_sound_out *out = arg;
+  const struct timespec poll = { 0, POLL_NS };
+  for (;;) {
+    const bool stop = atomic_load(&out->stop);
+    if (drain(out) > 0) {
+      fflush(out->f);
+    } else if (stop) {
+      break;
+    } else {
+      nanosleep(&poll, NULL);
+    }
+  }
+  return NULL;
+}
+
+int start_sound_out(hm1k_sound_out *out, const char *path) {
+  uint8_t header[WAV_HEADER_SIZE];
+  int err;
+
+  init_sound_ring(&out->ring);
+  atomic_init(&out->stop, false);
+  out->written = 0;
+  out->pipe = path[0] == '|';
+  out->f = out->pipe ? popen(path + 1, "w") : fopen(path, "wb");
+  if (!out->f) {
+    perror(path);
+    return -1;
+  }
+  /* The sizes are filled in by stop_sound_out, if possible. */
+  wav_header(header, UINT32_MAX);
+  if (fwrite(header, 1, sizeof(header), out->f) != sizeof(header)) {
+    perror(path);
+    goto error;
+  }
+  err = pthread_create(&out->thread, NULL, sound_thread, out);
+  if (err) {
+    fprintf(stderr, "pthread_create: %s\n", strerror(err));
+    goto error;
+  }
+  return 0;
+
+ error:
+  if (out->pipe) {
+    pclose(out->f);
+  } else {
+    fclose(out->f);
+  }
+  return -1;
+}
+
+int stop_sound_out(hm1k_sound_out *out) {
+  int result = 0;
+  atomic_store(&out->stop, true);
+  pthread_join(out->thread, NULL);
+  if (out->pipe) {
+    if (pclose(out->f) == -1) result = -1;
+  } else {
+    uint8_t header[WAV_HEADER_SIZE];
+    wav_header(header, out->written);
+    if (fseek(out->f, 0, SEEK_SET) != 0 ||
+        fwrite(header, 1, sizeof(header), out->f) != sizeof(header)) {
+      result = -1;
+    }
+    if (fclose(out->f) != 0) result = -1;
+  }
+  return result;
+}
@@ -0,0 +1,39 @@
+#ifndef HOMEMICRO_EMULATOR_SOUNDOUT
+#define HOMEMICRO_EMULATOR_SOUNDOUT
+
+#include "sound.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Writes the samples from a sound ring to a WAV file or pipe, from a
+ * thread of its own, so that the emulator never waits for output. The
+ * samples are written as 8-bit unsigned mono at SOUND_RATE. */
+
+typedef struct {
+  hm1k_sound_ring ring;
+  FILE *f;
+  /* Whether f was opened with popen. Pipes cannot be rewound to fill
+   * in the sizes in the WAV header, so those stay at their maximum. */
+  bool pipe;
+  pthread_t thread;
+  atomic_bool stop;
+  /* Number of samples written. Only used by the thread. */
+  unsigned long written;
+} hm1k_sound_out;
+
+/**
+ * Opens path and starts writing samples from out->ring to it. If path
+ * starts with '|', the rest is run as a shell command and the samples
+ * go to its standard input, for example "|aplay -q". Returns 0 on
+ * success. On failure, prints a message and returns -1.
+ */
+int start_sound_out(hm1k_sound_out *out, const char *path);
+
+/** Writes any samples still in the ring, stops the thread and closes
+ * the file. Returns 0 on success. */
+int stop_sound_out(hm1k_sound_out *out);
+
+#endif /* ndef HOMEMICRO_EMULATOR_SOUNDOUT */
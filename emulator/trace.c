@@ -0,0 +1,58 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+hm1k_trace *open_trace(const char *path, uint32_t capacity) {
+  hm1k_trace *t;
+  void *map;
+  size_t size;
+  uint32_t n = 1;
+  int fd;
+
+  while (n < capacity) n <<= 1;
+  size = sizeof(hm1k_trace_header) + (size_t) n * sizeof(hm1k_trace_record);
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    perror(path);
+    return NULL;
+  }
+  if (ftruncate(fd, size)) {
+    perror(path);
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("open_trace: mmap");
+    return NULL;
+  }
+
+  t = malloc(sizeof(*t));
+  if (!t) {
+    munmap(map, size);
+    return NULL;
+  }
+  t->header = map;
+  t->records = (hm1k_trace_record*) (t->header + 1);
+  t->head = 0;
+  t->mask = n - 1;
+  t->size = size;
+  memcpy(t->header->magic, TRACE_MAGIC, 4);
+  t->header->version = TRACE_VERSION;
+  t->header->record_size = sizeof(hm1k_trace_record);
+  t->header->capacity = n;
+  atomic_store(&t->header->head, 0);
+  return t;
+}
+
+void close_trace(hm1k_trace *t) {
+  munmap(t->header, t->size);
+  free(t);
+}
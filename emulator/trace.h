@@ -0,0 +1,78 @@
+#ifndef HOMEMICRO_EMULATOR_TRACE
+#define HOMEMICRO_EMULATOR_TRACE
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Execution traces are stored in a file that starts with a
+ * hm1k_trace_header, followed by capacity fixed-size records. The
+ * records form a ring buffer: record n is stored at index
+ * n % capacity, and head holds the total number of records written.
+ * The emulator is the only writer. It fills in a record, then
+ * publishes it by storing the new head with release semantics, so
+ * that readers mapping the same file can follow along without
+ * locking.
+ */
+
+#define TRACE_MAGIC "HMTR"
+#define TRACE_VERSION 2
+
+/* Bits in hm1k_trace_record.access. */
+#define TRACE_READ 1
+#define TRACE_WRITE 2
+
+/** State before executing one instruction, along with the last memory
+ * access the instruction made. operand holds the bytes after the
+ * opcode, so that the instruction can be disassembled; bytes the
+ * instruction does not use are whatever follows it in memory. */
+typedef struct {
+  uint64_t cycles;
+  uint16_t pc;
+  uint16_t addr;
+  uint8_t op, operand[2], a, x, y, s, p;
+  uint8_t val;
+  uint8_t access;
+} hm1k_trace_record;
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t record_size;
+  /* Number of records. Always a power of 2. */
+  uint32_t capacity;
+  _Atomic uint64_t head;
+  uint8_t reserved[40];
+} hm1k_trace_header;
+
+typedef struct {
+  hm1k_trace_header *header;
+  hm1k_trace_record *records;
+  uint64_t head;
+  uint32_t mask;
+  size_t size;
+} hm1k_trace;
+
+/** Largest number of records a trace can hold. */
+#define TRACE_MAX_RECORDS 0x80000000UL
+
+/** Creates a trace file that holds the given number of records, which
+ * is rounded up to a power of 2. capacity must not exceed
+ * TRACE_MAX_RECORDS. Returns NULL on error. */
+hm1k_trace *open_trace(const char *path, uint32_t capacity);
+
+/** Unmaps the trace file and frees t. */
+void close_trace(hm1k_trace *t);
+
+/** Returns the record to fill in next. */
+static inline hm1k_trace_record *trace_next(hm1k_trace *t) {
+  return &t->records[t->head & t->mask];
+}
+
+/** Makes the record returned by trace_next visible to readers. */
+static inline void trace_commit(hm1k_trace *t) {
+  atomic_store_explicit(&t->header->head, ++t->head,
+                        memory_order_release);
+}
+
+#endif /* ndef HOMEMICRO_EMULATOR_TRACE */
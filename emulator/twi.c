@@ -0,0 +1,97 @@
+#include "twi.h"
+
+#include <stddef.h>
+
+void init_twi(hm1k_twi_bus *bus) {
+  bus->state = TWI_IDLE;
+  bus->lines = TWI_LINE_SCL | TWI_LINE_SDA;
+  bus->shift = 0;
+  bus->fast_bits = 0;
+  bus->receiving = 1;
+  bus->active = NULL;
+  bus->device_count = 0;
+}
+
+int attach_twi_device(hm1k_twi_bus *bus, hm1k_twi_device *dev) {
+  if (bus->device_count == TWI_MAX_DEVICES) return -1;
+  bus->devices[bus->device_count++] = dev;
+  return 0;
+}
+
+/** Enters state and sets up the shift register for its next byte. */
+static void begin_byte(hm1k_twi_bus *bus, uint8_t state) {
+  bus->state = state;
+  switch (state) {
+  case TWI_ADDR:
+  case TWI_WRITE:
+    bus->fast_bits = 8;
+    bus->receiving = 1;
+    break;
+  case TWI_READ:
+    bus->shift = bus->active->read(bus->active);
+    bus->fast_bits = 8;
+    bus->receiving = 0;
+    break;
+  default:
+    bus->fast_bits = 0;
+    break;
+  }
+}
+
+/** Handles a complete byte sent by the master. Returns true if it was
+ * acknowledged. */
+static bool byte_received(hm1k_twi_bus *bus) {
+  bool ack = false;
+  unsigned int i;
+  if (bus->state == TWI_ADDR) {
+    for (i = 0; i < bus->device_count; i++) {
+      hm1k_twi_device *dev = bus->devices[i];
+      if ((bus->shift & dev->addr_mask) == dev->addr) {
+        ack = dev->start(dev, bus->shift);
+        if (ack) bus->active = dev;
+        break;
+      }
+    }
+    begin_byte(bus, !ack ? TWI_IDLE :
+               (bus->shift & 1) ? TWI_READ : TWI_WRITE);
+  } else {
+    ack = bus->active->write(bus->active, bus->shift);
+    begin_byte(bus, ack ? TWI_WRITE : TWI_IDLE);
+  }
+  return ack;
+}
+
+/** Handles a rising clock that twi_update did not handle: the
+ * acknowledge bit after a byte, or a clock while the bus is idle.
+ * Returns the level of SDA. */
+static int clock_bit(hm1k_twi_bus *bus, int sda) {
+  switch (bus->state) {
+  case TWI_ADDR:
+  case TWI_WRITE:
+    if (byte_received(bus)) sda = 0;
+    break;
+  case TWI_READ:
+    /* The master ends a read by not acknowledging. */
+    begin_byte(bus, sda ? TWI_IDLE : TWI_READ);
+    break;
+  }
+  return sda;
+}
+
+int twi_event(hm1k_twi_bus *bus, uint8_t event, int sda) {
+  switch (event) {
+  case TWI_EV_CLOCK:
+    return clock_bit(bus, sda);
+  case TWI_EV_START:
+    /* A repeated start ends the current transfer without a stop. */
+    bus->active = NULL;
+    begin_byte(bus, TWI_ADDR);
+    break;
+  case TWI_EV_STOP:
+    if (bus->active && bus->active->stop) bus->active->stop(bus->active);
+    bus->active = NULL;
+    begin_byte(bus, TWI_IDLE);
+    break;
+  }
+  return -1;
+}
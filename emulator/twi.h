@@ -0,0 +1,124 @@
+#ifndef HOMEMICRO_EMULATOR_TWI
+#define HOMEMICRO_EMULATOR_TWI
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The TWI (I2C) bus. The CPU drives SCL and SDA through SERCR. The bus
+ * turns changes in those lines into start and stop conditions and
+ * bytes, and passes those on to the devices attached to the bus.
+ * Devices only see whole bytes.
+ */
+
+#define TWI_MAX_DEVICES 8
+
+typedef struct hm1k_twi_device_s hm1k_twi_device;
+
+/** A device on the bus. Device models embed this as their first
+ * member. */
+struct hm1k_twi_device_s {
+  /* The device responds to address bytes for which
+   * (byte & addr_mask) == addr. The lowest bit of the address byte is
+   * the read/write bit. */
+  uint8_t addr;
+  uint8_t addr_mask;
+  /* Called when the device is addressed after a start condition.
+   * Returns true to acknowledge. */
+  bool (*start) (hm1k_twi_device *dev, uint8_t addr_byte);
+  /* Called for every byte the master writes to the device. Returns
+   * true to acknowledge. */
+  bool (*write) (hm1k_twi_device *dev, uint8_t byte);
+  /* Called when the master starts reading a byte from the device. */
+  uint8_t (*read) (hm1k_twi_device *dev);
+  /* Called on a stop condition if the device was addressed. */
+  void (*stop) (hm1k_twi_device *dev);
+};
+
+typedef struct {
+  /* State of the bus; one of the TWI_* states below. */
+  uint8_t state;
+  /* Level of SCL and SDA, as bits 1 and 0. Kept at 0 while SCL is
+   * low, as the level of SDA does not matter then. */
+  uint8_t lines;
+  /* Bits received so far, or the bits the device has yet to send. */
+  uint8_t shift;
+  /* Number of data bits of the current byte still to be clocked.
+   * twi_update shifts these itself; the clock after them is the
+   * acknowledge bit, which goes to twi_event. */
+  uint8_t fast_bits;
+  /* 1 while the master sends data bits, 0 while a device does. */
+  uint8_t receiving;
+  hm1k_twi_device *active;
+  hm1k_twi_device *devices[TWI_MAX_DEVICES];
+  unsigned int device_count;
+} hm1k_twi_bus;
+
+/* Bus states. Each one lasts for the eight data bits of a byte and
+ * its acknowledge bit. */
+/* Waiting for a start condition. */
+#define TWI_IDLE 0
+/* Receiving an address byte. */
+#define TWI_ADDR 1
+/* Receiving a data byte from the master. */
+#define TWI_WRITE 2
+/* Sending a data byte to the master. */
+#define TWI_READ 3
+
+/* Events passed to twi_event. */
+#define TWI_EV_CLOCK 1
+#define TWI_EV_START 2
+#define TWI_EV_STOP 3
+
+/* Bits in hm1k_twi_bus.lines. */
+#define TWI_LINE_SDA 1
+#define TWI_LINE_SCL 2
+
+/** Initializes a bus with no devices. */
+void init_twi(hm1k_twi_bus *bus);
+
+/** Attaches a device to the bus. Returns 0 on success. */
+int attach_twi_device(hm1k_twi_bus *bus, hm1k_twi_device *dev);
+
+/** Handles the events that involve devices: a start or stop condition,
+ * or an acknowledge bit, at which a byte is passed to or fetched from
+ * the device. Returns the level of SDA for clock events. */
+int twi_event(hm1k_twi_bus *bus, uint8_t event, int sda);
+
+/**
+ * Updates the bus for new levels of SCL and SDA as driven by the
+ * master. Returns the level of SDA as seen by the master after a
+ * rising clock edge (0 if any device pulls it low), or -1 if SCL did
+ * not rise.
+ * This is called for every write to SERCR, so writes that leave SCL
+ * low return early, and shifting bits in and out is done here;
+ * everything else is left to twi_event.
+ */
+static inline int twi_update(hm1k_twi_bus *bus, bool scl, bool sda) {
+  uint8_t old;
+  /* Data bits are sampled when SCL rises. Nothing happens while SCL
+   * is low or when it falls, and SDA only matters while SCL is high. */
+  if (!scl) {
+    bus->lines = 0;
+    return -1;
+  }
+  old = bus->lines;
+  bus->lines = TWI_LINE_SCL | (sda ? TWI_LINE_SDA : 0);
+  if (old) {
+    /* A change in SDA while SCL stays high is a start or stop
+     * condition. */
+    if ((old ^ bus->lines) & TWI_LINE_SDA) {
+      return twi_event(bus, sda ? TWI_EV_STOP : TWI_EV_START, sda);
+    }
+    return -1;
+  }
+  if (bus->fast_bits) {
+    /* Devices can only pull SDA low. */
+    const int level = sda & ((bus->shift >> 7) | bus->receiving);
+    bus->shift = (bus->shift << 1) | (sda & bus->receiving);
+    --bus->fast_bits;
+    return level;
+  }
+  return twi_event(bus, TWI_EV_CLOCK, sda);
+}
+
+#endif /* ndef HOMEMICRO_EMULATOR_TWI */
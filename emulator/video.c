@@ -0,0 +1,256 @@
+#include "video.h"
+
+#include <string.h>
+
+/* Where the video controller reads from. In the alternate video area,
+ * the screen and tiles are ALT_OFFSET higher. */
+#define TILES_OFFSET 0x1c00
+#define SCREEN_OFFSET 0x2000
+#define ALT_OFFSET 0x4000
+#define LOWER_CHARSET 0x2800
+#define UPPER_CHARSET 0x6800
+/* Offset of the font in the ROM. */
+#define ROM_CHARSET 0x0800
+
+/* Bytes per row of cells in bitmap modes. */
+#define BITMAP_ROW_BYTES (VIDEO_COLUMNS * 8)
+
+/* In color character mode, the right half of every line of a
+ * character is this far after the left half. */
+#define COLOR_CHARSET_HALF 0x400
+
+/* Pixels in a row of cells. */
+#define ROW_PIXELS (VIDEO_WIDTH * 8)
+
+/** The last palette in docs/design/palette, taken from the swatches in
+ * rgbi3.png: bit 0 is red, bit 1 green, bit 2 blue, and bit 3
+ * intensity. */
+const uint32_t video_palette[16] = {
+  0x000000, 0x850000, 0x005600, 0x855600,
+  0x003785, 0x853785, 0x008e85, 0x858e85,
+  0x636363, 0xe86363, 0x63ba63, 0xe8ba63,
+  0x639be8, 0xe89be8, 0x63f2e8, 0xe8f2e8,
+};
+
+/** What a kernel needs to render the current mode. */
+typedef struct {
+  /* Bitmap or character codes. */
+  const uint8_t *screen;
+  const uint8_t *tiles;
+  const uint8_t *charset;
+  /* Colors 0 through 3, from COLOR01 and COLOR23. */
+  uint32_t colors[4];
+} video_context;
+
+/** Renders one row of cells, 8 lines of VIDEO_WIDTH pixels, to out. */
+typedef void (*video_kernel) (const video_context *c, unsigned int row,
+                              uint32_t *out);
+
+/** Writes 8 pixels for a byte of 1 bit per pixel. */
+static inline void put_1bpp(uint32_t *out, uint8_t b,
+                            uint32_t c0, uint32_t c1) {
+  const uint32_t diff = c0 ^ c1;
+  int i;
+  for (i = 0; i < 8; i++) {
+    out[i] = c0 ^ (diff & -(uint32_t) ((b >> (7 - i)) & 1));
+  }
+}
+
+/** Writes 8 pixels for a byte of 2 bits per pixel, each 2 wide. */
+static inline void put_2bpp(uint32_t *out, uint8_t b,
+                            const uint32_t *colors) {
+  int i;
+  for (i = 0; i < 4; i++) {
+    out[2 * i] = out[2 * i + 1] = colors[(b >> (6 - 2 * i)) & 3];
+  }
+}
+
+/** Writes 4 pixels for a byte of 4 bits per pixel, each 2 wide. */
+static inline void put_4bpp(uint32_t *out, uint8_t b) {
+  out[0] = out[1] = video_palette[b >> 4];
+  out[2] = out[3] = video_palette[b & 15];
+}
+
+/**
+ * Renders a row of cells for a mode. The kernels below pass constants
+ * for kind, extra_color, and tiles, so that each of them is compiled
+ * into a loop that does only what its mode needs.
+ */
+static inline void render_cells(const video_context *c, unsigned int row,
+                                uint32_t *out, uint8_t kind,
+                                bool extra_color, bool tiles) {
+  uint32_t colors[4];
+  unsigned int col, line;
+  memcpy(colors, c->colors, sizeof(colors));
+  for (col = 0; col < VIDEO_COLUMNS; col++) {
+    const unsigned int cell = row * VIDEO_COLUMNS + col;
+    const uint8_t *data;
+    uint32_t *p = out + col * 8;
+    if (tiles) {
+      /* The tile replaces colors 0 and 1. */
+      colors[0] = video_palette[c->tiles[cell] & 15];
+      colors[1] = video_palette[c->tiles[cell] >> 4];
+    }
+    if (kind == VMODE_BITMAP) {
+      data = c->screen + row * BITMAP_ROW_BYTES + col * 8;
+    } else if (kind == VMODE_CHARACTER) {
+      data = c->charset + c->screen[cell] * 8;
+    } else {
+      data = c->charset + (c->screen[cell] & 0x7f) * 8;
+    }
+    for (line = 0; line < 8; line++, p += VIDEO_WIDTH) {
+      if (kind == VMODE_COLOR_CHARACTER) {
+        put_4bpp(p, data[line]);
+        put_4bpp(p + 4, data[COLOR_CHARSET_HALF + line]);
+      } else if (extra_color) {
+        put_2bpp(p, data[line], colors);
+      } else {
+        put_1bpp(p, data[line], colors[0], colors[1]);
+      }
+    }
+  }
+}
+
+#define KERNEL(NAME, KIND, EXTRA_COLOR, TILES) \
+  static void NAME(const video_context *c, unsigned int row, \
+                   uint32_t *out) { \
+    render_cells(c, row, out, KIND, EXTRA_COLOR, TILES); \
+  }
+
+KERNEL(render_mode0, VMODE_BITMAP, false, false)
+KERNEL(render_mode1, VMODE_BITMAP, true, false)
+KERNEL(render_mode2, VMODE_BITMAP, false, true)
+KERNEL(render_mode3, VMODE_BITMAP, true, true)
+KERNEL(render_mode5, VMODE_CHARACTER, true, false)
+KERNEL(render_mode7, VMODE_CHARACTER, true, true)
+KERNEL(render_mode9, VMODE_COLOR_CHARACTER, true, false)
+
+#undef KERNEL
+
+/** Modes without a definition show black. */
+static void render_blank(const video_context *c, unsigned int row,
+                         uint32_t *out) {
+  memset(out, 0, ROW_PIXELS * sizeof(*out));
+}
+
+/** Kernels, indexed by mode number. Modes 4 and 6 are drawn by
+ * render_text instead. */
+static const video_kernel kernels[16] = {
+  render_mode0, render_mode1, render_mode2, render_mode3,
+  NULL, render_mode5, NULL, render_mode7,
+  render_blank, render_mode9, render_blank, render_blank,
+  render_blank, render_blank, render_blank, render_blank,
+};
+
+static inline void set_bit(uint32_t *bits, unsigned int i) {
+  bits[i / 32] |= (uint32_t) 1 << (i % 32);
+}
+
+/**
+ * Renders a 2-color character mode. Instead of decoding every pixel,
+ * this compares the character set and every cell's code and colors to
+ * what they were last time, and only draws the cells that changed or
+ * that show a glyph that changed. When all is true, everything is
+ * treated as changed. Returns the rows of cells that changed.
+ */
+static uint32_t render_text(hm1k_video *video, const video_context *c,
+                            bool tiles, uint8_t color01, bool all) {
+  uint32_t rows = 0;
+  unsigned int i, line;
+
+  memset(video->changed_glyphs, 0, sizeof(video->changed_glyphs));
+  for (i = 0; i < VIDEO_GLYPHS; i++) {
+    const uint8_t *glyph = c->charset + i * 8;
+    if (all || memcmp(video->glyphs + i * 8, glyph, 8) != 0) {
+      memcpy(video->glyphs + i * 8, glyph, 8);
+      set_bit(video->changed_glyphs, i);
+    }
+  }
+
+  memset(video->changed_cells, 0, sizeof(video->changed_cells));
+  for (i = 0; i < VIDEO_CELLS; i++) {
+    const uint8_t code = c->screen[i];
+    const uint8_t colors = tiles ? c->tiles[i] : color01;
+    const unsigned int row = i / VIDEO_COLUMNS, col = i % VIDEO_COLUMNS;
+    const uint8_t *glyph = video->glyphs + code * 8;
+    uint32_t *p = video->pixels + row * ROW_PIXELS + col * 8;
+    if (!all && code == video->codes[i] && colors == video->colors[i] &&
+        !video_changed(video->changed_glyphs, code)) {
+      continue;
+    }
+    video->codes[i] = code;
+    video->colors[i] = colors;
+    set_bit(video->changed_cells, i);
+    rows |= (uint32_t) 1 << row;
+    for (line = 0; line < 8; line++, p += VIDEO_WIDTH) {
+      put_1bpp(p, glyph[line], video_palette[colors & 15],
+               video_palette[colors >> 4]);
+    }
+  }
+  return rows;
+}
+
+void init_video(hm1k_video *video) {
+  memset(video->pixels, 0, sizeof(video->pixels));
+  video->vmode = 0;
+  video->color01 = 0;
+  video->color23 = 0;
+  video->valid = false;
+  video->text = false;
+}
+
+uint32_t render_video(hm1k_video *video, uint8_t vmode, uint8_t color01,
+                      uint8_t color23, const uint8_t *ram,
+                      const uint8_t *rom, bool memory_changed) {
+  uint32_t buf[ROW_PIXELS];
+  const unsigned int base = (vmode & VMODE_ALT) ? ALT_OFFSET : 0;
+  const video_kernel kernel = kernels[vmode & 0x0f];
+  const bool same_registers = video->valid && vmode == video->vmode &&
+    color01 == video->color01 && color23 == video->color23;
+  video_context c;
+  uint32_t changed = 0;
+  unsigned int row;
+
+  if (!memory_changed && same_registers) return 0;
+
+  c.screen = ram + base + SCREEN_OFFSET;
+  c.tiles = ram + base + TILES_OFFSET;
+  switch (vmode & VMODE_CHARSET) {
+  case 0x20:
+    c.charset = ram + LOWER_CHARSET;
+    break;
+  case 0x40:
+    c.charset = ram + UPPER_CHARSET;
+    break;
+  default:
+    c.charset = rom + ROM_CHARSET;
+  }
+  c.colors[0] = video_palette[color01 & 15];
+  c.colors[1] = video_palette[color01 >> 4];
+  c.colors[2] = video_palette[color23 & 15];
+  c.colors[3] = video_palette[color23 >> 4];
+
+  if (!kernel) {
+    /* After another mode, the cells and glyphs are out of date. */
+    changed = render_text(video, &c, vmode & VMODE_TILES, color01,
+                          !same_registers || !video->text);
+    video->text = true;
+  } else {
+    video->text = false;
+  }
+
+  /* Only report the rows that actually look different. */
+  for (row = 0; kernel && row < VIDEO_ROWS; row++) {
+    uint32_t *pixels = video->pixels + row * ROW_PIXELS;
+    kernel(&c, row, buf);
+    if (!video->valid || memcmp(buf, pixels, sizeof(buf)) != 0) {
+      memcpy(pixels, buf, sizeof(buf));
+      changed |= (uint32_t) 1 << row;
+    }
+  }
+  video->vmode = vmode;
+  video->color01 = color01;
+  video->color23 = color23;
+  video->valid = true;
+  return changed;
+}
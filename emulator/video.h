@@ -0,0 +1,82 @@
+#ifndef HOMEMICRO_EMULATOR_VIDEO
+#define HOMEMICRO_EMULATOR_VIDEO
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Turns video memory into pixels, as the Home Micro 2000 video
+ * controller does. docs/emulator.txt describes how the modes are
+ * decoded. The Home Micro 1000 only has mode 0. */
+
+#define VIDEO_WIDTH 320
+#define VIDEO_HEIGHT 200
+
+/* The screen consists of 40x25 cells of 8x8 pixels. */
+#define VIDEO_COLUMNS 40
+#define VIDEO_ROWS 25
+#define VIDEO_ALL_ROWS ((UINT32_C(1) << VIDEO_ROWS) - 1)
+#define VIDEO_CELLS (VIDEO_COLUMNS * VIDEO_ROWS)
+
+/* Number of characters in a character set. */
+#define VIDEO_GLYPHS 256
+
+/* Bits in the video mode register. The low 4 bits are the mode
+ * number. */
+#define VMODE_EXTRA_COLOR 0x01
+#define VMODE_TILES 0x02
+#define VMODE_KIND 0x0c
+#define VMODE_CHARSET 0x60
+#define VMODE_ALT 0x80
+
+/* Values of the VMODE_KIND bits. */
+#define VMODE_BITMAP 0x00
+#define VMODE_CHARACTER 0x04
+#define VMODE_COLOR_CHARACTER 0x08
+
+/** The 16 colors of the palette, as 0xRRGGBB. */
+extern const uint32_t video_palette[16];
+
+typedef struct {
+  /* The picture, as 0xRRGGBB per pixel, row by row. */
+  uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT];
+  /* Registers the picture was last rendered with. */
+  uint8_t vmode, color01, color23;
+  /* False until the first picture has been rendered. */
+  bool valid;
+  /* Set in the 2-color character modes, 4 and 6. The picture is then
+   * also described as characters, so that a display can draw it from
+   * glyphs it has cached, redrawing only the cells and glyphs that
+   * changed in the last render_video. */
+  bool text;
+  /* Character code and colors of every cell. Color 0 is in the low 4
+   * bits and color 1 in the high 4 bits. */
+  uint8_t codes[VIDEO_CELLS];
+  uint8_t colors[VIDEO_CELLS];
+  /* The character set, 8 bytes per glyph. */
+  uint8_t glyphs[VIDEO_GLYPHS * 8];
+  /* Bit i % 32 of changed_cells[i / 32] is set if cell i changed, and
+   * likewise for glyphs. */
+  uint32_t changed_cells[(VIDEO_CELLS + 31) / 32];
+  uint32_t changed_glyphs[VIDEO_GLYPHS / 32];
+} hm1k_video;
+
+/** Returns whether bit i is set in changed_cells or changed_glyphs. */
+static inline bool video_changed(const uint32_t *bits, unsigned int i) {
+  return bits[i / 32] & ((uint32_t) 1 << (i % 32));
+}
+
+/** Initializes video so that the first render_video draws everything. */
+void init_video(hm1k_video *video);
+
+/**
+ * Renders the picture shown for video mode vmode and color registers
+ * color01 and color23. ram holds the first 48K of the address space and
+ * rom the 8K ROM at $e000. When memory_changed is false and the
+ * registers are the same as last time, nothing is done.
+ * Returns a mask with bit i set if cell row i of the picture changed.
+ */
+uint32_t render_video(hm1k_video *video, uint8_t vmode, uint8_t color01,
+                      uint8_t color23, const uint8_t *ram,
+                      const uint8_t *rom, bool memory_changed);
+
+#endif /* ndef HOMEMICRO_EMULATOR_VIDEO */
@@ -1,6 +1,7 @@
 #include "xcb.h"
 #include "hm1000.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,6 +12,7 @@ static void clear_rect(xcb_data *gui, xcb_drawable_t drawable,
 
   values[0] = gui->screen->black_pixel;
   xcb_change_gc(gui->xcb, gui->gc, XCB_GC_FOREGROUND, values);
+  gui->fg = values[0];
   rects[0].x = 0;
   rects[0].y = 0;
   rects[0].width = width;
@@ -39,17 +41,31 @@ int init_xcb(xcb_data *gui) {
   xcb_get_keyboard_mapping_cookie_t gkm_cookie;
   xcb_get_keyboard_mapping_reply_t *keyboard_mapping;
 
-  gui->pixmap = 0;
+  gui->line = NULL;
+  gui->glyphs = XCB_NONE;
+  gui->glyph_gc = XCB_NONE;
+  gui->glyphs_valid = false;
   gui->xcb = xcb_connect(NULL, NULL);
   if (xcb_connection_has_error(gui->xcb)) goto error;
 
   xcb_setup = xcb_get_setup(gui->xcb);
   xcb_screen_iterator = xcb_setup_roots_iterator(xcb_setup);
   gui->screen = xcb_screen_iterator.data;
+  /* Pixels are sent as 32-bit 0xRRGGBB values. */
+  if (gui->screen->root_depth != 24 && gui->screen->root_depth != 32) {
+    fprintf(stderr, "Unsupported screen depth %u\n",
+            gui->screen->root_depth);
+    goto error;
+  }
 
   gui->gc = xcb_generate_id(gui->xcb);
   values[0] = gui->screen->white_pixel;
-  xcb_create_gc(gui->xcb, gui->gc, gui->screen->root, XCB_GC_FOREGROUND, values);
+  /* Copying glyphs should not cause NoExpose events. */
+  values[1] = 0;
+  xcb_create_gc(gui->xcb, gui->gc, gui->screen->root,
+                XCB_GC_FOREGROUND | XCB_GC_GRAPHICS_EXPOSURES, values);
+  gui->fg = values[0];
+  gui->bg = gui->screen->black_pixel;
 
   gui->win = xcb_generate_id(gui->xcb);
   values[0] = gui->screen->black_pixel;
@@ -69,7 +85,6 @@ int init_xcb(xcb_data *gui) {
                     XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
                     values);
   xcb_map_window(gui->xcb, gui->win);
-  gui->pixmap = xcb_generate_id(gui->xcb);
   get_window_size(gui, &width, &height);
   resize(gui, width, height);
   gkm_cookie = xcb_get_keyboard_mapping(
@@ -133,10 +148,8 @@ int init_xcb(xcb_data *gui) {
   return 0;
   
  error:
-  if (gui->pixmap) {
-    xcb_free_pixmap(gui->xcb, gui->pixmap);
-    gui->pixmap = 0;
-  }
+  free(gui->line);
+  gui->line = NULL;
   xcb_disconnect(gui->xcb);
   return -1;
 }
@@ -145,63 +158,151 @@ void resize(xcb_data *gui,
             unsigned int width,
             unsigned int height) {
   unsigned int scale = height / 220;
+  uint32_t *line;
   gui->scale = width / 340;
   if (scale < gui->scale) gui->scale = scale;
-  gui->xoffset = (width - scale * 320) / 2;
-  gui->yoffset = (height - scale * 200) / 2;
-  xcb_generate_pixmap(gui);
+  if (gui->scale == 0) gui->scale = 1;
+  gui->xoffset = (width - gui->scale * VIDEO_WIDTH) / 2;
+  gui->yoffset = (height - gui->scale * VIDEO_HEIGHT) / 2;
+  line = realloc(gui->line, VIDEO_WIDTH * gui->scale * gui->scale *
+                 sizeof(*gui->line));
+  if (!line) {
+    perror("realloc");
+    exit(1);
+  }
+  gui->line = line;
   clear_rect(gui, gui->win, width, height);
+
+  /* The glyphs are redrawn at the new scale when they are next used. */
+  if (gui->glyphs != XCB_NONE) xcb_free_pixmap(gui->xcb, gui->glyphs);
+  gui->glyphs = xcb_generate_id(gui->xcb);
+  xcb_create_pixmap(gui->xcb, 1, gui->glyphs, gui->win,
+                    16 * 8 * gui->scale, VIDEO_GLYPHS / 16 * 8 * gui->scale);
+  if (!gui->glyph_gc) {
+    /* Drawing into the pixmap needs a gc of the same depth. */
+    gui->glyph_gc = xcb_generate_id(gui->xcb);
+    xcb_create_gc(gui->xcb, gui->glyph_gc, gui->glyphs, 0, NULL);
+  }
+  gui->glyphs_valid = false;
 }
 
-void update_display(xcb_data *gui, const uint8_t *ram, bool force_redraw) {
-  unsigned int idx, x, y;
-  uint8_t gfx;
-  for (y = 0; y < 200; y++) {
-    for (x = 0; x < 40; x++) {
-      idx = (320 * (y >> 3)) + (x << 3) + (y & 7);
-      gfx = ram[0x2000 + idx];
-      if (!force_redraw && gui->oldgfx[idx] == gfx) continue;
-      xcb_copy_area(gui->xcb, gui->pixmap, gui->win, gui->gc,
-                    0,
-                    (size_t) gfx * gui->scale,
-                    (x << 3) * gui->scale + gui->xoffset,
-                    y * gui->scale + gui->yoffset,
-                    8 * gui->scale, gui->scale);
-      gui->oldgfx[idx] = gfx;
+/** Draws glyph code from video into the glyph pixmap, one rectangle
+ * per run of set pixels. */
+static void draw_glyph(xcb_data *gui, const hm1k_video *video,
+                       unsigned int code) {
+  const unsigned int scale = gui->scale;
+  const unsigned int x0 = (code % 16) * 8 * scale;
+  const unsigned int y0 = (code / 16) * 8 * scale;
+  xcb_rectangle_t rects[8 * 4];
+  uint32_t values[1];
+  unsigned int n = 0, line, x;
+
+  values[0] = 0;
+  xcb_change_gc(gui->xcb, gui->glyph_gc, XCB_GC_FOREGROUND, values);
+  rects[0].x = x0;
+  rects[0].y = y0;
+  rects[0].width = 8 * scale;
+  rects[0].height = 8 * scale;
+  xcb_poly_fill_rectangle(gui->xcb, gui->glyphs, gui->glyph_gc, 1, rects);
+
+  for (line = 0; line < 8; line++) {
+    const uint8_t bits = video->glyphs[code * 8 + line];
+    for (x = 0; x < 8; x++) {
+      unsigned int end = x;
+      while (end < 8 && (bits & (0x80 >> end))) ++end;
+      if (end == x) continue;
+      rects[n].x = x0 + x * scale;
+      rects[n].y = y0 + line * scale;
+      rects[n].width = (end - x) * scale;
+      rects[n].height = scale;
+      ++n;
+      x = end;
     }
   }
-  xcb_flush(gui->xcb);
+  if (n == 0) return;
+  values[0] = 1;
+  xcb_change_gc(gui->xcb, gui->glyph_gc, XCB_GC_FOREGROUND, values);
+  xcb_poly_fill_rectangle(gui->xcb, gui->glyphs, gui->glyph_gc, n, rects);
 }
 
-void xcb_generate_pixmap(xcb_data *gui) {
-  uint32_t values[1];
-  unsigned int i, j, n;
-  xcb_rectangle_t rects[8];
-  
-  xcb_create_pixmap(gui->xcb,
-                    gui->screen->root_depth,
-                    gui->pixmap,
-                    gui->screen->root,
-                    gui->scale * 8,
-                    gui->scale * 256);
+/** Draws the cells that changed, or all cells if all is set, from the
+ * glyph pixmap. Only glyphs that changed are drawn into the pixmap. */
+static void draw_cells(xcb_data *gui, const hm1k_video *video, bool all) {
+  const unsigned int size = 8 * gui->scale;
+  unsigned int i;
 
-  clear_rect(gui, gui->pixmap, gui->scale * 8, gui->scale * 256);
+  for (i = 0; i < VIDEO_GLYPHS; i++) {
+    if (!gui->glyphs_valid || video_changed(video->changed_glyphs, i)) {
+      draw_glyph(gui, video, i);
+    }
+  }
+  gui->glyphs_valid = true;
 
-  values[0] = gui->screen->white_pixel;
-  xcb_change_gc(gui->xcb, gui->gc, XCB_GC_FOREGROUND, values);
-  for (i = 0; i < 256; i++) {
-    n = 0;
-    for (j = 0; j < 8; j++) {
-      if (i & (0x80 >> j)) {
-        rects[n].x = j * gui->scale;
-        rects[n].y = i * gui->scale;
-        rects[n].width = gui->scale;
-        rects[n].height = gui->scale;
-        ++n;
-      }
+  for (i = 0; i < VIDEO_CELLS; i++) {
+    const uint32_t fg = video_palette[video->colors[i] >> 4];
+    const uint32_t bg = video_palette[video->colors[i] & 15];
+    const unsigned int code = video->codes[i];
+    if (!all && !video_changed(video->changed_cells, i)) continue;
+    if (fg != gui->fg || bg != gui->bg) {
+      uint32_t values[2];
+      values[0] = gui->fg = fg;
+      values[1] = gui->bg = bg;
+      xcb_change_gc(gui->xcb, gui->gc,
+                    XCB_GC_FOREGROUND | XCB_GC_BACKGROUND, values);
     }
-    if (n > 0) {
-      xcb_poly_fill_rectangle(gui->xcb, gui->pixmap, gui->gc, n, rects);
+    xcb_copy_plane(gui->xcb, gui->glyphs, gui->win, gui->gc,
+                   (code % 16) * size, (code / 16) * size,
+                   gui->xoffset + (i % VIDEO_COLUMNS) * size,
+                   gui->yoffset + (i / VIDEO_COLUMNS) * size,
+                   size, size, 1);
+  }
+}
+
+/** Draws the rows of cells for which the bit in rows is set from the
+ * pixels in video. */
+static void draw_rows(xcb_data *gui, const hm1k_video *video,
+                      uint32_t rows) {
+  const unsigned int scale = gui->scale;
+  const unsigned int width = VIDEO_WIDTH * scale;
+  unsigned int row, y, x, i;
+  for (row = 0; row < VIDEO_ROWS; row++) {
+    if (!(rows & ((uint32_t) 1 << row))) continue;
+    /* Send every line of pixels as one scaled image. */
+    for (y = row * 8; y < row * 8 + 8; y++) {
+      const uint32_t *src = video->pixels + y * VIDEO_WIDTH;
+      uint32_t *dst = gui->line;
+      for (x = 0; x < VIDEO_WIDTH; x++) {
+        for (i = 0; i < scale; i++) *dst++ = src[x];
+      }
+      for (i = 1; i < scale; i++) {
+        memcpy(gui->line + i * width, gui->line,
+               width * sizeof(*gui->line));
+      }
+      xcb_put_image(gui->xcb, XCB_IMAGE_FORMAT_Z_PIXMAP, gui->win, gui->gc,
+                    width, scale, gui->xoffset, gui->yoffset + y * scale,
+                    0, gui->screen->root_depth,
+                    width * scale * sizeof(*gui->line),
+                    (const uint8_t *) gui->line);
     }
   }
 }
+
+void update_display(xcb_data *gui, const hm1k_video *video,
+                    uint32_t rows) {
+  if (rows == 0) return;
+  if (video->text) {
+    draw_cells(gui, video, false);
+  } else {
+    draw_rows(gui, video, rows);
+  }
+  xcb_flush(gui->xcb);
+}
+
+void redraw_display(xcb_data *gui, const hm1k_video *video) {
+  if (video->text) {
+    draw_cells(gui, video, true);
+  } else {
+    draw_rows(gui, video, VIDEO_ALL_ROWS);
+  }
+  xcb_flush(gui->xcb);
+}
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <xcb/xcb.h>
 
+#include "video.h"
+
 typedef struct {
   xcb_connection_t *xcb;
   xcb_screen_t *screen;
@@ -13,9 +15,16 @@ typedef struct {
   unsigned int xoffset;
   unsigned int yoffset;
   xcb_gcontext_t gc;
-  xcb_pixmap_t pixmap;
   uint8_t keymap[256];
-  uint8_t oldgfx[8000];
+  /* One line of the picture, scaled up in both directions. */
+  uint32_t *line;
+  /* In character modes, cells are copied from this 1-bit pixmap of
+   * scaled glyphs, 16 glyphs per row, in the colors of the cell. */
+  xcb_pixmap_t glyphs;
+  xcb_gcontext_t glyph_gc;
+  bool glyphs_valid;
+  /* Current foreground and background of gc. */
+  uint32_t fg, bg;
 } xcb_data;
 
 void get_window_size(xcb_data *gui,
@@ -25,7 +34,10 @@ int init_xcb(xcb_data *gui);
 void resize(xcb_data *gui,
             unsigned int width,
             unsigned int height);
-void update_display(xcb_data *gui, const uint8_t *ram, bool force_redraw);
-void xcb_generate_pixmap(xcb_data *gui);
+/** Draws what changed in the last render_video, which returned rows. */
+void update_display(xcb_data *gui, const hm1k_video *video,
+                    uint32_t rows);
+/** Draws the whole picture, for example after the window was exposed. */
+void redraw_display(xcb_data *gui, const hm1k_video *video);
 
 #endif /* ndef HOMEMICRO_EMULATOR_XCB */
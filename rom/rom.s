@@ -2,6 +2,7 @@
         BUFPTR = $82
         SHOWADDR = $84
         SHOWCTR = $86
+        VIDBASE = $88
         POLLKEYX = $f8
         POLLKEYY = $f9
         PUTINTAD = $fa
@@ -10,13 +11,17 @@
         SAVEA = $fd
         SAVEX = $fe
         SAVEY = $ff
+        VMODEV = $d1
         IRQHNDLR = $0200
         NMIHNDLR = $0204
         CARTBSZ = $0206
+        CARTMODE = $0208
+        CONMODE = $0209
         RAMTOP = $021e
         KBDSTATE = $0220
         BUF = $0240
         IOBASE = $d000
+        VMODE = $d001
         KBDCOL = $d002
         KBDROW = $d003
         ROMBASE = $e000
@@ -25,6 +30,24 @@
         SERCR = $d005
 
 * = ROMBASE
+        ;; Bits in CARTMODE, which controls how savecart writes.
+        ;; Skip blocks that already hold the data to be saved.
+        CARTSKIP = $01
+        ;; Read back blocks after writing them.
+        CARTVRFY = $02
+
+        ;; Bits in CONMODE, which controls how text is displayed.
+        ;; Double-buffered: scroll into the alternate video area and
+        ;; then show that, so the screen never shows half a scroll.
+        CONDBL = $01
+
+        ;; Bit in VMODE that selects the alternate video area.
+        VMALT = $80
+
+        ;; Bits in byte 14 of the cartridge header.
+        ;; The program is compressed, see loadcartz.
+        CARTLZ = $01
+
         ;; Feature bits.
         FEAT_HM1000 = $01
         FEATURES = FEAT_HM1000
@@ -59,6 +82,8 @@
         jmp shchr
         jmp copy
         jmp copy8
+        jmp loadcartz
+        jmp setcmode
 
         .dsb FONTBASE-*, $ff
 _charset:
@@ -85,6 +110,14 @@ _start:
         ;; Initialize constants.
         lda #>BUF
         sta BUFPTR + 1
+        lda #CARTSKIP
+        sta CARTMODE
+        lda #0
+        sta CONMODE
+        sta VMODEV
+        sta VMODE
+        lda #$20
+        sta VIDBASE
 
         ;; Memory check. First, we work work from $bfff down and write
         ;; #$aa to every address, until the value at $0220 has that value
@@ -246,7 +279,14 @@ cloaded:
         sta $a6
         lda $2a0d
         sta $a7
+        lda $2a0e
+        and #CARTLZ
+        beq cload
+        jsr loadcartz
+        jmp cloadd
+cload:
         jsr loadcart
+cloadd:
         cmp #0
         bne cartfail
         lda #$aa
@@ -266,7 +306,9 @@ cartfail:
 adjcur:
 ;;; Scrolls so that the cursor position is within screen bounds.
         lda CURPOS + 1
-        cmp #$3f
+        sec
+        sbc VIDBASE
+        cmp #$1f
         bcc adjcurok
         bne adjcurscroll
         lda CURPOS
@@ -287,55 +329,275 @@ loadcart:
 ;;; $a6..$a7  Address to write first byte to.
 ;;; Out:
 ;;; a       0 if successful. Any other value indicates an error.
-;;; Clobbers x.
+;;; Clobbers x, y, $a4..$a7.
         jsr twistart
         jsr cart_set_location
         cmp #0
         bne loadcart_done
-        jsr twiresta
-        cmp #0
-        bne loadcart_done
-        lda #$a1
-        jsr twisendb
+        jsr cart_start_read
         cmp #0
-        bne loadcart_done
+        beq loadcart_read
+loadcart_done:
+        tax
+        jsr twistop
+        txa
+        rts
+
+loadcart_read:
+        ;; All bytes but the last are received by loadcart_byte and
+        ;; acknowledged. The last one is not acknowledged, which
+        ;; ends the read.
+        lda $a4
+        bne loadcart_count
+        dec $a5
+loadcart_count:
         dec $a4
-        bne loadcart_loop
+        ;; loadcart_byte keeps SCL high with SDA released ($df) in x
+        ;; and SCL low with SDA released ($9f) in a, so that a bit
+        ;; can be clocked in with just two stores.
+        ldx #$df
+        ldy #0
         lda $a5
-        beq loadcart_last
-loadcart_loop:
-        jsr twigetb
-        ldx #0
-        sta ($a6,x)
-        jsr twiack
-        inc $a6
-        bne loadcart_skip_msb
+        beq loadcart_part
+        lda #$9f
+loadcart_byte:
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        lda SERIR
+        sta ($a6), y
+        ;; Acknowledge: pull SDA low, pulse SCL, release SDA.
+        lda #$1f
+        sta SERCR
+        lda #$5f
+        sta SERCR
+        lda #$1f
+        sta SERCR
+        lda #$9f
+        sta SERCR
+        iny
+        bne loadcart_byte
+        ;; End of a page.
         inc $a7
-loadcart_skip_msb:
-        dec $a4
-        bne loadcart_not_last
-        lda $a5
-        beq loadcart_last
-loadcart_not_last:
-        lda #$ff
-        cmp $a4
-        bne loadcart_loop
         dec $a5
-        jmp loadcart_loop
+        bne loadcart_byte
+loadcart_part:
+        ;; Fewer than 256 bytes (n, in $a4) remain before the last.
+        ;; To load those with loadcart_byte, move the pointer back
+        ;; by 256 - n and start y at 256 - n, so that the page ends
+        ;; after n bytes.
+        lda $a4
+        beq loadcart_last
+        clc
+        adc $a6
+        sta $a6
+        lda $a7
+        adc #$ff
+        sta $a7
+        lda #0
+        sec
+        sbc $a4
+        tay
+        lda #0
+        sta $a4
+        lda #1
+        sta $a5
+        lda #$9f
+        jmp loadcart_byte
 
 loadcart_last:
         jsr twigetb
-        ldx #0
-        sta ($a6,x)
+        ldy #0
+        sta ($a6), y
         jsr twinak
+        jsr twistop
         lda #0
+        rts
 
-loadcart_done:
+loadcartz:
+;;; Loads compressed data from a cartridge. The data consists of
+;;; tokens, each starting with a byte t:
+;;;  - t = 0: end of data.
+;;;  - t < $80: t bytes follow, which are copied as they are.
+;;;  - t >= $80: two bytes follow, forming a 16-bit distance d.
+;;;    (t and $7f) + 3 bytes are copied from d bytes before the
+;;;    current address. The bytes may overlap those being written.
+;;; In:
+;;; $a0..$a3  Location of the data on the cartridge.
+;;; $a6..$a7  Address to write first byte to.
+;;; Out:
+;;; a       0 if successful. Any other value indicates an error.
+;;; Clobbers x, y, $a4, $a6..$a9.
+        jsr twistart
+        jsr cart_set_location
+        cmp #0
+        bne loadcartz_done
+        jsr cart_start_read
+        cmp #0
+        beq loadcartz_token
+loadcartz_done:
         tax
         jsr twistop
         txa
         rts
 
+loadcartz_end:
+        ;; The last byte was acknowledged, so the cartridge is
+        ;; sending another. Read it without acknowledging to end the
+        ;; read.
+        jsr twigetb
+        jsr twinak
+        jsr twistop
+        lda #0
+        rts
+
+loadcartz_token:
+        jsr cartgetb
+        cmp #0
+        beq loadcartz_end
+        bmi loadcartz_match
+        ;; Literal bytes are received inline, as in loadcart, since
+        ;; most of the data usually consists of them.
+        sta $a4
+        ldy #0
+        ldx #$df
+        lda #$9f
+loadcartz_lit:
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        lda SERIR
+        sta ($a6), y
+        lda #$1f
+        sta SERCR
+        lda #$5f
+        sta SERCR
+        lda #$1f
+        sta SERCR
+        lda #$9f
+        sta SERCR
+        iny
+        cpy $a4
+        bne loadcartz_lit
+        beq loadcartz_next
+loadcartz_match:
+        and #$7f
+        clc
+        adc #3
+        sta $a4
+        ;; Source address is $a6..$a7 minus distance.
+        jsr cartgetb
+        sta $a8
+        jsr cartgetb
+        sta $a9
+        lda $a6
+        sec
+        sbc $a8
+        sta $a8
+        lda $a7
+        sbc $a9
+        sta $a9
+        ldy #0
+loadcartz_copy:
+        lda ($a8), y
+        sta ($a6), y
+        iny
+        cpy $a4
+        bne loadcartz_copy
+loadcartz_next:
+        ;; Advance $a6..$a7 by the number of bytes written.
+        tya
+        clc
+        adc $a6
+        sta $a6
+        bcc loadcartz_next0
+        inc $a7
+loadcartz_next0:
+        jmp loadcartz_token
+
+cartgetb:
+;;; Receives a byte from the cartridge and acknowledges it.
+;;; Like loadcart, this clocks in bits with two stores each.
+;;; Out:
+;;; a   The byte received.
+;;; Clobbers x.
+        ldx #$df
+        lda #$9f
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        ldx SERIR
+        lda #$1f
+        sta SERCR
+        lda #$5f
+        sta SERCR
+        lda #$1f
+        sta SERCR
+        lda #$9f
+        sta SERCR
+        txa
+        rts
+
+cart_start_read:
+;;; Switches the cartridge to reading from the location set by
+;;; cart_set_location.
+;;; In:
+;;; $a2     Block, as for cart_set_location.
+;;; Out:
+;;; a       0 if successful. Any other value indicates an error.
+;;; Clobbers x.
+        jsr twiresta
+        cmp #0
+        bne cart_start_read_done
+        ;; Read from the same device: $a2 selects the block, as in
+        ;; cart_set_location, and the low bit is set for reading.
+        lda $a2
+        sec
+        rol
+        ora #$a0
+        jsr twisendb
+cart_start_read_done:
+        rts
+
 cart_set_location:
 ;;; Sets the location for the next cartridge operation.
 ;;; Preconditions:
@@ -362,25 +624,94 @@ cart_set_location_done:
 
 cls:
 ;;; Clears the screen.
-;;; Clobbers a, y, x.
-        ldy #0
-        sty $a0
-        ldx #$20
-        stx $a1
+;;; Takes about 42800 cycles (was 80400 with a loop per page).
+;;; Clobbers a, x.
+        lda VIDBASE
+clsat:
+;;; Clears the video area starting at page a, which is $20 or $60.
+        ;; Clear the 8000 bytes with one store per page for each x. The
+        ;; last store covers $3e40..$3f3f, so that the bytes after the
+        ;; screen are left alone.
+        cmp #$60
+        beq clsalt
         lda #0
+        tax
 cls_loop:
-        sta ($a0), y
-        iny
-        bne cls_loop
+        sta $2000, x
+        sta $2100, x
+        sta $2200, x
+        sta $2300, x
+        sta $2400, x
+        sta $2500, x
+        sta $2600, x
+        sta $2700, x
+        sta $2800, x
+        sta $2900, x
+        sta $2a00, x
+        sta $2b00, x
+        sta $2c00, x
+        sta $2d00, x
+        sta $2e00, x
+        sta $2f00, x
+        sta $3000, x
+        sta $3100, x
+        sta $3200, x
+        sta $3300, x
+        sta $3400, x
+        sta $3500, x
+        sta $3600, x
+        sta $3700, x
+        sta $3800, x
+        sta $3900, x
+        sta $3a00, x
+        sta $3b00, x
+        sta $3c00, x
+        sta $3d00, x
+        sta $3e00, x
+        sta $3e40, x
         inx
-        stx $a1
-        cpx #$3f
-        bcc cls_loop
-cls_loop1:
-        sta ($a0), y
-        iny
-        cpy #$40
-        bcc cls_loop1
+        beq cls_done
+        jmp cls_loop
+clsalt:
+        lda #0
+        tax
+clsalt_loop:
+        sta $6000, x
+        sta $6100, x
+        sta $6200, x
+        sta $6300, x
+        sta $6400, x
+        sta $6500, x
+        sta $6600, x
+        sta $6700, x
+        sta $6800, x
+        sta $6900, x
+        sta $6a00, x
+        sta $6b00, x
+        sta $6c00, x
+        sta $6d00, x
+        sta $6e00, x
+        sta $6f00, x
+        sta $7000, x
+        sta $7100, x
+        sta $7200, x
+        sta $7300, x
+        sta $7400, x
+        sta $7500, x
+        sta $7600, x
+        sta $7700, x
+        sta $7800, x
+        sta $7900, x
+        sta $7a00, x
+        sta $7b00, x
+        sta $7c00, x
+        sta $7d00, x
+        sta $7e00, x
+        sta $7e40, x
+        inx
+        beq cls_done
+        jmp clsalt_loop
+cls_done:
         rts
 
 clshome:
@@ -423,6 +754,12 @@ col0:
         ;; line 3, column 7.
         ;; 320 * 3 + 8 * 7 = 1016. + 8192 = 9208. $23f8
         ;; target: 960 + 8192 = 9152. $23c0
+        ;; Work with the position relative to a screen at $2000.
+        lda CURPOS + 1
+        sec
+        sbc VIDBASE
+        ora #$20
+        sta CURPOS + 1
         asl CURPOS
         rol CURPOS + 1
         ;; $47dc
@@ -450,6 +787,8 @@ col0c:
         ;; $80
         lsr
         ;; $23
+        and #$1f
+        ora VIDBASE
         sta CURPOS + 1
         lda CURPOS
         ror
@@ -700,9 +1039,12 @@ savecart:
 ;;; $a0..$a3  Location (on cartridge) to save to.
 ;;; $a4..$a5  Number of bytes to save.
 ;;; $a6..$a7  Address of first byte to save.
+;;; CARTMODE  CARTSKIP to leave blocks that already hold the data
+;;;           unwritten, CARTVRFY to read blocks back after writing.
 ;;; Out:
-;;; a       0 if successful. Any other value indicates an error.
-;;; Clobbers x.
+;;; a       0 if successful, $80 if a written block did not read back
+;;;         the same. Any other value indicates an error.
+;;; Clobbers x, y.
         ;; We save data in blocks of CARTBSZ bytes.
         ;; Compute the size of the first. The computation
         ;; requires that CARTBSZ be a power of 2 and computes
@@ -793,26 +1135,157 @@ savecart2:
 ;;; Out:
 ;;; a       0 if successful. Any other value indicates an error.
 saveblk:
-        jsr cartnext
+;;; Saves a single block of data to the cartridge, as directed by
+;;; CARTMODE.
+;;; In:
+;;; $a0..$a3  Location (on cartridge) to save to.
+;;; $a6..$a7  Address of first byte to save.
+;;; $a8..$a9  Number of bytes to save.
+;;; Out:
+;;; a       0 if successful. Any other value indicates an error.
+;;; $a6..$a7  Address of the byte after the block.
+        lda CARTMODE
+        and #CARTSKIP
+        beq saveblkw
+        jsr cartcmp
+        cmp #$80
+        bne saveblkd
+saveblkw:
+        jsr cartwrite
         cmp #0
-        bne saveblk2
-saveblk0:
+        bne saveblkd
+        lda CARTMODE
+        and #CARTVRFY
+        beq saveblkd
+        jsr cartcmp
+saveblkd:
+        tax
+        clc
+        lda $a6
+        adc $a8
+        sta $a6
+        lda $a7
+        adc $a9
+        sta $a7
+        txa
+        rts
+
+cartblk:
+;;; Copies the address and size of a block from $a6..$a9 to
+;;; $ae..$af and $ac..$ad, and sets y to 0.
+        lda $a6
+        sta $ae
+        lda $a7
+        sta $af
+        lda $a8
+        sta $ac
+        lda $a9
+        sta $ad
         ldy #0
-        lda ($a6), y
+        rts
+
+cartwrite:
+;;; Writes a block of data to the cartridge.
+;;; In:
+;;; $a0..$a3  Location (on cartridge) to write to.
+;;; $a6..$a7  Address of first byte to write.
+;;; $a8..$a9  Number of bytes to write.
+;;; Out:
+;;; a       0 if successful. Any other value indicates an error.
+;;; Clobbers x, y, $ac..$af.
+        jsr cartnext
+        cmp #0
+        bne cartwrited
+        jsr cartblk
+cartwritel:
+        lda ($ae), y
         jsr twisendb
         cmp #0
-        bne saveblk2
-        inc $a6
-        bne saveblk1
-        inc $a7
-saveblk1:
-        dec $a8
-        bne saveblk0
-        lda $a9
-        beq saveblk2
-        dec $a9
-        jmp saveblk0
-saveblk2:
+        bne cartwrited
+        iny
+        bne cartwrite0
+        inc $af
+cartwrite0:
+        lda $ac
+        bne cartwrite1
+        dec $ad
+cartwrite1:
+        dec $ac
+        lda $ac
+        ora $ad
+        bne cartwritel
+cartwrited:
+        tax
+        jsr twistop
+        txa
+        rts
+
+cartcmp:
+;;; Compares a block on the cartridge with data in memory.
+;;; In:
+;;; $a0..$a3  Location (on cartridge) of the block.
+;;; $a6..$a7  Address of first byte to compare with.
+;;; $a8..$a9  Number of bytes to compare.
+;;; Out:
+;;; a       0 if the block holds the same bytes, $80 if not. Any other
+;;;         value indicates an error.
+;;; Clobbers x, y, $ac..$af.
+        ;; The cartridge may still be writing the previous block.
+        jsr cartnext
+        cmp #0
+        bne cartcmpd
+        jsr cart_start_read
+        cmp #0
+        bne cartcmpd
+        jsr cartblk
+        ;; As in loadcart, bits are clocked in with x holding $df
+        ;; and a holding $9f.
+        ldx #$df
+cartcmpl:
+        lda #$9f
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        stx SERCR
+        sta SERCR
+        lda SERIR
+        cmp ($ae), y
+        bne cartcmpn
+        iny
+        bne cartcmp0
+        inc $af
+cartcmp0:
+        lda $ac
+        bne cartcmp1
+        dec $ad
+cartcmp1:
+        dec $ac
+        lda $ac
+        ora $ad
+        beq cartcmpe
+        jsr twiack
+        jmp cartcmpl
+cartcmpn:
+        ;; Stop reading at the first difference.
+        jsr twinak
+        lda #$80
+        bne cartcmpd
+cartcmpe:
+        jsr twinak
+        lda #0
+cartcmpd:
         tax
         jsr twistop
         txa
@@ -864,8 +1337,15 @@ sbc16:
 
 scrollup:
 ;;; Scrolls the screen up a lines.
-        ;; a * 320 + #$2000 in $a2..$a3.
-        ;; #$2000 in $a0..$a1.
+;;; Scrolling up 1 line, as newline does, takes about 72600 cycles
+;;; (was 119800), or about 74600 when double buffering. Other numbers
+;;; of lines take about 16 cycles per byte moved and 11 per byte
+;;; cleared; 25 or more clear the screen.
+;;; When CONMODE has CONDBL set, the scrolled screen is built in the
+;;; video area that is not being shown, which is then shown instead.
+;;; Clobbers a, x, y.
+        tax
+        ;; Source: a * 320 + screen in $a2..$a3.
         sta $a3
         ldy #0
         sty $a2
@@ -876,10 +1356,18 @@ scrollup:
         ror $a2
         clc
         adc $a3
-        adc #$20
+        adc VIDBASE
         sta $a3
-        lda #$20
+        ;; Destination: the other video area when double buffering,
+        ;; else the screen, in $a0..$a1. Its page is kept in $a6.
+        lda CONMODE
+        and #CONDBL
+        beq scrollupsb
+        lda #$40
+scrollupsb:
+        eor VIDBASE
         sta $a1
+        sta $a6
         ;; update CURPOS
         lda CURPOS
         sec
@@ -892,56 +1380,422 @@ scrollup:
         sta CURPOS
 scrollupcpok:
         clc
-        adc #$20
+        adc $a6
         sta CURPOS + 1
-        ;; copy bytes until $a2..$a3 > #$3f3f.
-scrolluplow:
-        lda $a3
-        cmp #$3f
-        bcs scrolluphi
-        ;; y is 0 at this point
-scrollupll:
+        cpx #1
+        bne scrollupn
+        lda $a6
+        cmp VIDBASE
+        bne scrollup1d
+        cmp #$20
+        bne scrollupcp
+        jmp scrollup1
+scrollup1d:
+        cmp #$60
+        bne scrollup1d2
+        jmp scrollup26
+scrollup1d2:
+        jmp scrollup62
+scrollupn:
+        cpx #25
+        bcc scrollupcp
+        lda $a6
+        jsr clsat
+        jmp scrollupshow
+scrollupcp:
+        ;; Copy the bytes from ($a2..$a3) to the end of the screen to
+        ;; ($a0..$a1): first whole pages, then the rest.
+        sec
+        lda #$40
+        sbc $a2
+        sta $a4
+        lda VIDBASE
+        ora #$1f
+        sbc $a3
+        tax
+        beq scrollupcpr
+scrollupcpp:
         lda ($a2), y
         sta ($a0), y
         iny
-        bne scrollupll
+        bne scrollupcpp
         inc $a1
         inc $a3
-        jmp scrolluplow
-scrolluphi:
-        bne scrollupblank
-        clc
-scrolluphl:
-        tya
-        adc $a2
-        cmp #$40
-        bcs scrollupblank
+        dex
+        bne scrollupcpp
+scrollupcpr:
+        cpy $a4
+        beq scrollupbl
         lda ($a2), y
         sta ($a0), y
         iny
-        jmp scrolluphl
-scrollupblank:
-        lda $a1
-        cmp #$3f
-        bcc scrollupmore
-        bne scrollupdone
-        lda $a0
-        bne scrollupdone
-        lda #$3e
-        sta $a1
-        lda #$40
+        bne scrollupcpr
+scrollupbl:
+        ;; Clear from ($a0..$a1) + y to the end of the video area.
+        tya
+        clc
+        adc $a0
         sta $a0
-        ldy #$c0
-scrollupmore:
+        bcc scrollupbl0
+        inc $a1
+scrollupbl0:
+        sec
+        lda #$40
+        sbc $a0
+        sta $a4
+        lda $a6
+        ora #$1f
+        sbc $a1
+        tax
         lda #0
+        tay
+        cpx #0
+        beq scrollupblr
+scrollupblp:
         sta ($a0), y
         iny
-        bne scrollupmore
+        bne scrollupblp
         inc $a1
-        jmp scrollupblank
+        dex
+        bne scrollupblp
+scrollupblr:
+        cpy $a4
+        beq scrollupshow
+        sta ($a0), y
+        iny
+        bne scrollupblr
+scrollupshow:
+        ;; If the destination is not the screen, make it the screen.
+        lda $a6
+        cmp VIDBASE
+        beq scrollupdone
+        sta VIDBASE
+        lda VMODEV
+        eor #VMALT
+        sta VMODEV
+        sta VMODE
 scrollupdone:
         rts
 
+scrollup1:
+        ;; Move each half line up by one line, 160 bytes at a time,
+        ;; from the top of the screen down. Every byte is read in the
+        ;; same iteration in which it is overwritten, and before it.
+        ldx #160
+scrollup1l:
+        lda $213f, x
+        sta $1fff, x
+        lda $21df, x
+        sta $209f, x
+        lda $227f, x
+        sta $213f, x
+        lda $231f, x
+        sta $21df, x
+        lda $23bf, x
+        sta $227f, x
+        lda $245f, x
+        sta $231f, x
+        lda $24ff, x
+        sta $23bf, x
+        lda $259f, x
+        sta $245f, x
+        lda $263f, x
+        sta $24ff, x
+        lda $26df, x
+        sta $259f, x
+        lda $277f, x
+        sta $263f, x
+        lda $281f, x
+        sta $26df, x
+        lda $28bf, x
+        sta $277f, x
+        lda $295f, x
+        sta $281f, x
+        lda $29ff, x
+        sta $28bf, x
+        lda $2a9f, x
+        sta $295f, x
+        lda $2b3f, x
+        sta $29ff, x
+        lda $2bdf, x
+        sta $2a9f, x
+        lda $2c7f, x
+        sta $2b3f, x
+        lda $2d1f, x
+        sta $2bdf, x
+        lda $2dbf, x
+        sta $2c7f, x
+        lda $2e5f, x
+        sta $2d1f, x
+        lda $2eff, x
+        sta $2dbf, x
+        lda $2f9f, x
+        sta $2e5f, x
+        lda $303f, x
+        sta $2eff, x
+        lda $30df, x
+        sta $2f9f, x
+        lda $317f, x
+        sta $303f, x
+        lda $321f, x
+        sta $30df, x
+        lda $32bf, x
+        sta $317f, x
+        lda $335f, x
+        sta $321f, x
+        lda $33ff, x
+        sta $32bf, x
+        lda $349f, x
+        sta $335f, x
+        lda $353f, x
+        sta $33ff, x
+        lda $35df, x
+        sta $349f, x
+        lda $367f, x
+        sta $353f, x
+        lda $371f, x
+        sta $35df, x
+        lda $37bf, x
+        sta $367f, x
+        lda $385f, x
+        sta $371f, x
+        lda $38ff, x
+        sta $37bf, x
+        lda $399f, x
+        sta $385f, x
+        lda $3a3f, x
+        sta $38ff, x
+        lda $3adf, x
+        sta $399f, x
+        lda $3b7f, x
+        sta $3a3f, x
+        lda $3c1f, x
+        sta $3adf, x
+        lda $3cbf, x
+        sta $3b7f, x
+        lda $3d5f, x
+        sta $3c1f, x
+        lda $3dff, x
+        sta $3cbf, x
+        lda $3e9f, x
+        sta $3d5f, x
+        dex
+        beq scrollup1b
+        jmp scrollup1l
+scrollup1b:
+        ;; Clear the last line, $3e00..$3f3f.
+        lda #0
+        ldx #160
+scrollup1bl:
+        sta $3dff, x
+        sta $3e9f, x
+        dex
+        bne scrollup1bl
+        rts
+
+        ;; Scrolling up 1 line from one video area into the other.
+        ;; Source and destination do not overlap, so whole pages can
+        ;; be copied for each x.
+scrollup26:
+        ldx #0
+scrollup26l:
+        lda $2140, x
+        sta $6000, x
+        lda $2240, x
+        sta $6100, x
+        lda $2340, x
+        sta $6200, x
+        lda $2440, x
+        sta $6300, x
+        lda $2540, x
+        sta $6400, x
+        lda $2640, x
+        sta $6500, x
+        lda $2740, x
+        sta $6600, x
+        lda $2840, x
+        sta $6700, x
+        lda $2940, x
+        sta $6800, x
+        lda $2a40, x
+        sta $6900, x
+        lda $2b40, x
+        sta $6a00, x
+        lda $2c40, x
+        sta $6b00, x
+        lda $2d40, x
+        sta $6c00, x
+        lda $2e40, x
+        sta $6d00, x
+        lda $2f40, x
+        sta $6e00, x
+        lda $3040, x
+        sta $6f00, x
+        lda $3140, x
+        sta $7000, x
+        lda $3240, x
+        sta $7100, x
+        lda $3340, x
+        sta $7200, x
+        lda $3440, x
+        sta $7300, x
+        lda $3540, x
+        sta $7400, x
+        lda $3640, x
+        sta $7500, x
+        lda $3740, x
+        sta $7600, x
+        lda $3840, x
+        sta $7700, x
+        lda $3940, x
+        sta $7800, x
+        lda $3a40, x
+        sta $7900, x
+        lda $3b40, x
+        sta $7a00, x
+        lda $3c40, x
+        sta $7b00, x
+        lda $3d40, x
+        sta $7c00, x
+        lda $3e40, x
+        sta $7d00, x
+        inx
+        beq scrollup26b
+        jmp scrollup26l
+scrollup26b:
+        ;; Clear the last line, $7e00..$7f3f.
+        lda #0
+scrollup26bl:
+        sta $7e00, x
+        sta $7e40, x
+        inx
+        bne scrollup26bl
+        jmp scrollupshow
+
+scrollup62:
+        ldx #0
+scrollup62l:
+        lda $6140, x
+        sta $2000, x
+        lda $6240, x
+        sta $2100, x
+        lda $6340, x
+        sta $2200, x
+        lda $6440, x
+        sta $2300, x
+        lda $6540, x
+        sta $2400, x
+        lda $6640, x
+        sta $2500, x
+        lda $6740, x
+        sta $2600, x
+        lda $6840, x
+        sta $2700, x
+        lda $6940, x
+        sta $2800, x
+        lda $6a40, x
+        sta $2900, x
+        lda $6b40, x
+        sta $2a00, x
+        lda $6c40, x
+        sta $2b00, x
+        lda $6d40, x
+        sta $2c00, x
+        lda $6e40, x
+        sta $2d00, x
+        lda $6f40, x
+        sta $2e00, x
+        lda $7040, x
+        sta $2f00, x
+        lda $7140, x
+        sta $3000, x
+        lda $7240, x
+        sta $3100, x
+        lda $7340, x
+        sta $3200, x
+        lda $7440, x
+        sta $3300, x
+        lda $7540, x
+        sta $3400, x
+        lda $7640, x
+        sta $3500, x
+        lda $7740, x
+        sta $3600, x
+        lda $7840, x
+        sta $3700, x
+        lda $7940, x
+        sta $3800, x
+        lda $7a40, x
+        sta $3900, x
+        lda $7b40, x
+        sta $3a00, x
+        lda $7c40, x
+        sta $3b00, x
+        lda $7d40, x
+        sta $3c00, x
+        lda $7e40, x
+        sta $3d00, x
+        inx
+        beq scrollup62b
+        jmp scrollup62l
+scrollup62b:
+        ;; Clear the last line, $3e00..$3f3f.
+        lda #0
+scrollup62bl:
+        sta $3e00, x
+        sta $3e40, x
+        inx
+        bne scrollup62bl
+        jmp scrollupshow
+
+setcmode:
+;;; Sets the console mode.
+;;; In:
+;;; a   new value for CONMODE.
+;;; Clobbers a, x, y.
+        sta CONMODE
+        and #CONDBL
+        bne setcmoded
+        lda VIDBASE
+        cmp #$20
+        beq setcmoded
+        ;; Without double buffering, the screen is at $2000. Move the
+        ;; text there from $6000 and show it.
+        ldy #0
+        sty $a0
+        sty $a2
+        lda #$20
+        sta $a1
+        lda #$60
+        sta $a3
+        ldx #$1f
+setcmodep:
+        lda ($a2), y
+        sta ($a0), y
+        iny
+        bne setcmodep
+        inc $a1
+        inc $a3
+        dex
+        bne setcmodep
+setcmoder:
+        lda ($a2), y
+        sta ($a0), y
+        iny
+        cpy #$40
+        bne setcmoder
+        lda #$20
+        sta VIDBASE
+        lda CURPOS + 1
+        eor #$40
+        sta CURPOS + 1
+        lda VMODEV
+        and #~VMALT
+        sta VMODEV
+        sta VMODE
+setcmoded:
+        rts
+
 setcur:
 ;;; Sets the cursor position.
 ;;; In:
@@ -980,7 +1834,7 @@ setcur:
         asl
         sta $80
         ;; Add display base.
-        lda #$20
+        lda VIDBASE
         adc $81
         sta $81
         rts
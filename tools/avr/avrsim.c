@@ -0,0 +1,1133 @@
+// Usage: avrsim [-m device] [-c cycles] [-i inputs] [-s source] [-t] image
+//
+// Runs the firmware of the video or keyboard controller on a simulated
+// AVR, counting clock cycles, and records when its pins change. The
+// image is an Intel HEX file, as made by the Makefiles in video/ and
+// keyboard/, or a raw binary. The device is attiny85 or atmega328
+// (the default).
+//
+// With -t, every pin change is printed as "cycle pin level", for
+// example "398 PC4 0". With -i, input pins are driven from a file in
+// the same format. With -s, the header of the firmware's source file
+// is read for the hsync, vsync and active pins and the timing tables,
+// and the signals are checked against them. The device is then also
+// taken from the header. The exit status is nonzero if a check fails.
+//
+// Only the CPU, the I/O ports and pin change interrupts are modeled.
+// Other I/O registers read back what was written to them.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_FLASH 0x8000
+#define MAX_DATA 0x900
+#define MAX_PORTS 3
+
+// Run length without -s.
+#define DEFAULT_CYCLES 10000000
+
+// With -s, the run lasts this many frames. The first may be partial.
+#define CHECK_FRAMES 4
+
+// Mismatches printed per check. Further ones are only counted.
+#define MAX_REPORTS 5
+
+// Data space addresses of the stack pointer and status register.
+#define SPL 0x5d
+#define SPH 0x5e
+#define SREG 0x5f
+
+// SREG bits.
+#define FLAG_C 0x01
+#define FLAG_Z 0x02
+#define FLAG_N 0x04
+#define FLAG_V 0x08
+#define FLAG_S 0x10
+#define FLAG_H 0x20
+#define FLAG_T 0x40
+#define FLAG_I 0x80
+
+// The flags set by additions and subtractions.
+#define ARITH_FLAGS (FLAG_C | FLAG_Z | FLAG_N | FLAG_V | FLAG_S | FLAG_H)
+
+// Pointer registers.
+#define REG_X 26
+#define REG_Y 28
+#define REG_Z 30
+
+// Addresses below are in the data space, that is, I/O addresses
+// plus 0x20.
+typedef struct {
+  char name;
+  uint8_t pin, ddr, port;
+  // Pin change mask register, the port's bit in the control and flag
+  // registers, and its interrupt vector.
+  uint8_t pcmsk, pcie, vector;
+} port_t;
+
+typedef struct {
+  const char *name;
+  uint32_t flash_size;
+  uint16_t data_size;
+  // Whether jmp, call and the multiplications exist.
+  bool has_jmp;
+  uint8_t pcicr, pcifr;
+  // Size of an interrupt vector in words.
+  unsigned int vector_words;
+  unsigned int nports;
+  port_t ports[MAX_PORTS];
+} device_t;
+
+static const device_t devices[] = {
+  { "attiny85", 0x2000, 0x260, false, 0x5b, 0x5a, 1, 1,
+    { { 'B', 0x36, 0x37, 0x38, 0x35, 0x20, 2 } } },
+  { "atmega328", 0x8000, 0x900, true, 0x68, 0x3b, 2, 3,
+    { { 'B', 0x23, 0x24, 0x25, 0x6b, 0x01, 3 },
+      { 'C', 0x26, 0x27, 0x28, 0x6c, 0x02, 4 },
+      { 'D', 0x29, 0x2a, 0x2b, 0x6d, 0x04, 5 } } },
+};
+
+// A pin driven to a level from the -i file.
+typedef struct {
+  uint64_t cycle;
+  int pin;
+  int level;
+} event_t;
+
+// The timing checks. The horizontal ones are in clocks, the vertical
+// ones in lines.
+enum {
+  LINE_TOTAL, HSYNC_LOW, H_BACK_PORCH, H_ACTIVE, H_FRONT_PORCH,
+  FRAME_TOTAL, VSYNC_LOW, V_BACK_PORCH, V_ACTIVE, V_FRONT_PORCH,
+  NCHECKS
+};
+
+// Names of the rows in the source's timing tables.
+static const struct {
+  const char *row;
+  bool vertical;
+} rows[NCHECKS] = {
+  [LINE_TOTAL] = { "line total", false },
+  [HSYNC_LOW] = { "hsync low", false },
+  [H_BACK_PORCH] = { "back porch", false },
+  [H_ACTIVE] = { "active", false },
+  [H_FRONT_PORCH] = { "front porch", false },
+  [FRAME_TOTAL] = { "frame total", true },
+  [VSYNC_LOW] = { "vsync low", true },
+  [V_BACK_PORCH] = { "back porch", true },
+  [V_ACTIVE] = { "active", true },
+  [V_FRONT_PORCH] = { "front porch", true },
+};
+
+typedef struct {
+  unsigned int expected;
+  unsigned long checked, wrong;
+} check_t;
+
+typedef struct {
+  int hsync, vsync, active;
+  check_t checks[NCHECKS];
+  // Cycles at which the signals last changed, or 0 if they have not.
+  uint64_t hsync_fall, hsync_rise, vsync_fall, vsync_rise;
+  uint64_t active_rise, active_fall;
+  // Active lines since the last vsync fall.
+  unsigned int active_lines;
+  // Whether the first active line after vsync is still to come.
+  bool in_back_porch;
+} timing_t;
+
+typedef struct {
+  const device_t *dev;
+  uint16_t flash[MAX_FLASH / 2];
+  uint8_t data[MAX_DATA];
+  // Word address of the next instruction.
+  uint32_t pc;
+  uint64_t cycles;
+  // Levels driven onto the pins from outside, and which pins are
+  // driven. Pins that are not driven read their pull-ups.
+  uint8_t input[MAX_PORTS], driven[MAX_PORTS];
+  // Pin levels as last seen, to find changes.
+  uint8_t level[MAX_PORTS];
+  // Set by sei and reti: one more instruction runs before an
+  // interrupt is taken.
+  bool hold_interrupts;
+  bool trace;
+  timing_t *timing;
+} avr_t;
+
+static const device_t *find_device(const char *name) {
+  size_t i;
+  for (i = 0; i < sizeof(devices) / sizeof(*devices); i++) {
+    if (!strcmp(devices[i].name, name)) return &devices[i];
+  }
+  return NULL;
+}
+
+// Parses a pin name such as "PC4" or "B0". Returns the pin number
+// (port index times 8 plus bit), or -1.
+static int parse_pin(const device_t *dev, const char *s) {
+  unsigned int i;
+  if (*s == 'P') ++s;
+  if (s[1] < '0' || s[1] > '7') return -1;
+  for (i = 0; i < dev->nports; i++) {
+    if (dev->ports[i].name == s[0]) return i * 8 + s[1] - '0';
+  }
+  return -1;
+}
+
+static void print_pin(const avr_t *avr, int pin, FILE *f) {
+  fprintf(f, "P%c%d", avr->dev->ports[pin / 8].name, pin % 8);
+}
+
+// Reports a mismatch if got (in clocks) is not expected times scale.
+static void check(timing_t *t, int which, uint64_t cycle, int64_t got,
+                  unsigned int scale) {
+  check_t *c = &t->checks[which];
+  ++c->checked;
+  if (got == (int64_t) c->expected * scale) return;
+  if (c->wrong++ < MAX_REPORTS) {
+    fprintf(stderr, "cycle %llu: %s %s is %g %s, expected %u\n",
+            (unsigned long long) cycle,
+            rows[which].vertical ? "vertical" : "horizontal",
+            rows[which].row, (double) got / scale,
+            rows[which].vertical ? "lines" : "clocks", c->expected);
+  }
+}
+
+static void timing_edge(timing_t *t, int pin, int level, uint64_t cycle) {
+  const unsigned int line = t->checks[LINE_TOTAL].expected;
+
+  if (cycle == 0) return;
+  if (pin == t->hsync && !level) {
+    if (t->hsync_fall) check(t, LINE_TOTAL, cycle, cycle - t->hsync_fall, 1);
+    if (t->hsync_fall && t->active_fall > t->hsync_fall) {
+      check(t, H_FRONT_PORCH, cycle, cycle - t->active_fall, 1);
+    }
+    t->hsync_fall = cycle;
+  } else if (pin == t->hsync) {
+    if (t->hsync_fall) check(t, HSYNC_LOW, cycle, cycle - t->hsync_fall, 1);
+    t->hsync_rise = cycle;
+  } else if (pin == t->active && level) {
+    if (t->hsync_rise > t->hsync_fall) {
+      check(t, H_BACK_PORCH, cycle, cycle - t->hsync_rise, 1);
+    }
+    if (t->in_back_porch) {
+      check(t, V_BACK_PORCH, cycle, cycle - t->vsync_rise, line);
+      t->in_back_porch = false;
+    }
+    ++t->active_lines;
+    t->active_rise = cycle;
+  } else if (pin == t->active) {
+    if (t->active_rise) check(t, H_ACTIVE, cycle, cycle - t->active_rise, 1);
+    t->active_fall = cycle;
+  } else if (pin == t->vsync && !level) {
+    if (t->vsync_fall) {
+      check(t, FRAME_TOTAL, cycle, cycle - t->vsync_fall, line);
+      check(t, V_ACTIVE, cycle, t->active_lines, 1);
+    }
+    if (t->active_rise) {
+      // The last active line counts from its start, like vsync.
+      check(t, V_FRONT_PORCH, cycle,
+            (int64_t) (cycle - t->active_rise) - line, line);
+    }
+    t->active_lines = 0;
+    t->in_back_porch = false;
+    t->vsync_fall = cycle;
+  } else if (pin == t->vsync) {
+    if (t->vsync_fall) check(t, VSYNC_LOW, cycle, cycle - t->vsync_fall, line);
+    t->in_back_porch = true;
+    t->vsync_rise = cycle;
+  }
+}
+
+// Prints the results of the checks. Returns 0 if all of them were
+// made and passed, -1 otherwise.
+static int timing_report(const timing_t *t) {
+  int result = 0, i;
+  for (i = 0; i < NCHECKS; i++) {
+    const check_t *c = &t->checks[i];
+    printf("%-10s %-11s %5u %-6s %6lu checked, %lu wrong\n",
+           rows[i].vertical ? "vertical" : "horizontal", rows[i].row,
+           c->expected, rows[i].vertical ? "lines" : "clocks",
+           c->checked, c->wrong);
+    if (c->wrong || !c->checked) result = -1;
+  }
+  return result;
+}
+
+// Returns the level of the pins of port p.
+static uint8_t pin_levels(const avr_t *avr, unsigned int p) {
+  const port_t *port = &avr->dev->ports[p];
+  const uint8_t ddr = avr->data[port->ddr], out = avr->data[port->port];
+  const uint8_t in = (avr->input[p] & avr->driven[p]) |
+                     (out & ~avr->driven[p]);
+  return (out & ddr) | (in & ~ddr);
+}
+
+// Looks for pins of port p that changed at cycle, reports them and
+// raises the pin change interrupt flag if they are enabled.
+static void update_pins(avr_t *avr, unsigned int p, uint64_t cycle) {
+  const device_t *dev = avr->dev;
+  const port_t *port = &dev->ports[p];
+  const uint8_t level = pin_levels(avr, p);
+  const uint8_t changed = level ^ avr->level[p];
+  int bit;
+
+  if (!changed) return;
+  avr->level[p] = level;
+  for (bit = 0; bit < 8; bit++) {
+    if (!(changed & (1 << bit))) continue;
+    if (avr->trace) {
+      printf("%llu ", (unsigned long long) cycle);
+      print_pin(avr, p * 8 + bit, stdout);
+      printf(" %d\n", (level >> bit) & 1);
+    }
+    if (avr->timing) {
+      timing_edge(avr->timing, p * 8 + bit, (level >> bit) & 1, cycle);
+    }
+  }
+  if ((changed & avr->data[port->pcmsk]) &&
+      (avr->data[dev->pcicr] & port->pcie)) {
+    avr->data[dev->pcifr] |= port->pcie;
+  }
+}
+
+static uint8_t read_data(const avr_t *avr, uint16_t addr) {
+  unsigned int p;
+  if (addr >= avr->dev->data_size) return 0;
+  for (p = 0; p < avr->dev->nports; p++) {
+    if (addr == avr->dev->ports[p].pin) return pin_levels(avr, p);
+  }
+  return avr->data[addr];
+}
+
+static void write_data(avr_t *avr, uint16_t addr, uint8_t value) {
+  const device_t *dev = avr->dev;
+  unsigned int p;
+
+  if (addr >= dev->data_size) return;
+  if (addr == dev->pcifr) {
+    // Flags are cleared by writing ones to them.
+    avr->data[addr] &= ~value;
+    return;
+  }
+  for (p = 0; p < dev->nports; p++) {
+    const port_t *port = &dev->ports[p];
+    if (addr == port->pin) {
+      // Writing ones to PINx toggles those bits of PORTx.
+      avr->data[port->port] ^= value;
+    } else if (addr == port->ddr || addr == port->port) {
+      avr->data[addr] = value;
+    } else {
+      continue;
+    }
+    update_pins(avr, p, avr->cycles);
+    return;
+  }
+  avr->data[addr] = value;
+}
+
+static uint16_t get_word(const avr_t *avr, int r) {
+  return avr->data[r] | (avr->data[r + 1] << 8);
+}
+
+static void set_word(avr_t *avr, int r, uint16_t value) {
+  avr->data[r] = value & 0xff;
+  avr->data[r + 1] = value >> 8;
+}
+
+static void push(avr_t *avr, uint8_t value) {
+  const uint16_t sp = get_word(avr, SPL);
+  write_data(avr, sp, value);
+  set_word(avr, SPL, sp - 1);
+}
+
+static uint8_t pop(avr_t *avr) {
+  const uint16_t sp = get_word(avr, SPL) + 1;
+  set_word(avr, SPL, sp);
+  return read_data(avr, sp);
+}
+
+// The low byte of the return address is pushed first.
+static void push_pc(avr_t *avr) {
+  push(avr, avr->pc & 0xff);
+  push(avr, avr->pc >> 8);
+}
+
+static void pop_pc(avr_t *avr) {
+  const uint8_t high = pop(avr);
+  avr->pc = ((high << 8) | pop(avr)) & (avr->dev->flash_size / 2 - 1);
+}
+
+// Returns the address for ld or st through pointer register r, after
+// applying post-increment (mode 1) or pre-decrement (mode 2).
+static uint16_t pointer(avr_t *avr, int r, int mode) {
+  uint16_t addr = get_word(avr, r);
+  if (mode == 1) set_word(avr, r, addr + 1);
+  if (mode == 2) set_word(avr, r, --addr);
+  return addr;
+}
+
+static void set_flags(avr_t *avr, uint8_t mask, uint8_t flags) {
+  avr->data[SREG] = (avr->data[SREG] & ~mask) | flags;
+}
+
+// Adds N, Z and S for result r to flags, which holds V.
+static uint8_t nzs(uint8_t r, uint8_t flags) {
+  if (r & 0x80) flags |= FLAG_N;
+  if (!r) flags |= FLAG_Z;
+  if (!(flags & FLAG_N) != !(flags & FLAG_V)) flags |= FLAG_S;
+  return flags;
+}
+
+static uint8_t add_flags(uint8_t d, uint8_t r, uint8_t res) {
+  const uint8_t carries = (d & r) | (r & ~res) | (~res & d);
+  uint8_t flags = ((d ^ res) & (r ^ res) & 0x80) ? FLAG_V : 0;
+  if (carries & 0x08) flags |= FLAG_H;
+  if (carries & 0x80) flags |= FLAG_C;
+  return nzs(res, flags);
+}
+
+// Flags for res = d - r. With carry set, the subtraction was one
+// with carry, which leaves Z alone unless the result is nonzero.
+static uint8_t sub_flags(const avr_t *avr, uint8_t d, uint8_t r, uint8_t res,
+                         bool carry) {
+  const uint8_t borrows = (~d & r) | (r & res) | (res & ~d);
+  uint8_t flags = ((d ^ r) & (d ^ res) & 0x80) ? FLAG_V : 0;
+  if (borrows & 0x08) flags |= FLAG_H;
+  if (borrows & 0x80) flags |= FLAG_C;
+  flags = nzs(res, flags);
+  if (carry && !res) flags = (flags & ~FLAG_Z) | (avr->data[SREG] & FLAG_Z);
+  return flags;
+}
+
+// Flags for shifts to the right. c is the bit shifted out.
+static uint8_t shift_flags(uint8_t res, int c) {
+  uint8_t flags = c ? FLAG_C : 0;
+  if (!(res & 0x80) != !c) flags |= FLAG_V;
+  return nzs(res, flags);
+}
+
+static bool is_two_words(uint16_t op) {
+  return (op & 0xfc0f) == 0x9000 || (op & 0xfe0c) == 0x940c;
+}
+
+static void skip(avr_t *avr) {
+  const bool two = is_two_words(avr->flash[avr->pc]);
+  avr->pc += two ? 2 : 1;
+  avr->cycles += two ? 2 : 1;
+}
+
+static void unknown(const avr_t *avr, uint16_t op) {
+  fprintf(stderr, "cycle %llu: unknown instruction %04x at %04x\n",
+          (unsigned long long) avr->cycles, op, (avr->pc - 1) * 2);
+}
+
+// Runs the instructions at 0x9000-0x9fff, which load, store,
+// operate on a single register, jump, or access I/O bits.
+static bool step_9(avr_t *avr, uint16_t op) {
+  const int d = (op >> 4) & 0x1f;
+  const int r = (op & 0x0f) | ((op >> 5) & 0x10);
+  const uint16_t io = ((op >> 3) & 0x1f) + 0x20;
+  const uint8_t bit = 1 << (op & 7);
+  const int ptr = (op & 0x0c) == 0x0c ? REG_X : (op & 0x08) ? REG_Y : REG_Z;
+  uint8_t flags, res, v;
+  uint16_t w;
+
+  switch ((op >> 9) & 7) {
+  case 0:
+    avr->cycles += 2;
+    switch (op & 0x0f) {
+    case 0x0:
+      avr->data[d] = read_data(avr, avr->flash[avr->pc++]);
+      return true;
+    case 0x1: case 0x2: case 0x9: case 0xa: case 0xc: case 0xd: case 0xe:
+      avr->data[d] = read_data(avr, pointer(avr, ptr, op & 3));
+      return true;
+    case 0x4: case 0x5:
+      w = pointer(avr, REG_Z, op & 1);
+      avr->data[d] = avr->flash[(w >> 1) & (MAX_FLASH / 2 - 1)] >> (8 * (w & 1));
+      ++avr->cycles;
+      return true;
+    case 0xf:
+      avr->data[d] = pop(avr);
+      return true;
+    }
+    break;
+  case 1:
+    avr->cycles += 2;
+    switch (op & 0x0f) {
+    case 0x0:
+      w = avr->flash[avr->pc++];
+      write_data(avr, w, avr->data[d]);
+      return true;
+    case 0x1: case 0x2: case 0x9: case 0xa: case 0xc: case 0xd: case 0xe:
+      write_data(avr, pointer(avr, ptr, op & 3), avr->data[d]);
+      return true;
+    case 0xf:
+      push(avr, avr->data[d]);
+      return true;
+    }
+    break;
+  case 2:
+    v = avr->data[d];
+    switch (op & 0x0f) {
+    case 0x0:
+      res = ~v;
+      set_flags(avr, FLAG_C | FLAG_Z | FLAG_N | FLAG_V | FLAG_S,
+                nzs(res, FLAG_C));
+      break;
+    case 0x1:
+      res = -v;
+      flags = nzs(res, res == 0x80 ? FLAG_V : 0);
+      if (res) flags |= FLAG_C;
+      if ((res | v) & 0x08) flags |= FLAG_H;
+      set_flags(avr, ARITH_FLAGS, flags);
+      break;
+    case 0x2:
+      res = (v << 4) | (v >> 4);
+      break;
+    case 0x3:
+      res = v + 1;
+      set_flags(avr, FLAG_Z | FLAG_N | FLAG_V | FLAG_S,
+                nzs(res, res == 0x80 ? FLAG_V : 0));
+      break;
+    case 0x5:
+      res = (v >> 1) | (v & 0x80);
+      set_flags(avr, FLAG_C | FLAG_Z | FLAG_N | FLAG_V | FLAG_S,
+                shift_flags(res, v & 1));
+      break;
+    case 0x6:
+      res = v >> 1;
+      set_flags(avr, FLAG_C | FLAG_Z | FLAG_N | FLAG_V | FLAG_S,
+                shift_flags(res, v & 1));
+      break;
+    case 0x7:
+      res = (v >> 1) | ((avr->data[SREG] & FLAG_C) << 7);
+      set_flags(avr, FLAG_C | FLAG_Z | FLAG_N | FLAG_V | FLAG_S,
+                shift_flags(res, v & 1));
+      break;
+    case 0xa:
+      res = v - 1;
+      set_flags(avr, FLAG_Z | FLAG_N | FLAG_V | FLAG_S,
+                nzs(res, res == 0x7f ? FLAG_V : 0));
+      break;
+    case 0x8:
+      if ((op & 0xff0f) == 0x9408) {
+        // bset and bclr, including sei and cli.
+        const uint8_t flag = 1 << ((op >> 4) & 7);
+        set_flags(avr, flag, op & 0x80 ? 0 : flag);
+        if (flag == FLAG_I && !(op & 0x80)) avr->hold_interrupts = true;
+        ++avr->cycles;
+        return true;
+      }
+      switch (op) {
+      case 0x9508:
+        pop_pc(avr);
+        avr->cycles += 4;
+        return true;
+      case 0x9518:
+        pop_pc(avr);
+        set_flags(avr, FLAG_I, FLAG_I);
+        avr->hold_interrupts = true;
+        avr->cycles += 4;
+        return true;
+      case 0x9588: case 0x9598: case 0x95a8:
+        // sleep, break and wdr do nothing here.
+        ++avr->cycles;
+        return true;
+      case 0x95c8:
+        w = get_word(avr, REG_Z);
+        avr->data[0] = avr->flash[(w >> 1) & (MAX_FLASH / 2 - 1)] >> (8 * (w & 1));
+        avr->cycles += 3;
+        return true;
+      }
+      return false;
+    case 0x9:
+      if (op != 0x9409 && op != 0x9509) return false;
+      if (op == 0x9509) push_pc(avr);
+      avr->pc = get_word(avr, REG_Z);
+      avr->cycles += op == 0x9509 ? 3 : 2;
+      return true;
+    case 0xc: case 0xd: case 0xe: case 0xf:
+      if (!avr->dev->has_jmp) return false;
+      w = avr->flash[avr->pc++];
+      if (op & 2) push_pc(avr);
+      avr->pc = (((uint32_t) ((op >> 3) & 0x3e) | (op & 1)) << 16) | w;
+      avr->cycles += op & 2 ? 4 : 3;
+      return true;
+    default:
+      return false;
+    }
+    avr->data[d] = res;
+    ++avr->cycles;
+    return true;
+  case 3:
+    // adiw and sbiw.
+    {
+      const int rd = 24 + ((op >> 3) & 6);
+      const uint16_t k = (op & 0x0f) | ((op >> 2) & 0x30);
+      const uint16_t old = get_word(avr, rd);
+      const uint16_t sum = op & 0x100 ? old - k : old + k;
+      flags = (sum & 0x8000) ? FLAG_N : 0;
+      if (!sum) flags |= FLAG_Z;
+      if (op & 0x100) {
+        if (old & ~sum & 0x8000) flags |= FLAG_V;
+        if (sum & ~old & 0x8000) flags |= FLAG_C;
+      } else {
+        if (sum & ~old & 0x8000) flags |= FLAG_V;
+        if (old & ~sum & 0x8000) flags |= FLAG_C;
+      }
+      if (!(flags & FLAG_N) != !(flags & FLAG_V)) flags |= FLAG_S;
+      set_flags(avr, FLAG_C | FLAG_Z | FLAG_N | FLAG_V | FLAG_S, flags);
+      set_word(avr, rd, sum);
+      avr->cycles += 2;
+      return true;
+    }
+  case 4: case 5:
+    if (op & 0x100) {
+      // sbic and sbis.
+      const bool set = (read_data(avr, io) & bit) != 0;
+      ++avr->cycles;
+      if (set == ((op & 0x200) != 0)) skip(avr);
+      return true;
+    }
+    // cbi and sbi.
+    v = read_data(avr, io);
+    avr->cycles += 2;
+    write_data(avr, io, op & 0x200 ? v | bit : v & ~bit);
+    return true;
+  case 6: case 7:
+    if (!avr->dev->has_jmp) return false;
+    w = avr->data[d] * avr->data[r];
+    set_word(avr, 0, w);
+    set_flags(avr, FLAG_C | FLAG_Z,
+              (w & 0x8000 ? FLAG_C : 0) | (w ? 0 : FLAG_Z));
+    avr->cycles += 2;
+    return true;
+  }
+  return false;
+}
+
+// Runs one instruction. Returns false if it is not one we know.
+static bool step(avr_t *avr) {
+  const uint16_t op = avr->flash[avr->pc];
+  const int d = (op >> 4) & 0x1f;
+  const int r = (op & 0x0f) | ((op >> 5) & 0x10);
+  const int dh = 16 + ((op >> 4) & 0x0f);
+  const uint8_t k = ((op >> 4) & 0xf0) | (op & 0x0f);
+  const uint8_t c = avr->data[SREG] & FLAG_C;
+  uint8_t res, v;
+  int16_t w;
+
+  avr->pc = (avr->pc + 1) & (avr->dev->flash_size / 2 - 1);
+  switch (op >> 12) {
+  case 0x0:
+    switch (op & 0xfc00) {
+    case 0x0000:
+      if (op == 0) {
+        ++avr->cycles;
+        return true;
+      }
+      if ((op & 0xff00) == 0x0100) {
+        set_word(avr, ((op >> 4) & 0x0f) * 2, get_word(avr, (op & 0x0f) * 2));
+        ++avr->cycles;
+        return true;
+      }
+      if (!avr->dev->has_jmp) break;
+      if ((op & 0xff00) == 0x0200) {
+        w = (int8_t) avr->data[dh] * (int8_t) avr->data[16 + (op & 0x0f)];
+      } else if ((op & 0xff88) == 0x0300) {
+        w = (int8_t) avr->data[16 + ((op >> 4) & 7)] *
+            avr->data[16 + (op & 7)];
+      } else {
+        break;
+      }
+      set_word(avr, 0, w);
+      set_flags(avr, FLAG_C | FLAG_Z,
+                (w & 0x8000 ? FLAG_C : 0) | (w ? 0 : FLAG_Z));
+      avr->cycles += 2;
+      return true;
+    case 0x0400:
+      res = avr->data[d] - avr->data[r] - c;
+      set_flags(avr, ARITH_FLAGS,
+                sub_flags(avr, avr->data[d], avr->data[r], res, true));
+      ++avr->cycles;
+      return true;
+    case 0x0800:
+      res = avr->data[d] - avr->data[r] - c;
+      set_flags(avr, ARITH_FLAGS,
+                sub_flags(avr, avr->data[d], avr->data[r], res, true));
+      avr->data[d] = res;
+      ++avr->cycles;
+      return true;
+    case 0x0c00:
+      res = avr->data[d] + avr->data[r];
+      set_flags(avr, ARITH_FLAGS,
+                add_flags(avr->data[d], avr->data[r], res));
+      avr->data[d] = res;
+      ++avr->cycles;
+      return true;
+    }
+    break;
+  case 0x1:
+    switch (op & 0xfc00) {
+    case 0x1000:
+      ++avr->cycles;
+      if (avr->data[d] == avr->data[r]) skip(avr);
+      return true;
+    case 0x1400:
+      res = avr->data[d] - avr->data[r];
+      set_flags(avr, ARITH_FLAGS,
+                sub_flags(avr, avr->data[d], avr->data[r], res, false));
+      ++avr->cycles;
+      return true;
+    case 0x1800:
+      res = avr->data[d] - avr->data[r];
+      set_flags(avr, ARITH_FLAGS,
+                sub_flags(avr, avr->data[d], avr->data[r], res, false));
+      avr->data[d] = res;
+      ++avr->cycles;
+      return true;
+    default:
+      res = avr->data[d] + avr->data[r] + c;
+      set_flags(avr, ARITH_FLAGS,
+                add_flags(avr->data[d], avr->data[r], res));
+      avr->data[d] = res;
+      ++avr->cycles;
+      return true;
+    }
+  case 0x2:
+    switch (op & 0xfc00) {
+    case 0x2000:
+      res = avr->data[d] & avr->data[r];
+      break;
+    case 0x2400:
+      res = avr->data[d] ^ avr->data[r];
+      break;
+    case 0x2800:
+      res = avr->data[d] | avr->data[r];
+      break;
+    default:
+      avr->data[d] = avr->data[r];
+      ++avr->cycles;
+      return true;
+    }
+    set_flags(avr, FLAG_Z | FLAG_N | FLAG_V | FLAG_S, nzs(res, 0));
+    avr->data[d] = res;
+    ++avr->cycles;
+    return true;
+  case 0x3:
+    res = avr->data[dh] - k;
+    set_flags(avr, ARITH_FLAGS,
+              sub_flags(avr, avr->data[dh], k, res, false));
+    ++avr->cycles;
+    return true;
+  case 0x4: case 0x5:
+    res = avr->data[dh] - k - (op & 0x1000 ? 0 : c);
+    set_flags(avr, ARITH_FLAGS,
+              sub_flags(avr, avr->data[dh], k, res, !(op & 0x1000)));
+    avr->data[dh] = res;
+    ++avr->cycles;
+    return true;
+  case 0x6: case 0x7:
+    res = op & 0x1000 ? avr->data[dh] & k : avr->data[dh] | k;
+    set_flags(avr, FLAG_Z | FLAG_N | FLAG_V | FLAG_S, nzs(res, 0));
+    avr->data[dh] = res;
+    ++avr->cycles;
+    return true;
+  case 0x8: case 0xa:
+    // ldd and std, which include ld and st through Y and Z.
+    {
+      const int q = (op & 7) | ((op >> 7) & 0x18) | ((op >> 8) & 0x20);
+      const uint16_t addr = get_word(avr, op & 8 ? REG_Y : REG_Z) + q;
+      avr->cycles += 2;
+      if (op & 0x200) {
+        write_data(avr, addr, avr->data[d]);
+      } else {
+        avr->data[d] = read_data(avr, addr);
+      }
+      return true;
+    }
+  case 0x9:
+    if (step_9(avr, op)) return true;
+    break;
+  case 0xb:
+    {
+      const uint16_t io = ((op & 0x0f) | ((op >> 5) & 0x30)) + 0x20;
+      ++avr->cycles;
+      if (op & 0x800) {
+        write_data(avr, io, avr->data[d]);
+      } else {
+        avr->data[d] = read_data(avr, io);
+      }
+      return true;
+    }
+  case 0xc: case 0xd:
+    w = (int16_t) (op << 4) >> 4;
+    if (op & 0x1000) push_pc(avr);
+    avr->pc = (avr->pc + w) & (avr->dev->flash_size / 2 - 1);
+    avr->cycles += op & 0x1000 ? 3 : 2;
+    return true;
+  case 0xe:
+    avr->data[dh] = k;
+    ++avr->cycles;
+    return true;
+  case 0xf:
+    v = 1 << (op & 7);
+    switch (op & 0x0e00) {
+    case 0x0000: case 0x0200: case 0x0400: case 0x0600:
+      // brbs and brbc.
+      ++avr->cycles;
+      if (!(avr->data[SREG] & v) == !!(op & 0x400)) {
+        w = (int8_t) ((op >> 2) & 0xfe) >> 1;
+        avr->pc = (avr->pc + w) & (avr->dev->flash_size / 2 - 1);
+        ++avr->cycles;
+      }
+      return true;
+    case 0x0800:
+      if (op & 8) break;
+      avr->data[d] = (avr->data[d] & ~v) |
+                     (avr->data[SREG] & FLAG_T ? v : 0);
+      ++avr->cycles;
+      return true;
+    case 0x0a00:
+      if (op & 8) break;
+      set_flags(avr, FLAG_T, avr->data[d] & v ? FLAG_T : 0);
+      ++avr->cycles;
+      return true;
+    default:
+      // sbrc and sbrs.
+      if (op & 8) break;
+      ++avr->cycles;
+      if (!(avr->data[d] & v) == !(op & 0x200)) skip(avr);
+      return true;
+    }
+    break;
+  }
+  unknown(avr, op);
+  return false;
+}
+
+// Takes the pending pin change interrupt with the lowest vector, if
+// any.
+static void interrupt(avr_t *avr) {
+  const device_t *dev = avr->dev;
+  const uint8_t pending = avr->data[dev->pcifr] & avr->data[dev->pcicr];
+  unsigned int p;
+
+  if (!pending) return;
+  for (p = 0; p < dev->nports; p++) {
+    if (!(pending & dev->ports[p].pcie)) continue;
+    avr->data[dev->pcifr] &= ~dev->ports[p].pcie;
+    push_pc(avr);
+    set_flags(avr, FLAG_I, 0);
+    avr->pc = dev->ports[p].vector * dev->vector_words;
+    avr->cycles += 4;
+    return;
+  }
+}
+
+static int run(avr_t *avr, uint64_t cycles, const event_t *events,
+               size_t nevents) {
+  size_t next = 0;
+  while (avr->cycles < cycles) {
+    while (next < nevents && events[next].cycle <= avr->cycles) {
+      const event_t *e = &events[next++];
+      const uint8_t bit = 1 << (e->pin % 8);
+      avr->driven[e->pin / 8] |= bit;
+      if (e->level) {
+        avr->input[e->pin / 8] |= bit;
+      } else {
+        avr->input[e->pin / 8] &= ~bit;
+      }
+      update_pins(avr, e->pin / 8, e->cycle);
+    }
+    if (!avr->hold_interrupts && (avr->data[SREG] & FLAG_I)) interrupt(avr);
+    avr->hold_interrupts = false;
+    if (!step(avr)) return -1;
+  }
+  return 0;
+}
+
+static int hex_digits(const char *s, int n) {
+  int value = 0;
+  while (n--) {
+    const char ch = *s++;
+    value <<= 4;
+    if (ch >= '0' && ch <= '9') {
+      value |= ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+      value |= ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+      value |= ch - 'A' + 10;
+    } else {
+      return -1;
+    }
+  }
+  return value;
+}
+
+// Loads an Intel HEX file or, if it does not start with ':', a raw
+// binary into the flash. Returns 0 on success.
+static int load_image(avr_t *avr, const char *path) {
+  uint8_t *flash = (uint8_t *) avr->flash;
+  const uint32_t size = avr->dev->flash_size;
+  char line[600];
+  uint32_t base = 0;
+  int ch, lineno = 0;
+  FILE *f = fopen(path, "rb");
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  ch = getc(f);
+  ungetc(ch, f);
+  if (ch != ':') {
+    size_t n = fread(flash, 1, size, f);
+    if (getc(f) != EOF) {
+      fprintf(stderr, "%s: larger than the %s's flash\n", path,
+              avr->dev->name);
+      n = 0;
+    }
+    fclose(f);
+    return n ? 0 : -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    int count, addr, type, sum = 0, i;
+    ++lineno;
+    if (line[0] != ':') continue;
+    count = hex_digits(line + 1, 2);
+    addr = hex_digits(line + 3, 4);
+    type = hex_digits(line + 7, 2);
+    if (count < 0 || addr < 0 || type < 0 ||
+        strlen(line) < (size_t) (11 + 2 * count)) {
+      goto bad;
+    }
+    for (i = 0; i < count + 5; i++) {
+      const int byte = hex_digits(line + 1 + 2 * i, 2);
+      if (byte < 0) goto bad;
+      sum += byte;
+    }
+    if (sum & 0xff) goto bad;
+    if (type == 1) break;
+    if (type == 2 || type == 4) {
+      base = hex_digits(line + 9, 4) << (type == 2 ? 4 : 16);
+      continue;
+    }
+    if (type != 0) continue;
+    for (i = 0; i < count; i++) {
+      const uint32_t a = base + addr + i;
+      if (a >= size) {
+        fprintf(stderr, "%s:%d: address %x is outside the %s's flash\n",
+                path, lineno, a, avr->dev->name);
+        fclose(f);
+        return -1;
+      }
+      flash[a] = hex_digits(line + 9 + 2 * i, 2);
+    }
+  }
+  fclose(f);
+  return 0;
+
+ bad:
+  fprintf(stderr, "%s:%d: bad record\n", path, lineno);
+  fclose(f);
+  return -1;
+}
+
+// Reads the pin changes to apply from path. Returns the number of
+// them, or -1 on error.
+static long load_events(const avr_t *avr, const char *path,
+                        event_t **events) {
+  size_t n = 0, capacity = 0;
+  char line[256], name[8];
+  unsigned long long cycle;
+  int level, lineno = 0;
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  *events = NULL;
+  while (fgets(line, sizeof(line), f)) {
+    event_t *e;
+    ++lineno;
+    if (line[strspn(line, " \t\n")] == '\0' || line[0] == '#') continue;
+    if (n == capacity) {
+      capacity = capacity ? 2 * capacity : 256;
+      *events = realloc(*events, capacity * sizeof(**events));
+      if (!*events) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    e = &(*events)[n];
+    if (sscanf(line, "%llu %7s %d", &cycle, name, &level) != 3 ||
+        (e->pin = parse_pin(avr->dev, name)) < 0 ||
+        (n && cycle < (*events)[n - 1].cycle)) {
+      fprintf(stderr, "%s:%d: expected \"cycle pin level\", in order\n",
+              path, lineno);
+      fclose(f);
+      return -1;
+    }
+    e->cycle = cycle;
+    e->level = level != 0;
+    ++n;
+  }
+  fclose(f);
+  return n;
+}
+
+// Returns the pin named right after what in text, or -1.
+static int find_pin(const device_t *dev, const char *text, const char *what) {
+  const char *p = strstr(text, what);
+  return p ? parse_pin(dev, p + strlen(what)) : -1;
+}
+
+// Reads the comments at the top of the source file at path: the device
+// (if *dev is not set yet), the pins that carry hsync, vsync and
+// active, and the timing tables. Where a file has several tables, the
+// last one is used. Returns 0 on success.
+static int read_source(const char *path, const device_t **dev, timing_t *t) {
+  char line[256], text[4096] = "", name[32];
+  bool vertical = false;
+  unsigned int value;
+  int i;
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    char *p = line + strspn(line, " \t");
+    if (*p != ';') {
+      if (*p == '\n' || *p == '\0') continue;
+      break;
+    }
+    p += strspn(p, "; \t");
+    p[strcspn(p, "\n")] = '\0';
+    // Sentences run across lines, so keep the text as a whole.
+    if (strlen(text) + strlen(p) + 2 < sizeof(text)) {
+      strcat(text, " ");
+      strcat(text, p);
+    }
+    if (!strncmp(p, "Horizontal", 10)) {
+      vertical = false;
+    } else if (!strncmp(p, "Vert", 4)) {
+      // Vertical, or Vertial.
+      vertical = true;
+    } else if (sscanf(p, "%31[a-z ]%u", name, &value) == 2) {
+      for (i = 0; i < NCHECKS; i++) {
+        if (rows[i].vertical == vertical &&
+            !strncmp(p, rows[i].row, strlen(rows[i].row))) {
+          t->checks[i].expected = value;
+        }
+      }
+    }
+  }
+  fclose(f);
+
+  if (!*dev) {
+    if (strstr(text, "ATtiny")) *dev = find_device("attiny85");
+    if (strstr(text, "ATmega")) *dev = find_device("atmega328");
+    if (!*dev) {
+      fprintf(stderr, "%s: device not named in the header, use -m\n", path);
+      return -1;
+    }
+  }
+  t->hsync = find_pin(*dev, text, "hsync on ");
+  t->vsync = find_pin(*dev, text, "vsync on ");
+  t->active = find_pin(*dev, text, "active signal on ");
+  if (t->hsync < 0 || t->vsync < 0 || t->active < 0) {
+    fprintf(stderr, "%s: hsync, vsync and active pins not found\n", path);
+    return -1;
+  }
+  for (i = 0; i < NCHECKS; i++) {
+    if (!t->checks[i].expected) {
+      fprintf(stderr, "%s: no %s %s in the timing tables\n", path,
+              rows[i].vertical ? "vertical" : "horizontal", rows[i].row);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-m device] [-c cycles] [-i inputs] [-s source] [-t]"
+          " image\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  static avr_t avr;
+  const device_t *dev = NULL;
+  const char *source = NULL, *inputs = NULL;
+  uint64_t cycles = 0;
+  event_t *events = NULL;
+  long nevents = 0;
+  timing_t timing;
+  int opt, result = 0;
+
+  while ((opt = getopt(argc, argv, "c:i:m:s:t")) != -1) {
+    switch (opt) {
+    case 'c':
+      cycles = strtoull(optarg, NULL, 0);
+      break;
+    case 'i':
+      inputs = optarg;
+      break;
+    case 'm':
+      dev = find_device(optarg);
+      if (!dev) {
+        fprintf(stderr, "Unknown device %s. Use attiny85 or atmega328.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case 's':
+      source = optarg;
+      break;
+    case 't':
+      avr.trace = true;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (source) {
+    memset(&timing, 0, sizeof(timing));
+    if (read_source(source, &dev, &timing)) return 1;
+    avr.timing = &timing;
+    if (!cycles) {
+      cycles = (uint64_t) CHECK_FRAMES * timing.checks[FRAME_TOTAL].expected *
+               timing.checks[LINE_TOTAL].expected;
+    }
+  }
+  if (!dev) dev = find_device("atmega328");
+  if (!cycles) cycles = DEFAULT_CYCLES;
+  avr.dev = dev;
+  if (load_image(&avr, argv[optind])) return 1;
+  if (inputs) {
+    nevents = load_events(&avr, inputs, &events);
+    if (nevents < 0) return 1;
+  }
+
+  set_word(&avr, SPL, dev->data_size - 1);
+  if (run(&avr, cycles, events, nevents)) result = 1;
+  if (source && timing_report(&timing)) result = 1;
+  free(events);
+  return result;
+}
@@ -0,0 +1,258 @@
+// Usage: mkcart [-z] [-a load_address [-e entry] [-p page_size]] in out
+//
+// Builds a cartridge image. If in starts with a cartridge header, as
+// the apps' .bin files do, its fields are used. Otherwise, in holds
+// the program itself and -a must be given. With -z, the program is
+// compressed, so that it loads faster. The ROM's loadcartz describes
+// the format.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEADER_SIZE 16
+
+// Bit in header byte 14 that marks a compressed program.
+#define CARTLZ 0x01
+
+// Limits of the compressed format.
+#define MAX_LITERALS 0x7f
+#define MIN_MATCH 3
+#define MAX_MATCH (0x7f + MIN_MATCH)
+#define MAX_DISTANCE 0xffff
+
+// Matches shorter than this take more space than the literals.
+#define USEFUL_MATCH 4
+
+// Number of earlier positions with the same three bytes that are
+// tried when looking for a match.
+#define MAX_CHAIN 256
+
+#define HASH_SIZE 0x10000
+
+static uint16_t get_u16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static void put_u16(uint8_t *p, uint16_t x) {
+  p[0] = x & 0xff;
+  p[1] = x >> 8;
+}
+
+static unsigned int hash3(const uint8_t *p) {
+  return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+// Appends the literals from start to end to out. Returns the new end of
+// out.
+static size_t put_literals(uint8_t *out, size_t n, const uint8_t *start,
+                           const uint8_t *end) {
+  while (start < end) {
+    size_t count = end - start;
+    if (count > MAX_LITERALS) count = MAX_LITERALS;
+    out[n++] = count;
+    memcpy(out + n, start, count);
+    n += count;
+    start += count;
+  }
+  return n;
+}
+
+// Compresses size bytes from in into out, which must have room for
+// size + size / MAX_LITERALS + 2 bytes. Returns the compressed size.
+static size_t compress(const uint8_t *in, size_t size, uint8_t *out) {
+  int32_t *head = malloc(HASH_SIZE * sizeof(*head));
+  int32_t *prev = malloc((size ? size : 1) * sizeof(*prev));
+  size_t pos = 0, literals = 0, n = 0, i;
+
+  if (!head || !prev) {
+    perror("malloc");
+    exit(1);
+  }
+  for (i = 0; i < HASH_SIZE; i++) head[i] = -1;
+
+  while (pos < size) {
+    size_t best_len = 0, best_dist = 0;
+    if (pos + MIN_MATCH <= size) {
+      const unsigned int h = hash3(in + pos);
+      int32_t cand = head[h];
+      unsigned int chain = 0;
+      while (cand >= 0 && pos - cand <= MAX_DISTANCE &&
+             chain++ < MAX_CHAIN) {
+        size_t len = 0;
+        // The match may overlap the bytes being produced.
+        while (len < MAX_MATCH && pos + len < size &&
+               in[cand + len] == in[pos + len]) {
+          ++len;
+        }
+        if (len > best_len) {
+          best_len = len;
+          best_dist = pos - cand;
+          if (len == MAX_MATCH) break;
+        }
+        cand = prev[cand];
+      }
+    }
+    if (best_len >= USEFUL_MATCH) {
+      n = put_literals(out, n, in + literals, in + pos);
+      out[n++] = 0x80 | (best_len - MIN_MATCH);
+      put_u16(out + n, best_dist);
+      n += 2;
+      for (i = 0; i < best_len; i++, pos++) {
+        if (pos + MIN_MATCH <= size) {
+          const unsigned int h = hash3(in + pos);
+          prev[pos] = head[h];
+          head[h] = pos;
+        }
+      }
+      literals = pos;
+    } else {
+      if (pos + MIN_MATCH <= size) {
+        const unsigned int h = hash3(in + pos);
+        prev[pos] = head[h];
+        head[h] = pos;
+      }
+      ++pos;
+    }
+  }
+  n = put_literals(out, n, in + literals, in + size);
+  out[n++] = 0;
+
+  free(head);
+  free(prev);
+  return n;
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+  uint8_t *data;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  rewind(f);
+  data = malloc(*size ? *size : 1);
+  if (!data || fread(data, 1, *size, f) != *size) {
+    perror(path);
+    free(data);
+    data = NULL;
+  }
+  fclose(f);
+  return data;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-z] [-a load_address [-e entry] [-p page_size]]"
+          " in out\n", argv0);
+  exit(0x80);
+}
+
+int main(int argc, char *argv[]) {
+  long load = -1, entry = -1, page_size = 32;
+  int compressed = 0, opt;
+  uint8_t header[HEADER_SIZE];
+  uint8_t *in, *out;
+  const uint8_t *program;
+  size_t in_size, program_size, out_size;
+  FILE *f;
+
+  while ((opt = getopt(argc, argv, "a:e:p:z")) != -1) {
+    switch (opt) {
+    case 'a':
+      load = strtol(optarg, NULL, 0);
+      break;
+    case 'e':
+      entry = strtol(optarg, NULL, 0);
+      break;
+    case 'p':
+      page_size = strtol(optarg, NULL, 0);
+      break;
+    case 'z':
+      compressed = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 2) usage(argv[0]);
+
+  in = read_file(argv[optind], &in_size);
+  if (!in) return 1;
+
+  if (load < 0) {
+    // Take the program and header fields from an existing image.
+    size_t start, length;
+    if (in_size < HEADER_SIZE || memcmp(in, "HM\0\1", 4) != 0) {
+      fprintf(stderr, "%s: no cartridge header; use -a\n", argv[optind]);
+      return 1;
+    }
+    if (in[14] & CARTLZ) {
+      fprintf(stderr, "%s: already compressed\n", argv[optind]);
+      return 1;
+    }
+    start = get_u16(in + 8);
+    length = get_u16(in + 10);
+    if (start + length > in_size) {
+      fprintf(stderr, "%s: header says program ends at %lu,"
+              " but file is only %lu bytes\n", argv[optind],
+              (unsigned long) (start + length), (unsigned long) in_size);
+      return 1;
+    }
+    memcpy(header, in, HEADER_SIZE);
+    program = in + start;
+    program_size = length;
+  } else {
+    if (in_size > 0xffff) {
+      fprintf(stderr, "%s: program too large\n", argv[optind]);
+      return 1;
+    }
+    memcpy(header, "HM\0\1", 4);
+    put_u16(header + 4, entry < 0 ? load : entry);
+    put_u16(header + 6, page_size);
+    put_u16(header + 12, load);
+    program = in;
+    program_size = in_size;
+  }
+
+  // The program follows the header.
+  put_u16(header + 8, HEADER_SIZE);
+  header[14] = 0;
+  header[15] = 0;
+  if (compressed) {
+    out = malloc(program_size + program_size / MAX_LITERALS + 2);
+    if (!out) {
+      perror("malloc");
+      return 1;
+    }
+    out_size = compress(program, program_size, out);
+    if (out_size > 0xffff) {
+      fprintf(stderr, "%s: compressed program too large\n", argv[optind]);
+      return 1;
+    }
+    header[14] |= CARTLZ;
+  } else {
+    out = (uint8_t *) program;
+    out_size = program_size;
+  }
+  // For compressed programs, this is the number of bytes on the
+  // cartridge; loadcartz does not need it.
+  put_u16(header + 10, out_size);
+
+  f = fopen(argv[optind + 1], "wb");
+  if (!f) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+  if (fwrite(header, 1, HEADER_SIZE, f) != HEADER_SIZE ||
+      fwrite(out, 1, out_size, f) != out_size || fclose(f) != 0) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+  printf("%lu bytes program, %lu bytes on cartridge\n",
+         (unsigned long) program_size, (unsigned long) out_size);
+  return 0;
+}
@@ -0,0 +1,420 @@
+// Usage: multicart pinmap file [start_address [length]]
+//
+// Writes the same image to several cartridges at once, then reads them
+// all back and compares them with the image. pinmap lists one
+// cartridge slot per line: a name and the GPIO pins for vcc, scl and
+// sda. Lines starting with # are ignored. For example:
+//
+//   # name  vcc scl sda
+//   left      2   3   4
+//   right     5   6   7
+//
+// The slots are clocked in lock step: every edge of SCL on all slots is
+// a single write to the set or clear register, and reading SDA from all
+// slots is a single read of the level register. Writing to N
+// cartridges therefore takes as long as writing to one. A slot that
+// stops responding is dropped and the others carry on.
+#include "../gpio.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_SLOTS 8
+#define MAX_NAME 32
+
+/** Bus timing, from docs/design/twi.txt. */
+#define SCL_LOW_NS 1300
+#define SCL_HIGH_NS 600
+#define DATA_VALID_NS 900
+#define START_HOLD_NS 8000
+#define START_SETUP_NS 4700
+#define STOP_SETUP_NS 4000
+#define BUS_FREE_NS 4700
+
+/** Time to wait after powering up the cartridges. */
+#define POWER_UP_NS 500000000
+/** How long to keep polling for the end of a write. The 24C256 takes
+ *  up to 5 ms. */
+#define WRITE_TIMEOUT_NS 20000000
+
+/** Size and page size of the 24C256. */
+#define CHIP_SIZE 0x8000
+#define PAGE_SIZE 64
+
+/** Device address of the EEPROM, for writing and reading. */
+#define DEVICE_WRITE 0xa0
+#define DEVICE_READ 0xa1
+
+typedef struct {
+  char name[MAX_NAME];
+  int vcc_pin, scl_pin, sda_pin;
+  /** Why the slot was dropped, or NULL if it is still in use. */
+  const char *error;
+  /** Number of bytes that read back differently from the image. */
+  unsigned long differences;
+} slot_t;
+
+typedef struct {
+  gpio_t *gpio;
+  slot_t slots[MAX_SLOTS];
+  int num_slots;
+  /** Bit i is set if slot i is still in use. */
+  unsigned int active;
+  /** Pins of the slots in use. */
+  uint32_t scl, sda;
+  /** Pins of all slots. */
+  uint32_t all_vcc, all_scl, all_sda;
+} station_t;
+
+/** Reads the slots from the pin map at path. Returns 0 on success. */
+static int read_pinmap(station_t *station, const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[256];
+  int number = 0, i;
+  uint32_t used = 0, pins;
+  slot_t *slot;
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  station->num_slots = 0;
+  while (fgets(line, sizeof(line), f)) {
+    ++number;
+    line[strcspn(line, "#\n")] = 0;
+    if (line[strspn(line, " \t")] == 0) continue;
+    if (station->num_slots == MAX_SLOTS) {
+      fprintf(stderr, "%s:%d: more than %d slots\n", path, number,
+              MAX_SLOTS);
+      goto error;
+    }
+    slot = &station->slots[station->num_slots];
+    if (sscanf(line, "%31s %d %d %d", slot->name, &slot->vcc_pin,
+               &slot->scl_pin, &slot->sda_pin) != 4) {
+      fprintf(stderr, "%s:%d: expected name, vcc, scl and sda pins\n",
+              path, number);
+      goto error;
+    }
+    pins = 0;
+    for (i = 0; i < 3; i++) {
+      const int pin = i == 0 ? slot->vcc_pin :
+        i == 1 ? slot->scl_pin : slot->sda_pin;
+      if (pin < 0 || pin >= 28 || ((used | pins) & (1u << pin))) {
+        fprintf(stderr, "%s:%d: pin %d is not available\n", path, number,
+                pin);
+        goto error;
+      }
+      pins |= 1u << pin;
+    }
+    used |= pins;
+    slot->error = NULL;
+    slot->differences = 0;
+    ++station->num_slots;
+  }
+  fclose(f);
+  if (station->num_slots == 0) {
+    fprintf(stderr, "%s: no slots\n", path);
+    return -1;
+  }
+  return 0;
+
+ error:
+  fclose(f);
+  return -1;
+}
+
+/** Recomputes the pin masks from the slots. */
+static void update_masks(station_t *station) {
+  int i;
+  station->active = 0;
+  station->scl = station->sda = 0;
+  station->all_vcc = station->all_scl = station->all_sda = 0;
+  for (i = 0; i < station->num_slots; i++) {
+    const slot_t *slot = &station->slots[i];
+    station->all_vcc |= 1u << slot->vcc_pin;
+    station->all_scl |= 1u << slot->scl_pin;
+    station->all_sda |= 1u << slot->sda_pin;
+    if (slot->error) continue;
+    station->active |= 1u << i;
+    station->scl |= 1u << slot->scl_pin;
+    station->sda |= 1u << slot->sda_pin;
+  }
+}
+
+/** Stops using the slots whose bits are set in failed. */
+static void drop_slots(station_t *station, unsigned int failed,
+                       const char *error) {
+  int i;
+  failed &= station->active;
+  if (!failed) return;
+  for (i = 0; i < station->num_slots; i++) {
+    if (failed & (1u << i)) {
+      station->slots[i].error = error;
+      fprintf(stderr, "%s: %s\n", station->slots[i].name, error);
+    }
+  }
+  update_masks(station);
+}
+
+/** Returns a mask of the slots whose SDA pin is high in levels. */
+static unsigned int slots_high(const station_t *station, uint32_t levels) {
+  unsigned int result = 0;
+  int i;
+  for (i = 0; i < station->num_slots; i++) {
+    if (levels & (1u << station->slots[i].sda_pin)) result |= 1u << i;
+  }
+  return result;
+}
+
+/** Drives SDA of all slots in use high if bit is set, low otherwise. */
+static void set_sda(station_t *station, int bit) {
+  if (bit) {
+    set_gpio_pins_high(station->gpio, station->sda);
+  } else {
+    set_gpio_pins_low(station->gpio, station->sda);
+  }
+}
+
+/** Clocks one bit out of SDA. SCL is low before and after. */
+static void send_bit(station_t *station, int bit) {
+  set_sda(station, bit);
+  delay_ns(SCL_LOW_NS);
+  set_gpio_pins_high(station->gpio, station->scl);
+  delay_ns(SCL_HIGH_NS);
+  set_gpio_pins_low(station->gpio, station->scl);
+}
+
+/** Clocks one bit in from the SDA pins and returns their levels. */
+static uint32_t recv_bit(station_t *station) {
+  uint32_t levels;
+  delay_ns(SCL_LOW_NS);
+  set_gpio_pins_high(station->gpio, station->scl);
+  delay_ns(SCL_HIGH_NS);
+  levels = get_gpio_levels(station->gpio);
+  set_gpio_pins_low(station->gpio, station->scl);
+  return levels;
+}
+
+static void release_sda(station_t *station) {
+  set_gpio_pins_high(station->gpio, station->sda);
+  configure_gpio_pins(station->gpio, station->sda, GPIO_FUNC_INPUT);
+}
+
+static void drive_sda(station_t *station) {
+  /* Give the devices time to let go of SDA. */
+  delay_ns(DATA_VALID_NS);
+  configure_gpio_pins(station->gpio, station->all_sda, GPIO_FUNC_OUTPUT);
+}
+
+/** Sends a byte to all slots in use and returns a mask of the slots
+ *  that did not acknowledge it. */
+static unsigned int send_byte(station_t *station, uint8_t value) {
+  uint32_t levels;
+  int i;
+  for (i = 0; i < 8; i++) {
+    send_bit(station, value >> 7);
+    value <<= 1;
+  }
+  release_sda(station);
+  levels = recv_bit(station);
+  drive_sda(station);
+  return slots_high(station, levels) & station->active;
+}
+
+/** Receives a byte from each slot in use into values, indexed by slot,
+ *  and acknowledges it unless last is set. */
+static void recv_bytes(station_t *station, uint8_t values[MAX_SLOTS],
+                       bool last) {
+  unsigned int high;
+  int i, bit;
+  memset(values, 0, MAX_SLOTS);
+  release_sda(station);
+  for (bit = 0; bit < 8; bit++) {
+    high = slots_high(station, recv_bit(station));
+    for (i = 0; i < station->num_slots; i++) {
+      values[i] = (values[i] << 1) | ((high >> i) & 1);
+    }
+  }
+  drive_sda(station);
+  send_bit(station, last);
+}
+
+static void start(station_t *station) {
+  set_gpio_pins_low(station->gpio, station->sda);
+  delay_ns(START_HOLD_NS);
+  set_gpio_pins_low(station->gpio, station->scl);
+}
+
+static void restart(station_t *station) {
+  set_gpio_pins_high(station->gpio, station->sda);
+  delay_ns(SCL_LOW_NS);
+  set_gpio_pins_high(station->gpio, station->scl);
+  delay_ns(START_SETUP_NS);
+  start(station);
+}
+
+/** Ends the transaction on all slots, including those dropped in the
+ *  middle of it. */
+static void stop(station_t *station) {
+  set_gpio_pins_low(station->gpio, station->all_scl | station->all_sda);
+  delay_ns(SCL_LOW_NS);
+  set_gpio_pins_high(station->gpio, station->all_scl);
+  delay_ns(STOP_SETUP_NS);
+  set_gpio_pins_high(station->gpio, station->all_sda);
+  delay_ns(BUS_FREE_NS);
+}
+
+/** Starts a transaction at address on all slots in use. */
+static void begin_transfer(station_t *station, uint32_t address) {
+  start(station);
+  drop_slots(station, send_byte(station, DEVICE_WRITE),
+             "did not acknowledge device address");
+  drop_slots(station, send_byte(station, (address >> 8) & 0xff),
+             "did not acknowledge address byte 0");
+  drop_slots(station, send_byte(station, address & 0xff),
+             "did not acknowledge address byte 1");
+}
+
+/** Polls the slots in use until all have finished writing. Slots that
+ *  take too long are dropped. */
+static void wait_for_writes(station_t *station) {
+  const unsigned long begin = get_time_ns();
+  unsigned int busy = station->active;
+  while (busy) {
+    if (get_time_ns() - begin > WRITE_TIMEOUT_NS) {
+      drop_slots(station, busy, "did not acknowledge write");
+      return;
+    }
+    start(station);
+    busy &= send_byte(station, DEVICE_WRITE);
+    stop(station);
+  }
+}
+
+static void write_image(station_t *station, uint32_t address,
+                        const uint8_t *image, uint32_t length) {
+  uint32_t i, n;
+  while (length > 0 && station->active) {
+    n = PAGE_SIZE - (address % PAGE_SIZE);
+    if (n > length) n = length;
+    begin_transfer(station, address);
+    for (i = 0; i < n; i++) {
+      drop_slots(station, send_byte(station, image[i]),
+                 "did not acknowledge data");
+    }
+    stop(station);
+    wait_for_writes(station);
+    address += n;
+    image += n;
+    length -= n;
+  }
+}
+
+/** Reads the range back from all slots in use in one sequential read
+ *  and counts the bytes that differ from image. */
+static void verify_image(station_t *station, uint32_t address,
+                         const uint8_t *image, uint32_t length) {
+  uint8_t values[MAX_SLOTS];
+  uint32_t i;
+  int j;
+  begin_transfer(station, address);
+  restart(station);
+  drop_slots(station, send_byte(station, DEVICE_READ),
+             "did not acknowledge device address");
+  for (i = 0; i < length && station->active; i++) {
+    recv_bytes(station, values, i == length - 1);
+    for (j = 0; j < station->num_slots; j++) {
+      if ((station->active & (1u << j)) && values[j] != image[i]) {
+        station->slots[j].differences++;
+      }
+    }
+  }
+  stop(station);
+}
+
+static void configure_pins(station_t *station) {
+  /* Set scl and sda high and vcc low as fast as we can. */
+  configure_gpio_pins(station->gpio, station->all_vcc, GPIO_FUNC_OUTPUT);
+  set_gpio_pins_low(station->gpio, station->all_vcc);
+  set_gpio_pins_high(station->gpio, station->all_scl | station->all_sda);
+  configure_gpio_pins(station->gpio, station->all_scl | station->all_sda,
+                      GPIO_FUNC_OUTPUT);
+}
+
+int main(int argc, char *argv[]) {
+  static uint8_t image[CHIP_SIZE];
+  station_t station;
+  gpio_t gpio;
+  gpio_functions_t saved_functions;
+  FILE *input;
+  uint32_t address = 0, length = CHIP_SIZE;
+  unsigned long begin;
+  double seconds;
+  int i, active = 0, result = 0;
+
+  if (argc < 3 || argc > 5) {
+    fprintf(stderr, "Usage: multicart pinmap file [address [length]]\n");
+    return 0x80;
+  }
+  if (read_pinmap(&station, argv[1])) return 1;
+  if (argc > 3) address = atol(argv[3]);
+  if (argc > 4) length = atol(argv[4]);
+  if (address >= CHIP_SIZE) {
+    fprintf(stderr, "address %u is past the end of the cartridge\n",
+            address);
+    return 1;
+  }
+  if (length > CHIP_SIZE - address) length = CHIP_SIZE - address;
+  input = fopen(argv[2], "rb");
+  if (!input) {
+    perror(argv[2]);
+    return 1;
+  }
+  length = fread(image, 1, length, input);
+  if (ferror(input)) {
+    fprintf(stderr, "Error reading input - aborting\n");
+    return 1;
+  }
+  fclose(input);
+
+  if (init_gpio(&gpio)) return 1;
+  station.gpio = &gpio;
+  update_masks(&station);
+  get_gpio_functions(&gpio, &saved_functions);
+  configure_pins(&station);
+  set_gpio_pins_high(&gpio, station.all_vcc);
+  delay_ns(POWER_UP_NS);
+
+  begin = get_time_ns();
+  write_image(&station, address, image, length);
+  seconds = (get_time_ns() - begin) / 1e9;
+  for (i = 0; i < station.num_slots; i++) {
+    if (station.active & (1u << i)) active++;
+  }
+  fprintf(stderr, "Wrote %u bytes to %d cartridges in %.2f s"
+          " (%.0f bytes/s each)\n", length, active, seconds,
+          length / seconds);
+  verify_image(&station, address, image, length);
+
+  for (i = 0; i < station.num_slots; i++) {
+    const slot_t *slot = &station.slots[i];
+    if (slot->error) {
+      printf("%s: failed: %s\n", slot->name, slot->error);
+      result = 1;
+    } else if (slot->differences) {
+      printf("%s: failed: %lu bytes differ\n", slot->name,
+             slot->differences);
+      result = 1;
+    } else {
+      printf("%s: ok\n", slot->name);
+    }
+  }
+
+  set_gpio_pins_low(&gpio, station.all_vcc);
+  set_gpio_functions(&gpio, &saved_functions);
+  fini_gpio(&gpio);
+  return result;
+}
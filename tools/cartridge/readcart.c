@@ -1,4 +1,5 @@
-// Usage: readcart [start_address [length]]
+// Usage: readcart [-a] [-b] [-v file] [start_address [length]]
+#include "../dump.h"
 #include "../gpio.h"
 
 #include <stdio.h>
@@ -14,30 +15,36 @@
 #define SCL_PIN 3
 #define SDA_PIN 4
 
-static void sleep_ns_impl(unsigned long ns) {
-  struct timespec ts;
-  ts.tv_sec = ns / 1000000000UL;
-  ts.tv_nsec = ns % 1000000000UL;
-  nanosleep(&ts, NULL);
-}
+/** Bus timing, from docs/design/twi.txt. */
+#define SCL_LOW_NS 1300
+#define SCL_HIGH_NS 600
+#define DATA_VALID_NS 900
+#define START_HOLD_NS 8000
+#define START_SETUP_NS 4700
+#define STOP_SETUP_NS 4000
 
-static void sleep_ns(unsigned long ns) {
-  // sleep_ns_impl(ns * 5000000);
-  // sleep_ns_impl(ns * 100);
-  sleep_ns_impl(ns);
-}
+/** Time to wait after powering up the cartridge. */
+#define POWER_UP_NS 500000000
+
+/** Size of the 24C256. */
+#define CHIP_SIZE 0x8000
+/** Number of bytes read before passing them on. */
+#define CHUNK_SIZE 4096
+
+/** Device address of the EEPROM, for writing and reading. */
+#define DEVICE_WRITE 0xa0
+#define DEVICE_READ 0xa1
 
 /** Configures the pins and sets chip enable, output enable, and write
  *  enable high (which, for those pins, means "disabled").
  */
 static void configure_pins(gpio_t* gpio) {
-  volatile gpio_functions_t *gfsel = gpio->functions;
   /* Set scl and sda high and vcc low as fast as we can. */
-  set_gpio_pin_function(gfsel, VCC_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, VCC_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_low(gpio, VCC_PIN);
-  set_gpio_pin_function(gfsel, SCL_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, SCL_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, SCL_PIN);
-  set_gpio_pin_function(gfsel, SDA_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, SDA_PIN);
 }
 
@@ -50,30 +57,33 @@ static void enable_chip(gpio_t *gpio) {
   set_gpio_pins_high(gpio, (1 << SCL_PIN) | (1 << SDA_PIN) | (1 << VCC_PIN));
 }
 
+/** Receives a byte. SCL is low before and after. */
 static uint8_t recv_byte(gpio_t *gpio) {
   int i;
   uint8_t result = 0;
   
   set_gpio_pin_high(gpio, SDA_PIN);
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_INPUT);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_INPUT);
   for (i = 0; i < 8; i++) {
     result <<= 1;
-    sleep_ns(5000);
+    delay_ns(SCL_LOW_NS);
     set_gpio_pin_high(gpio, SCL_PIN);
-    sleep_ns(2500);
+    delay_ns(SCL_HIGH_NS);
     result |= get_gpio_pin_value(gpio, SDA_PIN);
-    sleep_ns(2500);
     set_gpio_pin_low(gpio, SCL_PIN);
   }
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_OUTPUT);
+  /* Give the device time to let go of SDA. */
+  delay_ns(DATA_VALID_NS);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_OUTPUT);
   return result;
 }
 
-static void send_ack(gpio_t *gpio) {
-  set_gpio_pin_low(gpio, SDA_PIN);
-  sleep_ns(5000);
+/** Sends an acknowledge bit: 0 to ask for another byte, 1 to end. */
+static void send_ack_bit(gpio_t *gpio, int bit) {
+  set_gpio_pin_value(gpio, SDA_PIN, bit);
+  delay_ns(SCL_LOW_NS);
   set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(5000);
+  delay_ns(SCL_HIGH_NS);
   set_gpio_pin_low(gpio, SCL_PIN);
 }
 
@@ -81,75 +91,125 @@ static int send_byte(gpio_t *gpio, uint8_t value) {
   int i;
   for (i = 0; i < 8; i++) {
     set_gpio_pin_value(gpio, SDA_PIN, (value >> 7));
-    sleep_ns(5000);
+    delay_ns(SCL_LOW_NS);
     set_gpio_pin_high(gpio, SCL_PIN);
-    sleep_ns(5000);
+    delay_ns(SCL_HIGH_NS);
     set_gpio_pin_low(gpio, SCL_PIN);
     value <<= 1;
   }
   set_gpio_pin_high(gpio, SDA_PIN);
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_INPUT);
-  sleep_ns(5000);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_INPUT);
+  delay_ns(SCL_LOW_NS);
   set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(2500);
+  delay_ns(SCL_HIGH_NS);
   i = get_gpio_pin_value(gpio, SDA_PIN);
-  sleep_ns(2500);
   set_gpio_pin_low(gpio, SCL_PIN);
-  sleep_ns(2500);
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_OUTPUT);
-  sleep_ns(2500);
+  delay_ns(DATA_VALID_NS);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_OUTPUT);
   return i;
 }
 
-static void send_nak(gpio_t *gpio) {
-  set_gpio_pin_high(gpio, SDA_PIN);
-  sleep_ns(5000);
-  set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(5000);
-  set_gpio_pin_low(gpio, SCL_PIN);
-}
-
 static void restart(gpio_t *gpio) {
   set_gpio_pin_high(gpio, SDA_PIN);
-  sleep_ns(8000);
+  delay_ns(SCL_LOW_NS);
   set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(8000);
+  delay_ns(START_SETUP_NS);
   set_gpio_pin_low(gpio, SDA_PIN);
-  sleep_ns(8000);
+  delay_ns(START_HOLD_NS);
   set_gpio_pin_low(gpio, SCL_PIN);
 }
 
 static void start(gpio_t *gpio) {
   set_gpio_pin_low(gpio, SDA_PIN);
-  sleep_ns(8000);
+  delay_ns(START_HOLD_NS);
   set_gpio_pin_low(gpio, SCL_PIN);
 }
 
 static void stop(gpio_t *gpio) {
   set_gpio_pins_low(gpio, (1 << SCL_PIN) | (1 << SDA_PIN));
-  sleep_ns(8000);
+  delay_ns(SCL_LOW_NS);
   set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(8000);
+  delay_ns(STOP_SETUP_NS);
   set_gpio_pin_high(gpio, SDA_PIN);
 }
 
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-a] [-b] [-v file] [start_address [length]]\n"
+          "  -a       read the whole cartridge\n"
+          "  -b       write the bytes as they are instead of as hex\n"
+          "  -v file  compare with file instead of writing the bytes\n",
+          argv0);
+  exit(1);
+}
+
 int main(int argc, char *argv[]) {
   int n = 0;
   gpio_t gpio;
   gpio_functions_t saved_functions;
-  uint32_t address = 0, address_mod = 0, length = 0x200;
+  uint32_t address = 0, length = 0x200, i, count;
+  dump_t dump;
+  bool whole_chip = false, binary = false;
+  const char *expected_path = NULL;
+  FILE *expected = NULL;
+  uint8_t buffer[CHUNK_SIZE];
+  long size;
+  int opt;
 
-  if (argc > 1) address = atol(argv[1]);
-  if (argc > 2) length = atol(argv[2]);
+  while ((opt = getopt(argc, argv, "abv:")) != -1) {
+    switch (opt) {
+    case 'a':
+      whole_chip = true;
+      break;
+    case 'b':
+      binary = true;
+      break;
+    case 'v':
+      expected_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (expected_path) {
+    expected = fopen(expected_path, "rb");
+    if (!expected) {
+      perror(expected_path);
+      return 1;
+    }
+    /* By default, compare the whole file. */
+    size = get_file_size(expected);
+    if (size < 0) {
+      perror(expected_path);
+      return 1;
+    }
+    length = size;
+  }
+  if (optind < argc) address = atol(argv[optind]);
+  if (optind + 1 < argc) length = atol(argv[optind + 1]);
+  if (optind + 2 < argc) usage(argv[0]);
+  if (whole_chip) {
+    address = 0;
+    length = CHIP_SIZE;
+  }
+  if (address >= CHIP_SIZE || length > CHIP_SIZE - address) {
+    fprintf(stderr, "range does not fit in the cartridge (%u bytes)\n",
+            CHIP_SIZE);
+    return 1;
+  }
+  if (length == 0) return 0;
 
   if (init_gpio(&gpio)) return 1;
-  copy_gpio_functions(&saved_functions, gpio.functions);
+  get_gpio_functions(&gpio, &saved_functions);
   configure_pins(&gpio);
   enable_chip(&gpio);
-  sleep_ns(500000000);
+  delay_ns(POWER_UP_NS);
+  init_dump(&dump, address);
+  if (binary) set_dump_binary(&dump);
+  if (expected) set_dump_expected(&dump, expected);
   start(&gpio);
   do {
-    n = send_byte(&gpio, 0xa0);
+    n = send_byte(&gpio, DEVICE_WRITE);
     if (n) {
       fprintf(stderr, "Device did not acknowledge device address\n");
       n = 1;
@@ -168,35 +228,29 @@ int main(int argc, char *argv[]) {
       break;
     }
     restart(&gpio);
-    n = send_byte(&gpio, 0xa1);
+    n = send_byte(&gpio, DEVICE_READ);
     if (n) {
       fprintf(stderr, "Device did not acknowledge device address\n");
       n = 1;
       break;
     }
 
+    /* The device sends the following byte for as long as we
+       acknowledge, so the whole range is read in one go. */
     while (length > 0) {
-      if (address_mod == 0) printf("%08x:", address);
-      printf(" %02x", recv_byte(&gpio));
-      if (length > 1) {
-        send_ack(&gpio);
-      } else {
-        send_nak(&gpio);
-      }
-      ++address_mod;
-      if (address_mod >= 16) {
-        address_mod = 0;
-        printf("\n");
+      count = length < CHUNK_SIZE ? length : CHUNK_SIZE;
+      for (i = 0; i < count; i++) {
+        buffer[i] = recv_byte(&gpio);
+        send_ack_bit(&gpio, length - i == 1);
       }
-      --length;
-      ++address;
+      dump_bytes(&dump, buffer, count);
+      length -= count;
     }
-    if (address_mod != 0) printf("\n");
-    n = 0;
+    n = fini_dump(&dump);
   } while(0);
   stop(&gpio);
   disable_chip(&gpio);
-  copy_gpio_functions(gpio.functions, &saved_functions);
+  set_gpio_functions(&gpio, &saved_functions);
   fini_gpio(&gpio);
   return n;
 }
@@ -14,30 +14,33 @@
 #define SCL_PIN 3
 #define SDA_PIN 4
 
-static void sleep_ns_impl(unsigned long ns) {
-  struct timespec ts;
-  ts.tv_sec = ns / 1000000000UL;
-  ts.tv_nsec = ns % 1000000000UL;
-  nanosleep(&ts, NULL);
-}
+/** Bus timing, from docs/design/twi.txt. */
+#define SCL_LOW_NS 1300
+#define SCL_HIGH_NS 600
+#define DATA_VALID_NS 900
+#define START_HOLD_NS 8000
+#define STOP_SETUP_NS 4000
+#define BUS_FREE_NS 4700
 
-static void sleep_ns(unsigned long ns) {
-  // sleep_ns_impl(ns * 5000000);
-  // sleep_ns_impl(ns * 100);
-  sleep_ns_impl(ns);
-}
+/** Time to wait after powering up the cartridge. */
+#define POWER_UP_NS 500000000
+/** How long to keep polling for the end of a write. The 24C256 takes
+ *  up to 5 ms. */
+#define WRITE_TIMEOUT_NS 20000000
+
+/** Device address of the EEPROM, for writing. */
+#define DEVICE_WRITE 0xa0
 
 /** Configures the pins and sets chip enable, output enable, and write
  *  enable high (which, for those pins, means "disabled").
  */
 static void configure_pins(gpio_t* gpio) {
-  volatile gpio_functions_t *gfsel = gpio->functions;
   /* Set scl and sda high and vcc low as fast as we can. */
-  set_gpio_pin_function(gfsel, VCC_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, VCC_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_low(gpio, VCC_PIN);
-  set_gpio_pin_function(gfsel, SCL_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, SCL_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, SCL_PIN);
-  set_gpio_pin_function(gfsel, SDA_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, SDA_PIN);
 }
 
@@ -50,69 +53,58 @@ static void enable_chip(gpio_t *gpio) {
   set_gpio_pins_high(gpio, (1 << SCL_PIN) | (1 << SDA_PIN) | (1 << VCC_PIN));
 }
 
-static uint8_t recv_byte(gpio_t *gpio) {
-  int i;
-  uint8_t result = 0;
-  
-  set_gpio_pin_high(gpio, SDA_PIN);
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_INPUT);
-  for (i = 0; i < 8; i++) {
-    result <<= 1;
-    sleep_ns(5000);
-    set_gpio_pin_high(gpio, SCL_PIN);
-    sleep_ns(2500);
-    result |= get_gpio_pin_value(gpio, SDA_PIN);
-    sleep_ns(2500);
-    set_gpio_pin_low(gpio, SCL_PIN);
-  }
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_OUTPUT);
-  return result;
-}
-
+/** Sends a byte and returns the acknowledge bit: 0 if the device
+ *  acknowledged, 1 if not. SCL is low before and after. */
 static int send_byte(gpio_t *gpio, uint8_t value) {
   int i;
   for (i = 0; i < 8; i++) {
     set_gpio_pin_value(gpio, SDA_PIN, (value >> 7));
-    sleep_ns(5000);
+    delay_ns(SCL_LOW_NS);
     set_gpio_pin_high(gpio, SCL_PIN);
-    sleep_ns(5000);
+    delay_ns(SCL_HIGH_NS);
     set_gpio_pin_low(gpio, SCL_PIN);
     value <<= 1;
   }
   set_gpio_pin_high(gpio, SDA_PIN);
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_INPUT);
-  sleep_ns(5000);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_INPUT);
+  delay_ns(SCL_LOW_NS);
   set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(2500);
+  delay_ns(SCL_HIGH_NS);
   i = get_gpio_pin_value(gpio, SDA_PIN);
-  sleep_ns(2500);
   set_gpio_pin_low(gpio, SCL_PIN);
-  sleep_ns(2500);
-  set_gpio_pin_function(gpio->functions, SDA_PIN, GPIO_FUNC_OUTPUT);
-  sleep_ns(2500);
+  /* Give the device time to let go of SDA. */
+  delay_ns(DATA_VALID_NS);
+  configure_gpio_pin(gpio, SDA_PIN, GPIO_FUNC_OUTPUT);
   return i;
 }
 
-static void send_nak(gpio_t *gpio) {
-  set_gpio_pin_high(gpio, SDA_PIN);
-  sleep_ns(5000);
-  set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(5000);
-  set_gpio_pin_low(gpio, SCL_PIN);
-}
-
 static void start(gpio_t *gpio) {
   set_gpio_pin_low(gpio, SDA_PIN);
-  sleep_ns(8000);
+  delay_ns(START_HOLD_NS);
   set_gpio_pin_low(gpio, SCL_PIN);
 }
 
 static void stop(gpio_t *gpio) {
   set_gpio_pins_low(gpio, (1 << SCL_PIN) | (1 << SDA_PIN));
-  sleep_ns(8000);
+  delay_ns(SCL_LOW_NS);
   set_gpio_pin_high(gpio, SCL_PIN);
-  sleep_ns(8000);
+  delay_ns(STOP_SETUP_NS);
   set_gpio_pin_high(gpio, SDA_PIN);
+  delay_ns(BUS_FREE_NS);
+}
+
+/** Waits for the device to finish a write. It does not acknowledge its
+ *  address until it has. Returns 0 when done, 1 on timeout. */
+static int wait_for_write(gpio_t *gpio) {
+  const unsigned long begin = get_time_ns();
+  int n;
+  for (;;) {
+    start(gpio);
+    n = send_byte(gpio, DEVICE_WRITE);
+    stop(gpio);
+    if (!n) return 0;
+    if (get_time_ns() - begin > WRITE_TIMEOUT_NS) return 1;
+  }
 }
 
 int main(int argc, char *argv[]) {
@@ -120,7 +112,9 @@ int main(int argc, char *argv[]) {
   gpio_t gpio;
   gpio_functions_t saved_functions;
   FILE *input;
-  uint32_t address = 0, bytes_to_read, length = ~0;
+  uint32_t address = 0, bytes_to_read, length = ~0, written = 0;
+  unsigned long begin;
+  double seconds;
   /* For 24C32: 32  *
    * For 24C256: 64 */
   const uint32_t page_size = 64;
@@ -139,39 +133,39 @@ int main(int argc, char *argv[]) {
   if (argc > 3) length = atol(argv[3]);
 
   if (init_gpio(&gpio)) return 1;
-  copy_gpio_functions(&saved_functions, gpio.functions);
+  get_gpio_functions(&gpio, &saved_functions);
   configure_pins(&gpio);
   enable_chip(&gpio);
-  sleep_ns(500000000);
+  delay_ns(POWER_UP_NS);
+  begin = get_time_ns();
+  /* Write a page at a time: the device takes the bytes up to the end of
+     the page in one transaction and writes them all at once. */
   for (;;) {
+    bytes_to_read = page_size - (address % page_size);
+    if (bytes_to_read > length) bytes_to_read = length;
+    n = fread(buffer, 1, bytes_to_read, input);
+    if (ferror(input)) {
+      fprintf(stderr, "Error reading input - aborting\n");
+      n = 1;
+      break;
+    }
+    if (n == 0) break;
     start(&gpio);
-    n = send_byte(&gpio, 0xa0);
-    if (n) {
+    if (send_byte(&gpio, DEVICE_WRITE)) {
       fprintf(stderr, "Device did not acknowledge device address\n");
       n = 1;
       break;
     }
-    n = send_byte(&gpio, (address >> 8) & 0xff);
-    if (n) {
+    if (send_byte(&gpio, (address >> 8) & 0xff)) {
       fprintf(stderr, "Device did not acknowledge address byte 0\n");
       n = 1;
       break;
     }
-    n = send_byte(&gpio, address & 0xff);
-    if (n) {
+    if (send_byte(&gpio, address & 0xff)) {
       fprintf(stderr, "Device did not acknowledge address byte 1\n");
       n = 1;
       break;
     }
-    bytes_to_read = page_size - (address % page_size);
-    if (bytes_to_read > length) bytes_to_read = length;
-    n = fread(buffer, 1, bytes_to_read, input);
-    if (ferror(input)) {
-      fprintf(stderr, "Error reading input - aborting\n");
-      n = 1;
-      break;
-    }
-    if (n == 0) break;
     for (i = 0; i < n; i++) {
       if (send_byte(&gpio, buffer[i])) {
         fprintf(stderr, "Device did not acknowledge data\n");
@@ -186,15 +180,10 @@ int main(int argc, char *argv[]) {
     stop(&gpio);
     length -= n;
     address += n;
-    for (i = 0; i < 200; i++) {
-      sleep_ns(5000000);
-      start(&gpio);
-      n = send_byte(&gpio, 0xa1);
-      (void) recv_byte(&gpio);
-      send_nak(&gpio);
-      stop(&gpio);
-      if (!n) break;
-    }
+    written += n;
+    /* Poll until the device acknowledges again, instead of waiting for
+       the longest a write can take. */
+    n = wait_for_write(&gpio);
     if (n) {
       fprintf(stderr, "Device did not acknowledge write\n");
       break;
@@ -202,8 +191,11 @@ int main(int argc, char *argv[]) {
     if (length == 0) break;
   }
   stop(&gpio);
+  seconds = (get_time_ns() - begin) / 1e9;
+  fprintf(stderr, "Wrote %u bytes in %.2f s (%.0f bytes/s)\n",
+          written, seconds, written / seconds);
   disable_chip(&gpio);
-  copy_gpio_functions(gpio.functions, &saved_functions);
+  set_gpio_functions(&gpio, &saved_functions);
   fini_gpio(&gpio);
   return n;
 }
@@ -0,0 +1,121 @@
+#include "dump.h"
+
+/** Size of the buffer for stdout when writing binary output. */
+#define OUTPUT_BUFFER_SIZE 0x10000
+
+/**
+ * Initializes dump for bytes starting at address, printed as hex to
+ * stdout. Call set_dump_binary or set_dump_expected before the first
+ * call to dump_bytes to change that.
+ */
+void init_dump(dump_t *dump, uint32_t address) {
+  dump->out = stdout;
+  dump->binary = false;
+  dump->expected = NULL;
+  dump->address = address;
+  dump->column = 0;
+  dump->differs = false;
+  dump->difference_start = 0;
+  dump->differences = 0;
+  dump->ranges = 0;
+  dump->error = false;
+}
+
+/** Makes dump write the bytes to stdout as they are. */
+void set_dump_binary(dump_t *dump) {
+  static char buffer[OUTPUT_BUFFER_SIZE];
+  dump->binary = true;
+  setvbuf(dump->out, buffer, _IOFBF, sizeof(buffer));
+}
+
+/** Makes dump compare the bytes with the contents of expected instead
+ *  of writing them out. */
+void set_dump_expected(dump_t *dump, FILE *expected) {
+  dump->expected = expected;
+  dump->out = NULL;
+}
+
+static void print_hex(dump_t *dump, const uint8_t *data, size_t size) {
+  size_t i;
+  for (i = 0; i < size; i++) {
+    if (dump->column == 0) {
+      fprintf(dump->out, "%08x:", (unsigned) (dump->address + i));
+    }
+    fprintf(dump->out, " %02x", data[i]);
+    if (++dump->column >= 16) {
+      dump->column = 0;
+      fputc('\n', dump->out);
+    }
+  }
+}
+
+static void end_difference(dump_t *dump, uint32_t end) {
+  fprintf(stderr, "Differs at %08x-%08x (%lu bytes)\n",
+          dump->difference_start, end - 1,
+          (unsigned long) (end - dump->difference_start));
+  dump->differs = false;
+}
+
+static void compare(dump_t *dump, const uint8_t *data, size_t size) {
+  uint8_t expected[4096];
+  size_t i, j, n, got;
+  for (i = 0; i < size; i += n) {
+    n = size - i < sizeof(expected) ? size - i : sizeof(expected);
+    got = fread(expected, 1, n, dump->expected);
+    if (ferror(dump->expected)) dump->error = true;
+    for (j = 0; j < n; j++) {
+      const uint32_t address = dump->address + i + j;
+      /* Bytes past the end of the file count as different. */
+      if (j >= got || data[i + j] != expected[j]) {
+        if (!dump->differs) {
+          dump->differs = true;
+          dump->difference_start = address;
+          ++dump->ranges;
+        }
+        ++dump->differences;
+      } else if (dump->differs) {
+        end_difference(dump, address);
+      }
+    }
+  }
+}
+
+/** Outputs or compares size bytes. */
+void dump_bytes(dump_t *dump, const uint8_t *data, size_t size) {
+  if (dump->expected) {
+    compare(dump, data, size);
+  } else if (dump->binary) {
+    if (fwrite(data, 1, size, dump->out) != size) dump->error = true;
+  } else {
+    print_hex(dump, data, size);
+  }
+  dump->address += size;
+}
+
+/**
+ * Finishes the output. Returns 0 if all went well, or 1 if an error
+ * occurred or the bytes differ from the file, after printing a message.
+ */
+int fini_dump(dump_t *dump) {
+  if (dump->expected) {
+    if (dump->differs) end_difference(dump, dump->address);
+    if (dump->differences) {
+      fprintf(stderr, "%lu bytes differ in %lu ranges\n",
+              dump->differences, dump->ranges);
+    }
+  } else if (!dump->binary && dump->column != 0) {
+    fputc('\n', dump->out);
+  }
+  if (dump->out && fflush(dump->out) != 0) dump->error = true;
+  if (dump->error) fprintf(stderr, "Error reading or writing a file\n");
+  return dump->error || dump->differences ? 1 : 0;
+}
+
+/** Returns the size of f, leaving it at the start, or -1 on error. */
+long get_file_size(FILE *f) {
+  long size;
+  if (fseek(f, 0, SEEK_END) != 0) return -1;
+  size = ftell(f);
+  if (fseek(f, 0, SEEK_SET) != 0) return -1;
+  return size;
+}
@@ -0,0 +1,42 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Output for the tools that read memory chips. The bytes read are
+ * passed to dump_bytes in chunks, which prints them as hex, writes them
+ * as they are, or compares them with the contents of a file.
+ */
+typedef struct {
+  /** Where to write the bytes, or NULL when verifying. */
+  FILE *out;
+  /** Write the bytes as they are instead of as hex. */
+  bool binary;
+  /** File to compare the bytes with, or NULL. */
+  FILE *expected;
+  /** Address of the next byte. */
+  uint32_t address;
+  /** Number of bytes on the current line of hex output. */
+  int column;
+  /** Whether the previous byte differed from the file, and where the
+   *  run of differing bytes it is part of started. */
+  bool differs;
+  uint32_t difference_start;
+  /** Number of differing bytes and runs of them. */
+  unsigned long differences, ranges;
+  /** Set when reading or writing a file failed. */
+  bool error;
+} dump_t;
+
+void init_dump(dump_t *dump, uint32_t address);
+void set_dump_binary(dump_t *dump);
+void set_dump_expected(dump_t *dump, FILE *expected);
+void dump_bytes(dump_t *dump, const uint8_t *data, size_t size);
+int fini_dump(dump_t *dump);
+long get_file_size(FILE *f);
+
+#endif /* ndef DUMP_H */
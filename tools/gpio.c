@@ -1,3 +1,5 @@
+#include "gpio.h"
+
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -34,6 +36,9 @@
 /** Number of pins that can be used as GPIO pins. */
 #define NUM_GPIO_PINS 28
 
+/** Number of nanosleep calls made by calibrate_delay. */
+#define CALIBRATION_SLEEPS 16
+
 /** Super simple debugging implementation. */
 #ifdef NDEBUG
 # define log_debug(FORMAT, ...)
@@ -41,56 +46,6 @@
 # define log_debug(FORMAT, ...) fprintf(stderr, FORMAT, __VA_ARGS__)
 #endif
 
-/** Pin function values. */
-typedef enum {
-  GPIO_FUNC_INPUT = 0,
-  GPIO_FUNC_OUTPUT = 1,
-  GPIO_FUNC_ALT5 = 2,
-  GPIO_FUNC_ALT4 = 3,
-  GPIO_FUNC_ALT0 = 4,
-  GPIO_FUNC_ALT1 = 5,
-  GPIO_FUNC_ALT2 = 6,
-  GPIO_FUNC_ALT3 = 7,
-} gpio_pin_function_t;
-
-/** Function selection settings for the GPIO pins. */
-typedef struct gpio_functions {
-  uint32_t registers[3];
-} gpio_functions_t;
-
-/**
- * Type representing the GPCLR register.
- * We wrap this in a struct to allow the type checker to
- * distinguish it from the GPSET register.
- */
-typedef struct gpio_clear {
-  uint32_t registers[1];
-} gpio_clear_t;
-
-/**
- * Type representing the GPSET register.
- * We wrap this in a struct to allow the type checker to
- * distinguish it from the GPCLR register.
- */
-typedef struct gpio_set {
-  uint32_t registers[1];
-} gpio_set_t;
-
-/**
- * Structure holding all the information we need to work with
- * the GPIO pins. This is used as a convenience so that we don't
- * have to pass the individual values separately when calling
- * the gpio functions.
- */
-typedef struct gpio {
-  int fd;
-  volatile void *map;
-  volatile gpio_functions_t *functions;
-  volatile gpio_clear_t *clear;
-  volatile gpio_set_t *set;
-  volatile uint32_t *levels;
-} gpio_t;
-
 /** Copies GPIO function selection settings from src to dest. */
 void copy_gpio_functions(
      volatile gpio_functions_t *dest,
@@ -108,11 +63,65 @@ gpio_pin_function_t get_gpio_pin_function(gpio_functions_t *gfsel, int pin) {
   return (gfsel->registers[word_offset] >> bit_offset) & 7;
 }
 
+/** Gets the function selection settings of all pins. */
+void get_gpio_functions(gpio_t *gpio, gpio_functions_t *functions) {
+  *functions = gpio->function_cache;
+}
+
+/**
+ * Sets the function selection settings of all pins. Only the registers
+ * that differ from the current settings are written.
+ */
+void set_gpio_functions(gpio_t *gpio, const gpio_functions_t *functions) {
+  int i;
+  for (i = 0; i < 3; i++) {
+    if (functions->registers[i] != gpio->function_cache.registers[i]) {
+      gpio->function_cache.registers[i] = functions->registers[i];
+      gpio->backend->set_function_register(gpio, i, functions->registers[i]);
+    }
+  }
+}
+
+/**
+ * Sets the function of a single pin, leaving the others as they are.
+ * To change several pins, use get_gpio_functions, set_gpio_pin_function
+ * and set_gpio_functions.
+ */
+void configure_gpio_pin(gpio_t *gpio, int pin, gpio_pin_function_t function) {
+  gpio_functions_t functions;
+  get_gpio_functions(gpio, &functions);
+  set_gpio_pin_function(&functions, pin, function);
+  set_gpio_functions(gpio, &functions);
+}
+
+/**
+ * Sets the function of each pin whose bit is set in pins, bit 0 being
+ * GPIO pin 0. Registers are only written if a function changes, so
+ * this is cheap to call when the pins are already configured.
+ */
+void configure_gpio_pins(gpio_t *gpio, uint32_t pins,
+                         gpio_pin_function_t function) {
+  gpio_functions_t functions;
+  int pin;
+  get_gpio_functions(gpio, &functions);
+  for (pin = 0; pins; pin++, pins >>= 1) {
+    if (pins & 1) set_gpio_pin_function(&functions, pin, function);
+  }
+  set_gpio_functions(gpio, &functions);
+}
+
+/**
+ * Returns the levels of all pins, bit 0 being GPIO pin 0.
+ */
+uint32_t get_gpio_levels(gpio_t *gpio) {
+  return gpio->backend->get_levels(gpio);
+}
+
 /**
  * @return 1 when the GPIO pin is high, 0 if low.
  */
 int get_gpio_pin_value(gpio_t *gpio, int pin) {
-  return (*gpio->levels >> pin) & 1;
+  return (get_gpio_levels(gpio) >> pin) & 1;
 }
 
 /**
@@ -121,21 +130,116 @@ int get_gpio_pin_value(gpio_t *gpio, int pin) {
  * can no longer be used for anything other than init_gpio.
  */
 int fini_gpio(gpio_t *gpio) {
+  return gpio->backend->fini(gpio);
+}
+
+/* The Raspberry Pi backend accesses the registers directly. */
+
+static int rpi_fini(gpio_t *gpio) {
   munmap((void*) gpio->map, GPIO_LENGTH);
   close(gpio->fd);
   return 0;
 }
 
+static void rpi_get_functions(gpio_t *gpio, gpio_functions_t *functions) {
+  copy_gpio_functions(functions, gpio->functions);
+}
+
+static void rpi_set_function_register(gpio_t *gpio, int index,
+                                      uint32_t value) {
+  gpio->functions->registers[index] = value;
+}
+
+static void rpi_set_pins(gpio_t *gpio, uint32_t pins) {
+  gpio->set->registers[0] = pins;
+}
+
+static void rpi_clear_pins(gpio_t *gpio, uint32_t pins) {
+  gpio->clear->registers[0] = pins;
+}
+
+static uint32_t rpi_get_levels(gpio_t *gpio) {
+  return *gpio->levels;
+}
+
+static const gpio_backend_t rpi_backend = {
+  "rpi",
+  rpi_fini,
+  rpi_get_functions,
+  rpi_set_function_register,
+  rpi_set_pins,
+  rpi_clear_pins,
+  rpi_get_levels,
+};
+
+/** How much longer than asked nanosleep takes, at most, as measured by
+ * calibrate_delay. */
+static unsigned long sleep_overshoot_ns = 100000;
+
+/** Returns the time in nanoseconds on the clock delay_ns uses. */
+unsigned long get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void sleep_for_ns(unsigned long ns) {
+  struct timespec ts;
+  ts.tv_sec = ns / 1000000000UL;
+  ts.tv_nsec = ns % 1000000000UL;
+  nanosleep(&ts, NULL);
+}
+
+/**
+ * Measures how late nanosleep wakes up, which decides which waits
+ * delay_ns spins for. Called by init_gpio.
+ */
+void calibrate_delay(void) {
+  unsigned long start, overshoot, max = 0;
+  int i;
+  for (i = 0; i < CALIBRATION_SLEEPS; i++) {
+    start = get_time_ns();
+    sleep_for_ns(1000);
+    overshoot = get_time_ns() - start - 1000;
+    if (overshoot > max) max = overshoot;
+  }
+  sleep_overshoot_ns = max;
+  log_debug("nanosleep overshoots by up to %lu ns\n", max);
+}
+
+/**
+ * Waits at least ns nanoseconds. Short waits spin on the clock, because
+ * nanosleep takes tens of microseconds to return even when asked to
+ * wait 100 ns. Longer waits sleep for all but the expected overshoot
+ * and spin for the rest.
+ */
+void delay_ns(unsigned long ns) {
+  const unsigned long start = get_time_ns();
+  if (ns > 2 * sleep_overshoot_ns) sleep_for_ns(ns - sleep_overshoot_ns);
+  while (get_time_ns() - start < ns) continue;
+}
+
 /**
  * Performs the required setup to start using GPIO pins and stores some relevant
  * information in the pointed-to gpio_t struct. This function must be called
  * before any of the other gpio functions can be used. It allocates resources
  * which must be released by calling fini_gpio(). init_gpio() returns 0 when
  * successful, or a nonzero value if an error occurs.
+ * If the GPIO_SIM environment variable is set, the pins are connected
+ * to a simulated chip instead; see init_gpio_sim().
  */
 int init_gpio(gpio_t *gpio) {
   volatile void *gpio_map;
-  int memfd = open("/dev/mem", O_RDWR | O_SYNC);
+  int memfd;
+  const char *sim = getenv("GPIO_SIM");
+
+  calibrate_delay();
+  if (sim) {
+    if (init_gpio_sim(gpio, sim)) return -1;
+    gpio->backend->get_functions(gpio, &gpio->function_cache);
+    return 0;
+  }
+  memfd = open("/dev/mem", O_RDWR | O_SYNC);
   if (memfd == -1) {
     perror("init_gpio: /dev/mem");
     return -1;
@@ -147,6 +251,8 @@ int init_gpio(gpio_t *gpio) {
     return -1;
   }
 
+  gpio->backend = &rpi_backend;
+  gpio->sim = NULL;
   gpio->fd = memfd;
   gpio->map = gpio_map;
   log_debug("GPIO mapped at %p\n", gpio_map);
@@ -155,6 +261,7 @@ int init_gpio(gpio_t *gpio) {
   gpio->clear = (gpio_clear_t*) (gpio_map + GPCLR_BASE);
   gpio->levels = (uint32_t*) (gpio_map + GPLEV_BASE);
   log_debug("GPIO levels at %p\n", gpio->levels);
+  gpio->backend->get_functions(gpio, &gpio->function_cache);
   return 0;
 }
 
@@ -177,7 +284,7 @@ void set_gpio_pin_function(
  * The pin must have been configured as an output pin.
  */
 void set_gpio_pin_high(gpio_t *gpio, int pin) {
-  gpio->set->registers[0] = (1 << pin);
+  gpio->backend->set_pins(gpio, 1 << pin);
 }
 
 /**
@@ -185,7 +292,7 @@ void set_gpio_pin_high(gpio_t *gpio, int pin) {
  * The pin must have been configured as an output pin.
  */
 void set_gpio_pin_low(gpio_t *gpio, int pin) {
-  gpio->clear->registers[0] = (1 << pin);
+  gpio->backend->clear_pins(gpio, 1 << pin);
 }
 
 /**
@@ -206,7 +313,7 @@ void set_gpio_pin_value(gpio_t *gpio, int pin, int value) {
  * pins is 0 are not affected.
  */
 void set_gpio_pins_high(gpio_t *gpio, uint32_t pins) {
-  gpio->set->registers[0] = pins;
+  gpio->backend->set_pins(gpio, pins);
 }
 
 /**
@@ -217,5 +324,5 @@ void set_gpio_pins_high(gpio_t *gpio, uint32_t pins) {
  * pins is 0 are not affected.
  */
 void set_gpio_pins_low(gpio_t *gpio, uint32_t pins) {
-  gpio->clear->registers[0] = pins;
+  gpio->backend->clear_pins(gpio, pins);
 }
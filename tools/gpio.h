@@ -38,6 +38,27 @@ typedef struct gpio_set {
   uint32_t registers[1];
 } gpio_set_t;
 
+struct gpio;
+
+/**
+ * Operations a GPIO backend provides. init_gpio picks the backend:
+ * normally the GPIO registers of the Raspberry Pi, mapped from
+ * /dev/mem, or, if the GPIO_SIM environment variable is set, a
+ * simulated chip (see gpiosim.c), so that the tools can be run and
+ * timed on any machine.
+ */
+typedef struct gpio_backend {
+  const char *name;
+  int (*fini)(struct gpio *gpio);
+  void (*get_functions)(struct gpio *gpio, gpio_functions_t *functions);
+  /* Sets one of the three function select registers. */
+  void (*set_function_register)(struct gpio *gpio, int index,
+                                uint32_t value);
+  void (*set_pins)(struct gpio *gpio, uint32_t pins);
+  void (*clear_pins)(struct gpio *gpio, uint32_t pins);
+  uint32_t (*get_levels)(struct gpio *gpio);
+} gpio_backend_t;
+
 /**
  * Structure holding all the information we need to work with
  * the GPIO pins. This is used as a convenience so that we don't
@@ -45,21 +66,40 @@ typedef struct gpio_set {
  * the gpio functions.
  */
 typedef struct gpio {
+  const gpio_backend_t *backend;
   int fd;
   volatile void *map;
   volatile gpio_functions_t *functions;
   volatile gpio_clear_t *clear;
   volatile gpio_set_t *set;
   volatile uint32_t *levels;
+  /* The function select registers as last written. Only this program
+   * is expected to change them, so they are read once, by init_gpio,
+   * and after that only written when a pin's function changes. This
+   * way, switching the data bus to the direction it already has costs
+   * no register accesses. */
+  gpio_functions_t function_cache;
+  /* State of the simulated backend. */
+  struct gpio_sim *sim;
 } gpio_t;
 
+void calibrate_delay(void);
+void configure_gpio_pin(gpio_t *gpio, int pin, gpio_pin_function_t function);
+void configure_gpio_pins(gpio_t *gpio, uint32_t pins,
+                         gpio_pin_function_t function);
 void copy_gpio_functions(
        volatile gpio_functions_t *dest,
        const volatile gpio_functions_t *src);
+void get_gpio_functions(gpio_t *gpio, gpio_functions_t *functions);
+uint32_t get_gpio_levels(gpio_t *gpio);
 gpio_pin_function_t get_gpio_pin_function(gpio_functions_t *gfsel, int pin);
 int get_gpio_pin_value(gpio_t *gpio, int pin);
+unsigned long get_time_ns(void);
 int fini_gpio(gpio_t *gpio);
 int init_gpio(gpio_t *gpio);
+int init_gpio_sim(gpio_t *gpio, const char *spec);
+void delay_ns(unsigned long ns);
+void set_gpio_functions(gpio_t *gpio, const gpio_functions_t *functions);
 void set_gpio_pin_function(
        volatile gpio_functions_t *gfsel,
        int pin,
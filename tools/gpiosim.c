@@ -0,0 +1,668 @@
+// Simulated GPIO backend. Instead of driving real pins, the tools talk
+// to a model of one of the chips they are used with, wired up the way
+// the tools expect:
+//
+//   flash   SST39SF010A flash ROM (writerom, readmem)
+//   sram    62256 static RAM (writemem, readmem)
+//   eeprom  24C256 TWI EEPROM (writecart, readcart, multicart)
+//
+// The chip is selected by setting GPIO_SIM to its name, optionally
+// followed by a colon and the path of an image file, which is loaded
+// at the start and written back at the end. Several EEPROMs can be
+// connected at once by separating them with spaces; each can be given
+// its own VCC, SCL and SDA pins by following the name with @ and the
+// pin numbers, as in "eeprom@2,3,4:a.img eeprom@5,6,7:b.img". Timing is taken from the
+// real clock and checked against the datasheets: a flash program or
+// erase takes as long as it does on the chip, and when a tool is too
+// quick, for example by reading data before it is valid, the result is
+// garbled the way it could be on real hardware and the violation is
+// counted. A summary is printed to stderr by fini_gpio.
+#include "gpio.h"
+#include "../emulator/eeprom.h"
+#include "../emulator/twi.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Pins of the parallel chips, as used by writerom, writemem and
+// readmem.
+#define CHIP_ENABLE_PIN 0
+#define WRITE_ENABLE_PIN 1
+#define OUTPUT_ENABLE_PIN 27
+#define FIRST_DATA_PIN 2
+#define FIRST_ADDRESS_PIN 10
+#define ADDRESS_BITS 17
+#define DATA_PINS (0xffu << FIRST_DATA_PIN)
+
+// Default pins of a TWI EEPROM, as used by readcart and writecart.
+#define VCC_PIN 2
+#define SCL_PIN 3
+#define SDA_PIN 4
+#define MAX_EEPROMS 8
+
+#define FLASH_SIZE 0x20000
+#define FLASH_SECTOR_SIZE 0x1000
+#define SRAM_SIZE 0x8000
+#define EEPROM_SIZE 0x8000
+#define EEPROM_PAGE_SIZE 64
+
+// Flash software IDs: SST, SST39SF010A.
+#define FLASH_MANUFACTURER_ID 0xbf
+#define FLASH_DEVICE_ID 0xb5
+
+// Timing, in nanoseconds. Access times are for the 70 ns parts.
+#define FLASH_ACCESS_NS 70
+#define FLASH_OE_NS 35
+#define FLASH_WE_PULSE_NS 40
+#define FLASH_DATA_SETUP_NS 40
+#define FLASH_PROGRAM_NS 20000
+#define FLASH_SECTOR_ERASE_NS 25000000
+#define FLASH_CHIP_ERASE_NS 100000000
+#define SRAM_ACCESS_NS 70
+#define SRAM_OE_NS 35
+#define SRAM_WE_PULSE_NS 50
+#define SRAM_DATA_SETUP_NS 30
+// 400 kHz TWI.
+#define TWI_SCL_LOW_NS 1300
+#define TWI_SCL_HIGH_NS 600
+#define EEPROM_WRITE_NS 5000000
+
+typedef enum {
+  SIM_FLASH,
+  SIM_SRAM,
+  SIM_EEPROM,
+} sim_chip_t;
+
+typedef enum {
+  VIOLATION_EARLY_READ,
+  VIOLATION_WE_PULSE,
+  VIOLATION_DATA_SETUP,
+  VIOLATION_FLOATING_DATA,
+  VIOLATION_WRITE_WHILE_BUSY,
+  VIOLATION_CONTENTION,
+  VIOLATION_SCL_LOW,
+  VIOLATION_SCL_HIGH,
+  NUM_VIOLATIONS,
+} sim_violation_t;
+
+static const char *const chip_names[] = { "flash", "sram", "eeprom" };
+
+static const char *const violation_names[NUM_VIOLATIONS] = {
+  "data read before it was valid",
+  "we# pulse too short",
+  "data not set up long enough before we# rose",
+  "write with data pins not driven",
+  "write while the chip was busy",
+  "both sides driving the data bus",
+  "scl low too short",
+  "scl high too short",
+};
+
+// States of the flash command decoder.
+enum {
+  FLASH_READY,
+  FLASH_UNLOCK1,
+  FLASH_UNLOCK2,
+  FLASH_PROGRAM,
+  FLASH_ERASE_UNLOCK0,
+  FLASH_ERASE_UNLOCK1,
+  FLASH_ERASE_UNLOCK2,
+};
+
+// A TWI EEPROM and the pins it is connected to. It is powered while its
+// VCC pin is an output driven high.
+struct sim_eeprom {
+  int vcc_pin, scl_pin, sda_pin;
+  char *path;
+  uint8_t *data;
+  bool powered;
+  hm1k_twi_bus twi;
+  hm1k_eeprom eeprom;
+  int sda_seen;
+  unsigned long scl_time;
+};
+
+struct gpio_sim {
+  sim_chip_t chip;
+  // Image file and contents of a parallel chip.
+  char *path;
+  uint8_t *data;
+  size_t size;
+  gpio_functions_t functions;
+  // Pins set as outputs by functions.
+  uint32_t outputs;
+  // Output register and the levels the chip saw last.
+  uint32_t latch;
+  uint32_t lines;
+  struct timespec start;
+  // Nanoseconds since start, as of the last change.
+  unsigned long now;
+
+  // Parallel chips: when the address, data and enables last changed.
+  unsigned long address_time, data_time, enable_time, we_low_time;
+  uint32_t write_address;
+  bool contention;
+  unsigned int flash_state;
+  bool flash_id_mode;
+  unsigned long busy_until;
+  // DQ7 reads as the complement of this while the flash is busy, and
+  // DQ6 toggles on every falling edge of oe# or ce#.
+  uint8_t busy_data;
+  uint8_t toggle;
+
+  // TWI EEPROMs.
+  struct sim_eeprom eeproms[MAX_EEPROMS];
+  int num_eeproms;
+
+  // Bus cycles, or for the EEPROM, SCL clocks.
+  unsigned long reads, writes, clocks;
+  // Accesses to the function select registers.
+  unsigned long function_accesses;
+  unsigned long violations[NUM_VIOLATIONS];
+};
+
+static unsigned long sim_time(struct gpio_sim *sim) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  sim->now = (ts.tv_sec - sim->start.tv_sec) * 1000000000UL +
+    ts.tv_nsec - sim->start.tv_nsec;
+  return sim->now;
+}
+
+/** Returns the pins set as outputs in functions. */
+static uint32_t output_pins(gpio_functions_t *functions) {
+  uint32_t pins = 0;
+  int i;
+  for (i = 0; i < 30; i++) {
+    if (get_gpio_pin_function(functions, i) == GPIO_FUNC_OUTPUT) {
+      pins |= 1u << i;
+    }
+  }
+  return pins;
+}
+
+/** Levels as driven by the Pi. Pins that are not outputs are pulled
+ * high. */
+static uint32_t host_lines(const struct gpio_sim *sim) {
+  return (sim->latch & sim->outputs) | ~sim->outputs;
+}
+
+static bool line(uint32_t lines, int pin) {
+  return (lines >> pin) & 1;
+}
+
+static void violation(struct gpio_sim *sim, sim_violation_t v) {
+  ++sim->violations[v];
+}
+
+/* Parallel chips. */
+
+static bool chip_outputs(uint32_t lines) {
+  return !line(lines, CHIP_ENABLE_PIN) && !line(lines, OUTPUT_ENABLE_PIN) &&
+    line(lines, WRITE_ENABLE_PIN);
+}
+
+static bool chip_writes(uint32_t lines) {
+  return !line(lines, CHIP_ENABLE_PIN) && !line(lines, WRITE_ENABLE_PIN);
+}
+
+static uint32_t line_address(uint32_t lines) {
+  return (lines >> FIRST_ADDRESS_PIN) & ((1u << ADDRESS_BITS) - 1);
+}
+
+static bool flash_busy(const struct gpio_sim *sim) {
+  return sim->now < sim->busy_until;
+}
+
+static void flash_write(struct gpio_sim *sim, uint32_t address,
+                        uint8_t value) {
+  const uint32_t command = address & 0x7fff;
+  address %= sim->size;
+  if (flash_busy(sim)) {
+    violation(sim, VIOLATION_WRITE_WHILE_BUSY);
+    return;
+  }
+  switch (sim->flash_state) {
+  case FLASH_READY:
+    if (command == 0x5555 && value == 0xaa) {
+      sim->flash_state = FLASH_UNLOCK1;
+    } else if (value == 0xf0) {
+      sim->flash_id_mode = false;
+    }
+    return;
+  case FLASH_UNLOCK1:
+    sim->flash_state = (command == 0x2aaa && value == 0x55) ?
+      FLASH_UNLOCK2 : FLASH_READY;
+    return;
+  case FLASH_UNLOCK2:
+    sim->flash_state = FLASH_READY;
+    if (command != 0x5555) return;
+    if (value == 0xa0) sim->flash_state = FLASH_PROGRAM;
+    if (value == 0x80) sim->flash_state = FLASH_ERASE_UNLOCK0;
+    if (value == 0x90) sim->flash_id_mode = true;
+    if (value == 0xf0) sim->flash_id_mode = false;
+    return;
+  case FLASH_PROGRAM:
+    // Programming can only clear bits.
+    sim->data[address] &= value;
+    sim->busy_data = value;
+    sim->busy_until = sim->now + FLASH_PROGRAM_NS;
+    sim->flash_state = FLASH_READY;
+    return;
+  case FLASH_ERASE_UNLOCK0:
+    sim->flash_state = (command == 0x5555 && value == 0xaa) ?
+      FLASH_ERASE_UNLOCK1 : FLASH_READY;
+    return;
+  case FLASH_ERASE_UNLOCK1:
+    sim->flash_state = (command == 0x2aaa && value == 0x55) ?
+      FLASH_ERASE_UNLOCK2 : FLASH_READY;
+    return;
+  case FLASH_ERASE_UNLOCK2:
+    sim->flash_state = FLASH_READY;
+    if (value == 0x30) {
+      memset(sim->data + (address & ~(FLASH_SECTOR_SIZE - 1)), 0xff,
+             FLASH_SECTOR_SIZE);
+      sim->busy_until = sim->now + FLASH_SECTOR_ERASE_NS;
+    } else if (value == 0x10 && command == 0x5555) {
+      memset(sim->data, 0xff, sim->size);
+      sim->busy_until = sim->now + FLASH_CHIP_ERASE_NS;
+    } else {
+      return;
+    }
+    // Erased bytes read as 1s, so DQ7 reads 0 until done.
+    sim->busy_data = 0xff;
+    return;
+  }
+}
+
+static uint8_t flash_read(struct gpio_sim *sim, uint32_t address) {
+  if (flash_busy(sim)) {
+    return (~sim->busy_data & 0x80) | sim->toggle;
+  }
+  if (sim->flash_id_mode) {
+    return (address & 1) ? FLASH_DEVICE_ID : FLASH_MANUFACTURER_ID;
+  }
+  return sim->data[address % sim->size];
+}
+
+static void parallel_update(struct gpio_sim *sim, uint32_t old,
+                            uint32_t lines) {
+  const bool flash = sim->chip == SIM_FLASH;
+  if (line_address(old) != line_address(lines)) sim->address_time = sim->now;
+  if ((old ^ lines) & DATA_PINS) sim->data_time = sim->now;
+  if (!chip_outputs(old) && chip_outputs(lines)) {
+    sim->enable_time = sim->now;
+    if (flash && flash_busy(sim)) sim->toggle ^= 0x40;
+  }
+  if (chip_outputs(lines) && (sim->outputs & DATA_PINS)) {
+    if (!sim->contention) violation(sim, VIOLATION_CONTENTION);
+    sim->contention = true;
+  } else {
+    sim->contention = false;
+  }
+
+  if (!chip_writes(old) && chip_writes(lines)) {
+    // The address is latched on the falling edge of we# or ce#.
+    sim->we_low_time = sim->now;
+    sim->write_address = line_address(lines);
+  } else if (chip_writes(old) && !chip_writes(lines)) {
+    // The data is latched on the rising edge.
+    uint8_t value = (old >> FIRST_DATA_PIN) & 0xff;
+    if (sim->now - sim->we_low_time <
+        (flash ? FLASH_WE_PULSE_NS : SRAM_WE_PULSE_NS)) {
+      violation(sim, VIOLATION_WE_PULSE);
+    }
+    if (sim->now - sim->data_time <
+        (flash ? FLASH_DATA_SETUP_NS : SRAM_DATA_SETUP_NS)) {
+      violation(sim, VIOLATION_DATA_SETUP);
+    }
+    if ((sim->outputs & DATA_PINS) != DATA_PINS) {
+      violation(sim, VIOLATION_FLOATING_DATA);
+      value = rand();
+    }
+    ++sim->writes;
+    if (flash) {
+      flash_write(sim, sim->write_address, value);
+    } else {
+      sim->data[sim->write_address % sim->size] = value;
+    }
+  }
+}
+
+static uint32_t parallel_levels(struct gpio_sim *sim, uint32_t lines) {
+  const bool flash = sim->chip == SIM_FLASH;
+  const uint32_t address = line_address(lines);
+  uint8_t value;
+  if (!chip_outputs(lines)) return lines;
+  ++sim->reads;
+  value = flash ? flash_read(sim, address) : sim->data[address % sim->size];
+  if (sim->now - sim->address_time <
+      (flash ? FLASH_ACCESS_NS : SRAM_ACCESS_NS) ||
+      sim->now - sim->enable_time < (flash ? FLASH_OE_NS : SRAM_OE_NS)) {
+    violation(sim, VIOLATION_EARLY_READ);
+    value = ~value;
+  }
+  // Pins the Pi drives itself read back its own levels.
+  return (lines & ~DATA_PINS) |
+    (((uint32_t) value << FIRST_DATA_PIN) & ~sim->outputs);
+}
+
+/* TWI EEPROM. */
+
+static void eeprom_update(struct gpio_sim *sim, struct sim_eeprom *e,
+                          uint32_t old, uint32_t lines) {
+  const bool scl = line(lines, e->scl_pin), sda = line(lines, e->sda_pin);
+  const bool was_powered = e->powered;
+  int level;
+  e->powered = line(lines, e->vcc_pin) && (sim->outputs & (1u << e->vcc_pin));
+  if (!e->powered) {
+    e->sda_seen = 1;
+    return;
+  }
+  if (!was_powered) {
+    // Power on: the bus starts idle.
+    e->twi.state = TWI_IDLE;
+    e->twi.lines = (scl ? TWI_LINE_SCL : 0) | (sda ? TWI_LINE_SDA : 0);
+    e->twi.active = NULL;
+    e->scl_time = sim->now;
+    return;
+  }
+  if (line(old, e->scl_pin) != scl) {
+    const unsigned long min = scl ? TWI_SCL_LOW_NS : TWI_SCL_HIGH_NS;
+    if (sim->now - e->scl_time < min) {
+      violation(sim, scl ? VIOLATION_SCL_LOW : VIOLATION_SCL_HIGH);
+    }
+    e->scl_time = sim->now;
+    // The device only changes SDA while SCL is low.
+    if (!scl) e->sda_seen = 1;
+  }
+  level = twi_update(&e->twi, scl, sda);
+  if (level >= 0) {
+    e->sda_seen = level;
+    if (level == 0 && sda &&
+        (sim->outputs & (1u << e->sda_pin))) {
+      violation(sim, VIOLATION_CONTENTION);
+    }
+    ++sim->clocks;
+  }
+}
+
+static uint32_t eeprom_levels(struct gpio_sim *sim, uint32_t lines) {
+  int i;
+  for (i = 0; i < sim->num_eeproms; i++) {
+    const struct sim_eeprom *e = &sim->eeproms[i];
+    if (e->powered && !e->sda_seen) lines &= ~(1u << e->sda_pin);
+  }
+  return lines;
+}
+
+/* Image files. */
+
+/** Loads path, if it exists, into data. */
+static void load_image(const char *path, uint8_t *data, size_t size) {
+  FILE *f = fopen(path, "rb");
+  if (f) {
+    if (fread(data, 1, size, f) == 0 && ferror(f)) perror(path);
+    fclose(f);
+  }
+}
+
+/** Saves data to path, if not NULL. Returns 0 on success. */
+static int save_image(const char *path, const uint8_t *data, size_t size) {
+  FILE *f;
+  if (!path) return 0;
+  f = fopen(path, "wb");
+  if (!f || fwrite(data, 1, size, f) != size || fclose(f) != 0) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+/* Backend operations. */
+
+/** Lets the chip see the current levels of the pins. */
+static void sim_update(gpio_t *gpio) {
+  struct gpio_sim *sim = gpio->sim;
+  const uint32_t old = sim->lines;
+  sim->lines = host_lines(sim);
+  sim_time(sim);
+  if (sim->chip == SIM_EEPROM) {
+    int i;
+    for (i = 0; i < sim->num_eeproms; i++) {
+      eeprom_update(sim, &sim->eeproms[i], old, sim->lines);
+    }
+  } else {
+    parallel_update(sim, old, sim->lines);
+  }
+}
+
+static void sim_get_functions(gpio_t *gpio, gpio_functions_t *functions) {
+  *functions = gpio->sim->functions;
+  gpio->sim->function_accesses += 3;
+}
+
+static void sim_set_function_register(gpio_t *gpio, int index,
+                                      uint32_t value) {
+  struct gpio_sim *sim = gpio->sim;
+  sim->functions.registers[index] = value;
+  sim->outputs = output_pins(&sim->functions);
+  ++sim->function_accesses;
+  sim_update(gpio);
+}
+
+static void sim_set_pins(gpio_t *gpio, uint32_t pins) {
+  gpio->sim->latch |= pins;
+  sim_update(gpio);
+}
+
+static void sim_clear_pins(gpio_t *gpio, uint32_t pins) {
+  gpio->sim->latch &= ~pins;
+  sim_update(gpio);
+}
+
+static uint32_t sim_get_levels(gpio_t *gpio) {
+  struct gpio_sim *sim = gpio->sim;
+  sim_time(sim);
+  if (sim->chip == SIM_EEPROM) return eeprom_levels(sim, sim->lines);
+  return parallel_levels(sim, sim->lines);
+}
+
+static int sim_fini(gpio_t *gpio) {
+  struct gpio_sim *sim = gpio->sim;
+  unsigned long total = 0;
+  int i, result = 0;
+
+  sim_time(sim);
+  for (i = 0; i < NUM_VIOLATIONS; i++) total += sim->violations[i];
+  if (sim->chip == SIM_EEPROM) {
+    fprintf(stderr, "gpio sim: %d x %s, %lu clocks", sim->num_eeproms,
+            chip_names[sim->chip], sim->clocks);
+  } else {
+    fprintf(stderr, "gpio sim: %s, %lu reads, %lu writes", chip_names[sim->chip],
+            sim->reads, sim->writes);
+  }
+  fprintf(stderr, " in %.3f s, %lu function select accesses,"
+          " %lu timing violations\n", sim->now / 1e9,
+          sim->function_accesses, total);
+  for (i = 0; i < NUM_VIOLATIONS; i++) {
+    if (sim->violations[i]) {
+      fprintf(stderr, "gpio sim: %lu x %s\n", sim->violations[i],
+              violation_names[i]);
+    }
+  }
+
+  if (save_image(sim->path, sim->data, sim->size)) result = -1;
+  free(sim->path);
+  free(sim->data);
+  for (i = 0; i < sim->num_eeproms; i++) {
+    struct sim_eeprom *e = &sim->eeproms[i];
+    if (save_image(e->path, e->data, EEPROM_SIZE)) result = -1;
+    free(e->path);
+    free(e->data);
+  }
+  free(sim);
+  gpio->sim = NULL;
+  return result;
+}
+
+static const gpio_backend_t sim_backend = {
+  "sim",
+  sim_fini,
+  sim_get_functions,
+  sim_set_function_register,
+  sim_set_pins,
+  sim_clear_pins,
+  sim_get_levels,
+};
+
+/**
+ * Parses one chip of a GPIO_SIM spec, which is length characters at
+ * spec: the name, optionally @ and three pin numbers, and optionally :
+ * and an image path. Returns the chip type, or -1 if not valid.
+ */
+static int parse_chip(const char *spec, size_t length, int pins[3],
+                      char **path) {
+  char *copy = strndup(spec, length), *colon, *at;
+  int chip = -1, i, n = 0;
+
+  *path = NULL;
+  if (!copy) return -1;
+  colon = strchr(copy, ':');
+  if (colon) {
+    *colon = 0;
+    *path = strdup(colon + 1);
+  }
+  pins[0] = VCC_PIN;
+  pins[1] = SCL_PIN;
+  pins[2] = SDA_PIN;
+  at = strchr(copy, '@');
+  if (at) {
+    *at = 0;
+    if (sscanf(at + 1, "%d,%d,%d%n", &pins[0], &pins[1], &pins[2], &n) != 3 ||
+        at[1 + n] != 0) {
+      goto done;
+    }
+    for (i = 0; i < 3; i++) {
+      if (pins[i] < 0 || pins[i] >= 28) goto done;
+    }
+  }
+  for (i = 0; i < 3; i++) {
+    if (strcmp(copy, chip_names[i]) == 0) chip = i;
+  }
+  // Only EEPROMs can be moved to other pins.
+  if (at && chip != SIM_EEPROM) chip = -1;
+
+ done:
+  free(copy);
+  if (chip < 0) {
+    free(*path);
+    *path = NULL;
+  }
+  return chip;
+}
+
+/**
+ * Connects gpio to a simulated chip. spec is the chip name, optionally
+ * followed by ':' and the path of an image file. For EEPROMs, spec can
+ * list several chips, separated by spaces, and the name can be followed
+ * by '@' and the VCC, SCL and SDA pins, separated by commas. Returns 0
+ * on success.
+ */
+int init_gpio_sim(gpio_t *gpio, const char *spec) {
+  struct gpio_sim *sim = calloc(1, sizeof(*sim));
+  const char *p = spec;
+  size_t length;
+  int pins[3], chip, kind = -1;
+  char *path;
+
+  if (!sim) {
+    perror("init_gpio_sim");
+    return -1;
+  }
+  for (;;) {
+    p += strspn(p, " ");
+    if (!*p) break;
+    length = strcspn(p, " ");
+    chip = parse_chip(p, length, pins, &path);
+    if (chip < 0 || (kind >= 0 && (chip != SIM_EEPROM || kind != SIM_EEPROM)) ||
+        sim->num_eeproms == MAX_EEPROMS) {
+      fprintf(stderr, "GPIO_SIM: cannot use \"%.*s\" in \"%s\";"
+              " use flash, sram, or eeprom, optionally followed by"
+              " :imagefile, or up to %d eeproms, each optionally"
+              " followed by @vcc,scl,sda\n", (int) length, p, spec,
+              MAX_EEPROMS);
+      free(path);
+      goto error;
+    }
+    sim->chip = kind = chip;
+    p += length;
+    if (chip == SIM_EEPROM) {
+      struct sim_eeprom *e = &sim->eeproms[sim->num_eeproms++];
+      e->vcc_pin = pins[0];
+      e->scl_pin = pins[1];
+      e->sda_pin = pins[2];
+      e->path = path;
+      e->data = malloc(EEPROM_SIZE);
+      if (!e->data) {
+        perror("init_gpio_sim");
+        goto error;
+      }
+      // EEPROMs come erased.
+      memset(e->data, 0xff, EEPROM_SIZE);
+      if (path) load_image(path, e->data, EEPROM_SIZE);
+      e->sda_seen = 1;
+      init_twi(&e->twi);
+      init_eeprom(&e->eeprom, e->data, EEPROM_SIZE, EEPROM_PAGE_SIZE);
+      set_eeprom_timing(&e->eeprom, &sim->now, EEPROM_WRITE_NS);
+      attach_twi_device(&e->twi, &e->eeprom.dev);
+    } else {
+      sim->path = path;
+      sim->size = chip == SIM_FLASH ? FLASH_SIZE : SRAM_SIZE;
+      sim->data = malloc(sim->size);
+      if (!sim->data) {
+        perror("init_gpio_sim");
+        goto error;
+      }
+      // Flash comes erased. RAM holds whatever it holds.
+      if (chip == SIM_SRAM) {
+        size_t i;
+        for (i = 0; i < sim->size; i++) sim->data[i] = rand();
+      } else {
+        memset(sim->data, 0xff, sim->size);
+      }
+      if (path) load_image(path, sim->data, sim->size);
+    }
+  }
+  if (kind < 0) {
+    fprintf(stderr, "GPIO_SIM: no chip given\n");
+    goto error;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &sim->start);
+  sim->lines = host_lines(sim);
+
+  gpio->backend = &sim_backend;
+  gpio->sim = sim;
+  gpio->fd = -1;
+  gpio->map = NULL;
+  gpio->functions = NULL;
+  gpio->clear = NULL;
+  gpio->set = NULL;
+  gpio->levels = NULL;
+  return 0;
+
+ error:
+  free(sim->path);
+  free(sim->data);
+  for (chip = 0; chip < sim->num_eeproms; chip++) {
+    free(sim->eeproms[chip].path);
+    free(sim->eeproms[chip].data);
+  }
+  free(sim);
+  return -1;
+}
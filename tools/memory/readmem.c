@@ -1,4 +1,5 @@
-// Usage: readmem [start_address [length]]
+// Usage: readmem [-a] [-b] [-v file] [start_address [length]]
+#include "../dump.h"
 #include "../gpio.h"
 
 #include <errno.h>
@@ -45,6 +46,11 @@
 #define FIRST_DATA_PIN 2
 #define FIRST_ADDRESS_PIN 10
 
+/** Size of the address space. */
+#define CHIP_SIZE 0x20000
+/** Number of bytes read before passing them on. */
+#define CHUNK_SIZE 4096
+
 /** Minimum time between setting address and pulling we# low. */
 #define ADDRESS_SETUP_NS 100
 #define READ_DELAY_NS 300
@@ -56,27 +62,8 @@
 
 #define log_debug(FORMAT, ...) fprintf(stderr, FORMAT, __VA_ARGS__)
 
-static void sleep_ns_impl(unsigned long ns) {
-  struct timespec ts;
-  ts.tv_sec = ns / 1000000000UL;
-  ts.tv_nsec = ns % 1000000000UL;
-  nanosleep(&ts, NULL);
-}
-
-static void sleep_ns(unsigned long ns) {
-  // sleep_ns_impl(ns * 5000000);
-  sleep_ns_impl(ns);
-}
-
 static void configure_data_pins_for_input(gpio_t *gpio) {
-  int i;
-  gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
-  copy_gpio_functions(&functions, gfsel);
-  for (i = FIRST_DATA_PIN; i < FIRST_DATA_PIN + 8; i++) {
-    set_gpio_pin_function(&functions, i, GPIO_FUNC_INPUT);
-  }
-  copy_gpio_functions(gfsel, &functions);
+  configure_gpio_pins(gpio, 0xff << FIRST_DATA_PIN, GPIO_FUNC_INPUT);
 }
 
 /** Configures the pins and sets chip enable, output enable, and write
@@ -85,21 +72,20 @@ static void configure_data_pins_for_input(gpio_t *gpio) {
 static void configure_pins(gpio_t* gpio) {
   int i;
   gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
   /* Set ce#, we#, and oe# as fast as we can. */
-  set_gpio_pin_function(gfsel, CHIP_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, CHIP_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, CHIP_ENABLE_PIN);
-  set_gpio_pin_function(gfsel, WRITE_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, WRITE_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, WRITE_ENABLE_PIN);
-  set_gpio_pin_function(gfsel, OUTPUT_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, OUTPUT_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, OUTPUT_ENABLE_PIN);
 
   configure_data_pins_for_input(gpio);
-  copy_gpio_functions(&functions, gfsel);
+  get_gpio_functions(gpio, &functions);
   for (i = FIRST_ADDRESS_PIN; i < FIRST_ADDRESS_PIN + 17; i++) {
     set_gpio_pin_function(&functions, i, GPIO_FUNC_OUTPUT);
   }
-  copy_gpio_functions(gfsel, &functions);
+  set_gpio_functions(gpio, &functions);
 }
 
 static void disable_chip(gpio_t *gpio) {
@@ -118,45 +104,105 @@ static void set_address(gpio_t *gpio, uint32_t address) {
   set_gpio_pins_high(gpio, (address & 0x1ffff) << FIRST_ADDRESS_PIN);
 }
 
-static uint8_t read_byte(gpio_t *gpio, uint32_t address) {
+/** Reads size bytes starting at start_address. The chip stays enabled
+ *  for the whole range, so that only the address changes per byte. */
+static void read_bytes(gpio_t *gpio, uint32_t start_address, uint8_t *buffer, size_t size) {
+  uint32_t address = start_address;
+  size_t i;
   configure_data_pins_for_input(gpio);
   /* ce# low, ce2 high, oe# low, we# high */
   set_gpio_pins_high(gpio, (1 << WRITE_ENABLE_PIN));
   set_gpio_pins_low(gpio, (1 << CHIP_ENABLE_PIN) | (1 << OUTPUT_ENABLE_PIN));
-  set_address(gpio, address);
-  sleep_ns(READ_DELAY_NS);
-  return (uint8_t) ((*gpio->levels >> FIRST_DATA_PIN) & 0xff);
+  for (i = 0; i < size; i++) {
+    set_address(gpio, address++);
+    delay_ns(READ_DELAY_NS);
+    buffer[i] = (uint8_t) ((get_gpio_levels(gpio) >> FIRST_DATA_PIN) & 0xff);
+  }
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-a] [-b] [-v file] [start_address [length]]\n"
+          "  -a       read the whole chip\n"
+          "  -b       write the bytes as they are instead of as hex\n"
+          "  -v file  compare with file instead of writing the bytes\n",
+          argv0);
+  exit(1);
 }
 
 int main(int argc, char *argv[]) {
-  uint32_t address, address_mod = 0;
-  uint32_t start_address = 0, length = 0x200;
-  uint32_t end_address;
+  uint32_t address, start_address = 0, length = 0x200, n;
   gpio_t gpio;
   gpio_functions_t saved_functions;
+  dump_t dump;
+  bool whole_chip = false, binary = false;
+  const char *expected_path = NULL;
+  FILE *expected = NULL;
+  uint8_t buffer[CHUNK_SIZE];
+  long size;
+  int opt, result;
+
+  while ((opt = getopt(argc, argv, "abv:")) != -1) {
+    switch (opt) {
+    case 'a':
+      whole_chip = true;
+      break;
+    case 'b':
+      binary = true;
+      break;
+    case 'v':
+      expected_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (expected_path) {
+    expected = fopen(expected_path, "rb");
+    if (!expected) {
+      perror(expected_path);
+      return 1;
+    }
+    /* By default, compare the whole file. */
+    size = get_file_size(expected);
+    if (size < 0) {
+      perror(expected_path);
+      return 1;
+    }
+    length = size;
+  }
+  if (optind < argc) start_address = atol(argv[optind]);
+  if (optind + 1 < argc) length = atol(argv[optind + 1]);
+  if (optind + 2 < argc) usage(argv[0]);
+  if (whole_chip) {
+    start_address = 0;
+    length = CHIP_SIZE;
+  }
+  if (start_address >= CHIP_SIZE || length > CHIP_SIZE - start_address) {
+    fprintf(stderr, "range does not fit in the chip (%u bytes)\n",
+            CHIP_SIZE);
+    return 1;
+  }
 
-  if (argc > 1) start_address = atol(argv[1]);
-  if (argc > 2) length = atol(argv[2]);
-  end_address = start_address + length - 1;
-  
   if (init_gpio(&gpio)) return 1;
-  copy_gpio_functions(&saved_functions, gpio.functions);
+  get_gpio_functions(&gpio, &saved_functions);
   configure_pins(&gpio);
   enable_chip(&gpio);
 
-  for (address = start_address; address <= end_address; address++) {
-    if (address_mod == 0) printf("%08x:", address);
-    printf(" %02x", read_byte(&gpio, address));
-    address_mod++;
-    if (address_mod >= 16) {
-      address_mod = 0;
-      printf("\n");
-    }
+  init_dump(&dump, start_address);
+  if (binary) set_dump_binary(&dump);
+  if (expected) set_dump_expected(&dump, expected);
+  for (address = start_address; address < start_address + length;
+       address += n) {
+    n = start_address + length - address;
+    if (n > CHUNK_SIZE) n = CHUNK_SIZE;
+    read_bytes(&gpio, address, buffer, n);
+    dump_bytes(&dump, buffer, n);
   }
-  if (address_mod != 0) printf("\n");
+  result = fini_dump(&dump);
 
   disable_chip(&gpio);
-  copy_gpio_functions(gpio.functions, &saved_functions);
+  set_gpio_functions(&gpio, &saved_functions);
   fini_gpio(&gpio);
-  return 0;
+  return result;
 }
@@ -55,38 +55,12 @@
 
 #define log_debug(FORMAT, ...) fprintf(stderr, FORMAT, __VA_ARGS__)
 
-static void sleep_ns_impl(unsigned long ns) {
-  struct timespec ts;
-  ts.tv_sec = ns / 1000000000UL;
-  ts.tv_nsec = ns % 1000000000UL;
-  nanosleep(&ts, NULL);
-}
-
-static void sleep_ns(unsigned long ns) {
-  // sleep_ns_impl(ns * 5000000);
-  sleep_ns_impl(ns);
-}
-
 static void configure_data_pins_for_input(gpio_t *gpio) {
-  int i;
-  gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
-  copy_gpio_functions(&functions, gfsel);
-  for (i = FIRST_DATA_PIN; i < FIRST_DATA_PIN + 8; i++) {
-    set_gpio_pin_function(&functions, i, GPIO_FUNC_INPUT);
-  }
-  copy_gpio_functions(gfsel, &functions);
+  configure_gpio_pins(gpio, 0xff << FIRST_DATA_PIN, GPIO_FUNC_INPUT);
 }
 
 static void configure_data_pins_for_output(gpio_t *gpio) {
-  int i;
-  gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
-  copy_gpio_functions(&functions, gfsel);
-  for (i = FIRST_DATA_PIN; i < FIRST_DATA_PIN + 8; i++) {
-    set_gpio_pin_function(&functions, i, GPIO_FUNC_OUTPUT);
-  }
-  copy_gpio_functions(gfsel, &functions);
+  configure_gpio_pins(gpio, 0xff << FIRST_DATA_PIN, GPIO_FUNC_OUTPUT);
 }
 
 /** Configures the pins and sets chip enable, output enable, and write
@@ -95,21 +69,20 @@ static void configure_data_pins_for_output(gpio_t *gpio) {
 static void configure_pins(gpio_t* gpio) {
   int i;
   gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
   /* Set ce#, we#, and oe# as fast as we can. */
-  set_gpio_pin_function(gfsel, CHIP_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, CHIP_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, CHIP_ENABLE_PIN);
-  set_gpio_pin_function(gfsel, WRITE_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, WRITE_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, WRITE_ENABLE_PIN);
-  set_gpio_pin_function(gfsel, OUTPUT_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, OUTPUT_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, OUTPUT_ENABLE_PIN);
 
   configure_data_pins_for_input(gpio);
-  copy_gpio_functions(&functions, gfsel);
+  get_gpio_functions(gpio, &functions);
   for (i = FIRST_ADDRESS_PIN; i < FIRST_ADDRESS_PIN + 17; i++) {
     set_gpio_pin_function(&functions, i, GPIO_FUNC_OUTPUT);
   }
-  copy_gpio_functions(gfsel, &functions);
+  set_gpio_functions(gpio, &functions);
 }
 
 static void disable_chip(gpio_t *gpio) {
@@ -139,8 +112,8 @@ static uint8_t read_byte(gpio_t *gpio, uint32_t address) {
   set_gpio_pins_high(gpio, (1 << WRITE_ENABLE_PIN));
   set_gpio_pins_low(gpio, (1 << CHIP_ENABLE_PIN) | (1 << OUTPUT_ENABLE_PIN));
   set_address(gpio, address);
-  sleep_ns(READ_DELAY_NS);
-  return (uint8_t) ((*gpio->levels >> FIRST_DATA_PIN) & 0xff);
+  delay_ns(READ_DELAY_NS);
+  return (uint8_t) ((get_gpio_levels(gpio) >> FIRST_DATA_PIN) & 0xff);
 }
 
 static void write_byte(gpio_t *gpio, uint32_t address, uint8_t value) {
@@ -149,18 +122,18 @@ static void write_byte(gpio_t *gpio, uint32_t address, uint8_t value) {
   set_gpio_pins_high(gpio, (1 << CHIP_ENABLE_PIN) | (1 << WRITE_ENABLE_PIN) | (1 << OUTPUT_ENABLE_PIN));
   set_address(gpio, address);
   set_gpio_pin_low(gpio, CHIP_ENABLE_PIN);
-  sleep_ns(ADDRESS_SETUP_NS);
+  delay_ns(ADDRESS_SETUP_NS);
   /* pull we# low, this latches the address. */
   set_gpio_pin_low(gpio, WRITE_ENABLE_PIN);
-  sleep_ns(WRITE_ENABLE_TO_DATA_DELAY_NS);
+  delay_ns(WRITE_ENABLE_TO_DATA_DELAY_NS);
   configure_data_pins_for_output(gpio);
   set_data(gpio, value);
-  sleep_ns(WRITE_ENABLE_PULSE_NS);
+  delay_ns(WRITE_ENABLE_PULSE_NS);
   /* pull we# high, this latches the data and performs the write. */
   set_gpio_pin_high(gpio, WRITE_ENABLE_PIN);
   /* wait for the write to complete before returning. */
-  sleep_ns(WRITE_DELAY_NS);
-  configure_data_pins_for_input(gpio);
+  delay_ns(WRITE_DELAY_NS);
+  /* The data pins stay outputs until the next read. */
 }
 
 int main(int argc, char *argv[]) {
@@ -171,7 +144,7 @@ int main(int argc, char *argv[]) {
   gpio_functions_t saved_functions;
 
   if (init_gpio(&gpio)) return 1;
-  copy_gpio_functions(&saved_functions, gpio.functions);
+  get_gpio_functions(&gpio, &saved_functions);
   configure_pins(&gpio);
   enable_chip(&gpio);
 
@@ -191,7 +164,7 @@ int main(int argc, char *argv[]) {
   if (address_mod != 0) printf("\n");
 
   disable_chip(&gpio);
-  copy_gpio_functions(gpio.functions, &saved_functions);
+  set_gpio_functions(&gpio, &saved_functions);
   fini_gpio(&gpio);
   return 0;
 }
@@ -1,4 +1,4 @@
-// Usage: writerom [file [start_address [length]]]
+// Usage: writerom [-n] [file [start_address [length]]]
 #include "../gpio.h"
 
 #include <errno.h>
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
@@ -50,14 +51,27 @@
 #define SECTOR_SIZE 4096
 #define SECTOR_MASK ~(SECTOR_SIZE - 1)
 
-/** Value that indicates two sectors contain the same bytes. */
-#define SECTORS_EQUAL ~0
+/** Size of the chip. */
+#define CHIP_SIZE 0x20000
+
+/** How many times to write and verify before giving up. */
+#define MAX_ATTEMPTS 3
 
 /** Minimum time between setting address and pulling we# low. */
 #define ADDRESS_SETUP_NS 100
-#define ERASE_SECTOR_NS 50000000
 #define READ_DELAY_NS 300
-#define WRITE_DELAY_NS 50000
+/** How long to wait for a byte to be programmed (20 us at most according
+ *  to the datasheet) or a sector to be erased (25 ms) before giving up. */
+#define PROGRAM_TIMEOUT_NS 1000000
+#define ERASE_TIMEOUT_NS 250000000
+/** Bit 6 of the data read while the chip is busy, which toggles on each
+ *  read. */
+#define TOGGLE_BIT 0x40
+/** Rough times for a byte program (including the bus cycles), a sector
+ *  erase and a read, used to estimate how long a plan will take. */
+#define PROGRAM_ESTIMATE_NS 30000
+#define ERASE_ESTIMATE_NS 25000000
+#define READ_ESTIMATE_NS 1000
 /** Minimum time to keep we# low after setting data bits. */
 #define WRITE_ENABLE_PULSE_NS 100
 /** Minimum time between pulling we# low and setting data bits. */
@@ -65,51 +79,30 @@
 
 #define log_debug(FORMAT, ...) fprintf(stderr, FORMAT, __VA_ARGS__)
 
-static void sleep_ns_impl(unsigned long ns) {
-  struct timespec ts;
-  ts.tv_sec = ns / 1000000000UL;
-  ts.tv_nsec = ns % 1000000000UL;
-  nanosleep(&ts, NULL);
-}
-
-static void sleep_ns(unsigned long ns) {
-  // sleep_ns_impl(ns * 5000000);
-  // sleep_ns_impl(ns * 100);
-  sleep_ns_impl(ns);
-}
-
-/** Compares the first size bytes of two sectors.
- *  Returns the index of the first byte that differs, or
- *  SECTORS_EQUAL if the contents of the sectors is the same.
- */
-static size_t compare_sectors(const uint8_t *a, const uint8_t *b, size_t size, size_t start) {
-  size_t i;
-  for (i = start; i < size; i++) {
-    if (a[i] != b[i]) return i;
-  }
-  return SECTORS_EQUAL;
-}
+/** What to do with a sector. */
+typedef enum {
+  /** The sector already has the right contents. */
+  SECTOR_SKIP,
+  /** Only bits need to be cleared: program the bytes that differ. */
+  SECTOR_PATCH,
+  /** Erase the sector, then program the bytes that are not 0xff. */
+  SECTOR_ERASE,
+} sector_action_t;
+
+typedef struct {
+  sector_action_t action;
+  uint32_t address;
+  size_t size;
+  /** Number of bytes to program. */
+  size_t writes;
+} sector_plan_t;
 
 static void configure_data_pins_for_input(gpio_t *gpio) {
-  int i;
-  gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
-  copy_gpio_functions(&functions, gfsel);
-  for (i = FIRST_DATA_PIN; i < FIRST_DATA_PIN + 8; i++) {
-    set_gpio_pin_function(&functions, i, GPIO_FUNC_INPUT);
-  }
-  copy_gpio_functions(gfsel, &functions);
+  configure_gpio_pins(gpio, 0xff << FIRST_DATA_PIN, GPIO_FUNC_INPUT);
 }
 
 static void configure_data_pins_for_output(gpio_t *gpio) {
-  int i;
-  gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
-  copy_gpio_functions(&functions, gfsel);
-  for (i = FIRST_DATA_PIN; i < FIRST_DATA_PIN + 8; i++) {
-    set_gpio_pin_function(&functions, i, GPIO_FUNC_OUTPUT);
-  }
-  copy_gpio_functions(gfsel, &functions);
+  configure_gpio_pins(gpio, 0xff << FIRST_DATA_PIN, GPIO_FUNC_OUTPUT);
 }
 
 /** Configures the pins and sets chip enable, output enable, and write
@@ -118,21 +111,20 @@ static void configure_data_pins_for_output(gpio_t *gpio) {
 static void configure_pins(gpio_t* gpio) {
   int i;
   gpio_functions_t functions;
-  volatile gpio_functions_t *gfsel = gpio->functions;
   /* Set ce#, we#, and oe# as fast as we can. */
-  set_gpio_pin_function(gfsel, CHIP_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, CHIP_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, CHIP_ENABLE_PIN);
-  set_gpio_pin_function(gfsel, WRITE_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, WRITE_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, WRITE_ENABLE_PIN);
-  set_gpio_pin_function(gfsel, OUTPUT_ENABLE_PIN, GPIO_FUNC_OUTPUT);
+  configure_gpio_pin(gpio, OUTPUT_ENABLE_PIN, GPIO_FUNC_OUTPUT);
   set_gpio_pin_high(gpio, OUTPUT_ENABLE_PIN);
 
   configure_data_pins_for_input(gpio);
-  copy_gpio_functions(&functions, gfsel);
+  get_gpio_functions(gpio, &functions);
   for (i = FIRST_ADDRESS_PIN; i < FIRST_ADDRESS_PIN + 17; i++) {
     set_gpio_pin_function(&functions, i, GPIO_FUNC_OUTPUT);
   }
-  copy_gpio_functions(gfsel, &functions);
+  set_gpio_functions(gpio, &functions);
 }
 
 static void disable_chip(gpio_t *gpio) {
@@ -173,15 +165,22 @@ static uint8_t read_byte(gpio_t *gpio, uint32_t address) {
   set_gpio_pins_high(gpio, (1 << WRITE_ENABLE_PIN));
   set_gpio_pins_low(gpio, (1 << CHIP_ENABLE_PIN) | (1 << OUTPUT_ENABLE_PIN));
   set_address(gpio, address);
-  sleep_ns(READ_DELAY_NS);
-  return (uint8_t) ((*gpio->levels >> FIRST_DATA_PIN) & 0xff);
+  delay_ns(READ_DELAY_NS);
+  return (uint8_t) ((get_gpio_levels(gpio) >> FIRST_DATA_PIN) & 0xff);
 }
 
+/** Reads size bytes starting at start_address. The chip stays enabled
+ *  for the whole range, so that only the address changes per byte. */
 static void read_bytes(gpio_t *gpio, uint32_t start_address, uint8_t *buffer, size_t size) {
   uint32_t address = start_address;
   size_t i;
+  configure_data_pins_for_input(gpio);
+  set_gpio_pins_high(gpio, (1 << WRITE_ENABLE_PIN));
+  set_gpio_pins_low(gpio, (1 << CHIP_ENABLE_PIN) | (1 << OUTPUT_ENABLE_PIN));
   for (i = 0; i < size; i++) {
-    buffer[i] = read_byte(gpio, address++);
+    set_address(gpio, address++);
+    delay_ns(READ_DELAY_NS);
+    buffer[i] = (uint8_t) ((get_gpio_levels(gpio) >> FIRST_DATA_PIN) & 0xff);
   }
 }
 
@@ -192,18 +191,47 @@ static void write_byte_aux(gpio_t *gpio, uint32_t address, uint8_t value) {
   set_address(gpio, address);
   configure_data_pins_for_output(gpio);
   set_gpio_pin_low(gpio, CHIP_ENABLE_PIN);
-  sleep_ns(ADDRESS_SETUP_NS);
+  delay_ns(ADDRESS_SETUP_NS);
   /* pull we# low, this latches the address. */
   set_gpio_pin_low(gpio, WRITE_ENABLE_PIN);
-  configure_data_pins_for_output(gpio);
   set_data(gpio, value);
-  sleep_ns(WRITE_ENABLE_TO_DATA_DELAY_NS);
-  sleep_ns(WRITE_ENABLE_PULSE_NS);
+  delay_ns(WRITE_ENABLE_TO_DATA_DELAY_NS);
+  delay_ns(WRITE_ENABLE_PULSE_NS);
   /* pull we# high, this latches the data and performs the write. */
   set_gpio_pin_high(gpio, WRITE_ENABLE_PIN);
-  /* wait for the write to complete before returning. */
-  sleep_ns(WRITE_DELAY_NS);
-  configure_data_pins_for_input(gpio);
+  /* The data pins stay outputs until the next read, so that command
+     sequences do not turn the bus around between writes. */
+}
+
+/** Reads the byte at address in a read cycle of its own, which the
+ *  chip counts as a new read for the toggle bit. */
+static uint8_t read_status(gpio_t *gpio, uint32_t address) {
+  set_gpio_pin_high(gpio, OUTPUT_ENABLE_PIN);
+  return read_byte(gpio, address);
+}
+
+/** Waits for a program or erase operation to finish. While the chip is
+ *  busy, DQ6 toggles on every read; when two reads in a row agree, it is
+ *  done. Returns false if that takes more than timeout_ns.
+ */
+static bool wait_for_chip(gpio_t *gpio, uint32_t address,
+                          unsigned long timeout_ns) {
+  const unsigned long start = get_time_ns();
+  uint8_t previous = read_status(gpio, address), status;
+  bool late, previous_late = false;
+  for (;;) {
+    late = get_time_ns() - start > timeout_ns;
+    status = read_status(gpio, address);
+    if (!((status ^ previous) & TOGGLE_BIT)) return true;
+    /* Only give up when both reads were made after the timeout, in case
+       we were not running for a while. */
+    if (late && previous_late) {
+      fprintf(stderr, "Timed out waiting at address %08x\n", address);
+      return false;
+    }
+    previous = status;
+    previous_late = late;
+  }
 }
 
 static void write_byte(gpio_t *gpio, uint32_t address, uint8_t value) {
@@ -211,14 +239,7 @@ static void write_byte(gpio_t *gpio, uint32_t address, uint8_t value) {
   write_byte_aux(gpio, 0x2aaa, 0x55);
   write_byte_aux(gpio, 0x5555, 0xa0);
   write_byte_aux(gpio, address, value);
-}
-
-static void write_bytes(gpio_t *gpio, uint32_t start_address, uint8_t *data, size_t size) {
-  uint32_t address = start_address;
-  size_t i;
-  for (i = 0; i < size; i++) {
-    write_byte(gpio, address++, data[i]);
-  }
+  wait_for_chip(gpio, address, PROGRAM_TIMEOUT_NS);
 }
 
 static void erase_sector(gpio_t *gpio, uint32_t address) {
@@ -229,19 +250,125 @@ static void erase_sector(gpio_t *gpio, uint32_t address) {
   write_byte_aux(gpio, 0x5555, 0xaa);
   write_byte_aux(gpio, 0x2aaa, 0x55);
   write_byte_aux(gpio, address, 0x30);
-  sleep_ns(ERASE_SECTOR_NS);
+  wait_for_chip(gpio, address, ERASE_TIMEOUT_NS);
+}
+
+/** Returns true if the byte at index i of a sector needs to be
+ *  programmed to carry out plan. */
+static bool needs_write(const sector_plan_t *plan, const uint8_t *chip,
+                        const uint8_t *image, size_t i) {
+  if (plan->action == SECTOR_ERASE) return image[i] != 0xff;
+  return image[i] != chip[i];
+}
+
+/** Works out what to do with each sector to change chip, the current
+ *  contents of size bytes starting at start_address, into image. Fills
+ *  in plans and returns the number of sectors that need work. */
+static size_t plan_sectors(sector_plan_t *plans, uint32_t start_address,
+                           const uint8_t *chip, const uint8_t *image,
+                           size_t size) {
+  size_t offset, i, busy = 0;
+  sector_plan_t *plan = plans;
+  for (offset = 0; offset < size; offset += SECTOR_SIZE, plan++) {
+    plan->address = start_address + offset;
+    plan->size = size - offset < SECTOR_SIZE ? size - offset : SECTOR_SIZE;
+    if (memcmp(chip + offset, image + offset, plan->size) == 0) {
+      plan->action = SECTOR_SKIP;
+    } else if (need_erase(chip + offset, image + offset, plan->size)) {
+      plan->action = SECTOR_ERASE;
+    } else {
+      plan->action = SECTOR_PATCH;
+    }
+    plan->writes = 0;
+    for (i = 0; i < plan->size; i++) {
+      if (needs_write(plan, chip + offset, image + offset, i)) plan->writes++;
+    }
+    if (plan->action != SECTOR_SKIP) busy++;
+  }
+  return busy;
+}
+
+/** Prints the sectors that need work and an estimate of how long that
+ *  and reading them back will take. */
+static void print_plan(const sector_plan_t *plans, size_t sectors) {
+  size_t i, erases = 0, writes = 0, reads = 0;
+  for (i = 0; i < sectors; i++) {
+    if (plans[i].action == SECTOR_SKIP) continue;
+    log_debug("Sector %08x: %s %lu bytes\n", plans[i].address,
+              plans[i].action == SECTOR_ERASE ? "erase and write" : "patch",
+              (unsigned long) plans[i].writes);
+    if (plans[i].action == SECTOR_ERASE) erases++;
+    writes += plans[i].writes;
+    reads += plans[i].size;
+  }
+  log_debug("%lu of %lu sectors to erase, %lu bytes to write,"
+            " about %.1f s\n", (unsigned long) erases,
+            (unsigned long) sectors, (unsigned long) writes,
+            (erases * (double) ERASE_ESTIMATE_NS +
+             writes * (double) PROGRAM_ESTIMATE_NS +
+             reads * (double) READ_ESTIMATE_NS) / 1e9);
+}
+
+static void execute_plan(gpio_t *gpio, const sector_plan_t *plans,
+                         size_t sectors, uint32_t start_address,
+                         const uint8_t *chip, const uint8_t *image) {
+  size_t n, i, offset;
+  const sector_plan_t *plan;
+  for (n = 0; n < sectors; n++) {
+    plan = &plans[n];
+    if (plan->action == SECTOR_SKIP) continue;
+    if (plan->action == SECTOR_ERASE) erase_sector(gpio, plan->address);
+    offset = plan->address - start_address;
+    for (i = 0; i < plan->size; i++) {
+      if (needs_write(plan, chip + offset, image + offset, i)) {
+        write_byte(gpio, plan->address + i, image[offset + i]);
+      }
+    }
+  }
+}
+
+/** Reads back the sectors that plans changed. The others were read just
+ *  before and did not need to change. */
+static void verify_plan(gpio_t *gpio, const sector_plan_t *plans,
+                        size_t sectors, uint32_t start_address,
+                        uint8_t *chip) {
+  size_t n;
+  for (n = 0; n < sectors; n++) {
+    if (plans[n].action == SECTOR_SKIP) continue;
+    read_bytes(gpio, plans[n].address,
+               chip + (plans[n].address - start_address), plans[n].size);
+  }
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-n] [file [start_address [length]]]\n",
+          argv0);
+  exit(1);
 }
 
 int main(int argc, char *argv[]) {
-  uint32_t address, changed;
-  uint32_t start_address = 0, end_address;
+  uint32_t start_address = 0;
   uint32_t length = 0x200;
   gpio_t gpio;
   gpio_functions_t saved_functions;
   FILE *input = NULL;
-  uint8_t buffer[SECTOR_SIZE], sector[SECTOR_SIZE];
-  size_t bytes_read, difference_index;
-  int attempts;
+  static uint8_t image[CHIP_SIZE], chip[CHIP_SIZE];
+  sector_plan_t plans[CHIP_SIZE / SECTOR_SIZE];
+  size_t size, sectors, i;
+  bool dry_run = false;
+  int opt, attempts = 0, result = 0;
+
+  while ((opt = getopt(argc, argv, "n")) != -1) {
+    switch (opt) {
+    case 'n':
+      dry_run = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
 
   if (argc > 2) {
     start_address = atol(argv[2]);
@@ -250,95 +377,69 @@ int main(int argc, char *argv[]) {
   if (argc > 3) {
     length = atol(argv[3]);
   }
-  end_address = start_address + length - 1;
   
   if (start_address & ~SECTOR_MASK) {
     fprintf(
         stderr,
         "start address %u is not on a sector boundary"
-        " (needs to be a multiple of %u)",
+        " (needs to be a multiple of %u)\n",
         start_address, SECTOR_SIZE);
     return 1;
   }
 
+  if (start_address >= CHIP_SIZE || length > CHIP_SIZE - start_address) {
+    fprintf(stderr, "range does not fit in the chip (%u bytes)\n",
+            CHIP_SIZE);
+    return 1;
+  }
+
   if (argc > 1) {
     input = fopen(argv[1], "rb");
     if (!input) {
       perror(argv[1]);
       return 1;
     }
+    size = fread(image, 1, length, input);
+    if (ferror(input)) {
+      fprintf(stderr, "Error reading input - aborting\n");
+      return 1;
+    }
+    fclose(input);
+  } else {
+    size = length;
+    for (i = 0; i < size; i++) image[i] = (uint8_t) (i & 0xff);
   }
+  log_debug("Read %lu bytes of input\n", (unsigned long) size);
   
   if (init_gpio(&gpio)) return 1;
-  copy_gpio_functions(&saved_functions, gpio.functions);
+  get_gpio_functions(&gpio, &saved_functions);
   configure_pins(&gpio);
   enable_chip(&gpio);
 
-  address = start_address;
-  while (address <= end_address) {
-    /* Get next SECTOR_SIZE bytes of input. */
-    if (input) {
-      bytes_read = fread(buffer, 1, SECTOR_SIZE, input);
-      if (ferror(input)) {
-        fprintf(stderr, "Error reading input - aborting\n");
-        return 1;
-      }
-      if (bytes_read == 0) break;
-    } else {
-      for (bytes_read = 0; bytes_read < SECTOR_SIZE; bytes_read++) {
-        buffer[bytes_read] = (uint8_t) (bytes_read & 0xff);
-      }
+  /* Read the whole range once, work out what needs to change, do that,
+     and read back what was changed to verify. */
+  read_bytes(&gpio, start_address, chip, size);
+  sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  for (;;) {
+    if (plan_sectors(plans, start_address, chip, image, size) == 0) {
+      log_debug("%lu bytes at %08x verified\n", (unsigned long) size,
+                start_address);
+      break;
     }
-
-    /* Make sure we don't process past end_address. */
-    if (address + bytes_read > end_address)
-      bytes_read = end_address - address + 1;
-    log_debug("Read %lu bytes of input\n", bytes_read);
-
-    attempts = 3;
-    for (;;) {
-      /* Read an equal number of bytes from the chip. */
-      log_debug("Checking contents of sector %08x\n", address);
-      read_bytes(&gpio, address, sector, bytes_read);
-      if (compare_sectors(sector, buffer, bytes_read, 0) == SECTORS_EQUAL) {
-        log_debug("Sector %08x verified\n", address);
-        break;
-      } else if (attempts <= 0) {
-        fprintf(stderr, "Sector %08x still incorrect; giving up\n", address);
-        return 1;
-      }
-
-      if (need_erase(sector, buffer, bytes_read)) {
-        log_debug("Erasing and writing sector %08x\n", address);
-        erase_sector(&gpio, address);
-        write_bytes(&gpio, address, buffer, bytes_read);
-      } else {
-        log_debug("Updating sector %08x\n", address);
-        difference_index = 0;
-        changed = 0;
-        for (;;) {
-          difference_index = compare_sectors(
-              sector,
-              buffer,
-              bytes_read,
-              difference_index);
-          if (difference_index == SECTORS_EQUAL) break;
-          write_byte(&gpio,
-                     address + difference_index,
-                     buffer[difference_index]);
-          ++difference_index;
-          ++changed;
-        }
-        log_debug("%u bytes changed\n", changed);
-      }
-      attempts--;
+    print_plan(plans, sectors);
+    if (dry_run) break;
+    if (attempts++ == MAX_ATTEMPTS) {
+      fprintf(stderr, "Still incorrect after %d attempts; giving up\n",
+              MAX_ATTEMPTS);
+      result = 1;
+      break;
     }
-
-    address += bytes_read;
+    execute_plan(&gpio, plans, sectors, start_address, chip, image);
+    verify_plan(&gpio, plans, sectors, start_address, chip);
   }
 
   disable_chip(&gpio);
-  copy_gpio_functions(gpio.functions, &saved_functions);
+  set_gpio_functions(&gpio, &saved_functions);
   fini_gpio(&gpio);
-  return 0;
+  return result;
 }